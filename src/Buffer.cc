@@ -15,18 +15,46 @@
  *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
  */
  
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string>
+#include <stdexcept>
+
 #include "Buffer.hh"
 
-Buffer::Buffer(size_t _size) : size(_size) {
-    buffer = new char[size*2];
-    r_ptr = w_ptr = buffer;
+Buffer::Buffer(size_t _size) : waiting(0), w_pos(0), r_pos(0) {
+    //both mappings of the ring must be page aligned
+    const size_t page = sysconf(_SC_PAGESIZE);
+    size = _size%page ? (_size/page+1)*page : _size;
+    
+    int fd = memfd_create("Buffer",0);
+    if (fd < 0) throw std::runtime_error("Buffer: could not create ring memory");
+    if (ftruncate(fd,size)) {
+        close(fd);
+        throw std::runtime_error("Buffer: could not allocate " + std::to_string(size) + " bytes");
+    }
+    
+    //reserve twice the size, then map the same pages into each half
+    void *base = mmap(NULL,2*size,PROT_NONE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("Buffer: could not reserve ring address space");
+    }
+    buffer = (char*)base;
+    if (mmap(buffer,size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_FIXED,fd,0) == MAP_FAILED ||
+        mmap(buffer+size,size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_FIXED,fd,0) == MAP_FAILED) {
+        munmap(base,2*size);
+        close(fd);
+        throw std::runtime_error("Buffer: could not map ring memory");
+    }
+    close(fd);
+    
     pthread_mutex_init(&mutex,NULL);
     pthread_cond_init(&cond, NULL);
 }
 
 Buffer::~Buffer() {
-    delete [] buffer;
+    munmap(buffer,2*size);
     pthread_mutex_destroy(&mutex);
     pthread_cond_destroy(&cond);
 }
-
@@ -15,12 +15,18 @@
  *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <atomic>
 #include <pthread.h>
 #include <cstring>
 
 #ifndef Buffer__hh
 #define Buffer__hh
 
+// Single-producer single-consumer ring buffer for readout data. The readout 
+// thread is the only caller of free/wptr/inc and the decode thread is the only
+// caller of fill/rptr/dec, so positions are published with atomics instead of a
+// lock. The ring is mapped twice back-to-back in virtual memory, so any span of
+// up to size bytes starting at wptr() or rptr() is contiguous even if it wraps.
 class Buffer {
     public:
         Buffer(size_t _size);
@@ -32,64 +38,62 @@ class Buffer {
         }
         
         inline size_t free() {
-            pthread_mutex_lock(&mutex);
-            const size_t amt = size - (w_ptr - r_ptr);
-            pthread_mutex_unlock(&mutex);
-            return amt;
+            return size - (w_pos.load(std::memory_order_acquire) - r_pos.load(std::memory_order_acquire));
         }
         
         inline size_t fill() {
-            pthread_mutex_lock(&mutex);
-            const size_t amt = w_ptr - r_ptr;
-            pthread_mutex_unlock(&mutex);
-            return amt;
+            return w_pos.load(std::memory_order_acquire) - r_pos.load(std::memory_order_acquire);
         }
         
         inline void inc(size_t amt) {
-            pthread_mutex_lock(&mutex);
-            w_ptr += amt;
-            if ((size_t)(r_ptr - buffer) >= size) {
-                const size_t total = w_ptr - r_ptr;
-                memmove(buffer,r_ptr,total);
-                r_ptr = buffer;
-                w_ptr = buffer + total;
+            w_pos.fetch_add(amt);
+            if (waiting.load()) {
+                pthread_mutex_lock(&mutex);
+                pthread_mutex_unlock(&mutex);
+                pthread_cond_signal(&cond);
             }
-            pthread_mutex_unlock(&mutex);
-            pthread_cond_signal(&cond);
         }
         
         inline void dec(size_t amt) {
-            pthread_mutex_lock(&mutex);
-            r_ptr += amt;
-            pthread_mutex_unlock(&mutex);
+            r_pos.fetch_add(amt,std::memory_order_release);
         }
         
         inline char* wptr() {
-            pthread_mutex_lock(&mutex);
-            char *ptr = w_ptr;
-            pthread_mutex_unlock(&mutex);
-            return ptr;
+            return buffer + w_pos.load(std::memory_order_relaxed) % size;
         }
         
         inline char* rptr() {
-            pthread_mutex_lock(&mutex);
-            char *ptr = r_ptr;
-            pthread_mutex_unlock(&mutex);
-            return ptr;
+            return buffer + r_pos.load(std::memory_order_relaxed) % size;
         }
         
         inline void ready() {
             pthread_mutex_lock(&mutex);
-            while (w_ptr - r_ptr == 0) pthread_cond_wait(&cond,&mutex);
+            waiting.fetch_add(1);
+            while (w_pos.load() == r_pos.load()) pthread_cond_wait(&cond,&mutex);
+            waiting.fetch_sub(1);
             pthread_mutex_unlock(&mutex);
         }
         
+        inline size_t capacity() {
+            return size;
+        }
+        
     protected:
+        //only used to block in ready()
         pthread_mutex_t mutex;
         pthread_cond_t cond;
-        char *buffer, *r_ptr, *w_ptr;
+        std::atomic<int> waiting;
+        
+        //total bytes ever written and read, position in ring is modulo size
+        //(padded apart so the two threads do not share a cache line)
+        char pad0[64];
+        std::atomic<size_t> w_pos;
+        char pad1[64];
+        std::atomic<size_t> r_pos;
+        char pad2[64];
+        
+        char *buffer;
         size_t size;
 };
 
 #endif
-
@@ -0,0 +1,245 @@
+/**
+ *  Copyright 2014 by Benjamin Land (a.k.a. BenLand100)
+ *
+ *  WbLSdaq is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  WbLSdaq is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <stdexcept>
+#include <zlib.h>
+
+#include "Compression.hh"
+
+using namespace std;
+using namespace H5;
+
+Compression::Compression() : chunk_events(0), shuffle(false), filter(0), level(0) {
+}
+
+Compression::Compression(const json::Value &conf) : Compression() {
+    chunk_events = conf["chunk_events"].cast<int>();
+    if (conf.isMember("shuffle")) shuffle = conf["shuffle"].cast<bool>();
+    if (conf.isMember("filter")) {
+        if (conf["filter"].getType() == json::TSTRING) {
+            const string name = conf["filter"].cast<string>();
+            if (name == "deflate") {
+                filter = H5Z_FILTER_DEFLATE;
+            } else if (name != "none") {
+                throw runtime_error("Unknown compression filter: " + name);
+            }
+        } else {
+            filter = conf["filter"].cast<int>();
+        }
+    }
+    level = conf.isMember("level") ? conf["level"].cast<int>() : 4;
+    if (conf.isMember("options")) {
+        vector<int> values = conf["options"].toVector<int>();
+        for (size_t i = 0; i < values.size(); i++) options.push_back(values[i]);
+    }
+    if (filter == H5Z_FILTER_DEFLATE && (level < 0 || level > 9)) throw runtime_error("Deflate level must be 0 to 9");
+    if (filter && H5Zfilter_avail(filter) <= 0) throw runtime_error("HDF5 filter " + to_string(filter) + " is not available");
+    if ((shuffle || filter) && !chunk_events) throw runtime_error("Filtered datasets need chunk_events");
+}
+
+DSetCreatPropList Compression::properties(size_t nevents, size_t width) const {
+    DSetCreatPropList props;
+    //chunks may not be larger than a fixed size dataset
+    if (!chunk_events || !nevents || !width) return props;
+    hsize_t dims[2] = { chunk_events < nevents ? chunk_events : nevents, width };
+    props.setChunk(2, dims);
+    if (shuffle) props.setShuffle();
+    if (filter == H5Z_FILTER_DEFLATE) {
+        props.setDeflate(level);
+    } else if (filter) {
+        props.setFilter(filter, H5Z_FLAG_MANDATORY, options.size(), options.data());
+    }
+    return props;
+}
+
+DSetCreatPropList Compression::extendible(size_t width) const {
+    DSetCreatPropList props;
+    hsize_t dims[2] = { chunk_events ? chunk_events : (width ? 64 : 4096), width };
+    props.setChunk(width ? 2 : 1, dims);
+    if (shuffle) props.setShuffle();
+    if (filter == H5Z_FILTER_DEFLATE) {
+        props.setDeflate(level);
+    } else if (filter) {
+        props.setFilter(filter, H5Z_FLAG_MANDATORY, options.size(), options.data());
+    }
+    return props;
+}
+
+bool Compression::direct() const {
+    return !filter || filter == H5Z_FILTER_DEFLATE;
+}
+
+ChunkCompressor::ChunkCompressor(size_t nthreads) : quit(false), next(0), compression(NULL), store(NULL) {
+    pthread_mutex_init(&mutex,NULL);
+    pthread_cond_init(&work,NULL);
+    pthread_cond_init(&done,NULL);
+    workers.resize(nthreads);
+    for (size_t i = 0; i < workers.size(); i++) {
+        pthread_create(&workers[i],NULL,&ChunkCompressor::worker_thread,this);
+    }
+}
+
+ChunkCompressor::~ChunkCompressor() {
+    pthread_mutex_lock(&mutex);
+    quit = true;
+    pthread_cond_broadcast(&work);
+    pthread_mutex_unlock(&mutex);
+    for (size_t i = 0; i < workers.size(); i++) {
+        pthread_join(workers[i],NULL);
+    }
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&work);
+    pthread_cond_destroy(&done);
+}
+
+void ChunkCompressor::writeChunks(DataSet &dataset, const Compression &_compression, EventStore &_store, size_t _column, size_t n, size_t _width, size_t _elemsize, hsize_t row) {
+    //extendible datasets have whole chunks even when holding fewer events
+    hsize_t dims[2];
+    dataset.getCreatePlist().getChunk(2, dims);
+    
+    pthread_mutex_lock(&mutex);
+    compression = &_compression;
+    store = &_store;
+    column = _column;
+    width = _width;
+    elemsize = _elemsize;
+    chunk_rows = dims[0];
+    error.clear();
+
+    //a few chunks per thread are in flight at a time to bound memory
+    const size_t window = 4*workers.size();
+    for (size_t first = 0; first < n && error.empty(); ) {
+        chunks.resize(0);
+        for ( ; first < n && chunks.size() < window; first += chunk_rows) {
+            chunk c;
+            c.first = first;
+            c.rows = n - first < chunk_rows ? n - first : chunk_rows;
+            c.done = false;
+            chunks.push_back(c);
+        }
+        next = 0;
+        pthread_cond_broadcast(&work);
+        for (size_t i = 0; i < chunks.size(); i++) {
+            while (!chunks[i].done) pthread_cond_wait(&done,&mutex);
+            if (error.size()) break;
+            //workers only touch chunks they have not yet finished
+            pthread_mutex_unlock(&mutex);
+            hsize_t offset[2] = { row + chunks[i].first, 0 };
+            const herr_t res = H5Dwrite_chunk(dataset.getId(), H5P_DEFAULT, 0, offset, chunks[i].data.size(), chunks[i].data.data());
+            vector<char>().swap(chunks[i].data);
+            pthread_mutex_lock(&mutex);
+            if (res < 0 && error.empty()) error = "Direct chunk write failed";
+        }
+        //after a failure, chunks not yet taken are dropped and those being
+        //compressed must finish before the window is reused
+        const size_t taken = next;
+        next = chunks.size();
+        for (size_t i = 0; i < taken; i++) {
+            while (!chunks[i].done) pthread_cond_wait(&done,&mutex);
+        }
+    }
+
+    const string failed = error;
+    chunks.resize(0);
+    store = NULL;
+    pthread_mutex_unlock(&mutex);
+    if (failed.size()) throw runtime_error(failed);
+}
+
+void ChunkCompressor::compress(chunk &c) {
+    //edge chunks are written whole, padded with zeros
+    const size_t rowbytes = width*elemsize;
+    const size_t bytes = chunk_rows*rowbytes;
+    vector<char> raw(bytes, 0);
+    for (size_t i = 0; i < c.rows; ) {
+        const size_t rows = store->span(c.first+i, c.rows-i);
+        memcpy(raw.data() + i*rowbytes, store->at<char>(column, c.first+i), rows*rowbytes);
+        i += rows;
+    }
+
+    //same byte order as HDF5's shuffle filter: every element's first byte,
+    //then every second byte, ...
+    if (compression->shuffle && elemsize > 1) {
+        vector<char> shuffled(bytes);
+        const size_t nelems = bytes/elemsize;
+        for (size_t b = 0; b < elemsize; b++) {
+            char *out = shuffled.data() + b*nelems;
+            const char *in = raw.data() + b;
+            for (size_t e = 0; e < nelems; e++) out[e] = in[e*elemsize];
+        }
+        raw.swap(shuffled);
+    }
+
+    if (compression->filter == H5Z_FILTER_DEFLATE) {
+        uLongf size = compressBound(bytes);
+        c.data.resize(size);
+        const int res = compress2((Bytef*)c.data.data(), &size, (const Bytef*)raw.data(), bytes, compression->level);
+        if (res != Z_OK) throw runtime_error("Deflating a chunk failed: " + to_string(res));
+        c.data.resize(size);
+    } else {
+        c.data.swap(raw);
+    }
+}
+
+void *ChunkCompressor::worker_thread(void *_self) {
+    ChunkCompressor *self = (ChunkCompressor*)_self;
+    pthread_mutex_lock(&self->mutex);
+    while (true) {
+        while (!self->quit && self->next >= self->chunks.size()) pthread_cond_wait(&self->work,&self->mutex);
+        if (self->quit) break;
+        chunk &c = self->chunks[self->next++];
+        pthread_mutex_unlock(&self->mutex);
+        string failed;
+        try {
+            self->compress(c);
+        } catch (exception &e) {
+            failed = e.what();
+        }
+        pthread_mutex_lock(&self->mutex);
+        if (failed.size() && self->error.empty()) self->error = failed;
+        c.done = true;
+        pthread_cond_broadcast(&self->done);
+    }
+    pthread_mutex_unlock(&self->mutex);
+    pthread_exit(NULL);
+}
+
+DataSet outputDataSet(H5File &file, const string &path, const DataType &type, size_t n, size_t width, const Compression &compression, bool append, hsize_t &row) {
+    const int rank = width ? 2 : 1;
+    hsize_t dims[2] = { n, width };
+    row = 0;
+    if (!append) {
+        DataSpace space(rank, dims);
+        return file.createDataSet(path, type, space, width ? compression.properties(n, width) : DSetCreatPropList());
+    }
+    if (outputExists(file, path)) {
+        DataSet dataset = file.openDataSet(path);
+        dataset.getSpace().getSimpleExtentDims(dims);
+        row = dims[0];
+        dims[0] += n;
+        dataset.extend(dims);
+        return dataset;
+    }
+    hsize_t maxdims[2] = { H5S_UNLIMITED, width };
+    DataSpace space(rank, dims, maxdims);
+    return file.createDataSet(path, type, space, width ? compression.extendible(width) : Compression().extendible(0));
+}
+
+bool outputExists(H5File &file, const string &path) {
+    return H5Lexists(file.getId(), path.c_str(), H5P_DEFAULT) > 0;
+}
@@ -0,0 +1,132 @@
+/**
+ *  Copyright 2014 by Benjamin Land (a.k.a. BenLand100)
+ *
+ *  WbLSdaq is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  WbLSdaq is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+#include <string>
+#include <pthread.h>
+#include <H5Cpp.h>
+
+#include "json.hh"
+#include "EventStore.hh"
+
+#ifndef Compression__hh
+#define Compression__hh
+
+// Layout of a card's trace datasets (samples, probes): contiguous by default,
+// or in chunks of chunk_events traces, optionally byte shuffled and filtered.
+// The per event datasets are always contiguous.
+class Compression {
+
+    public:
+
+        //contiguous
+        Compression();
+
+        //from a card's compression table, e.g.
+        //{ chunk_events: 256, shuffle: true, filter: "deflate", level: 4 }
+        //where filter may also be the id of any filter HDF5 can load, with
+        //its parameters as options: [...]
+        Compression(const json::Value &conf);
+
+        //creation properties for a dataset of nevents traces of width values
+        H5::DSetCreatPropList properties(size_t nevents, size_t width) const;
+
+        //creation properties for an extendible dataset of traces of width
+        //values, or of single values if width is 0, chunked by chunk_events
+        //(64 traces or 4096 values if unset)
+        H5::DSetCreatPropList extendible(size_t width) const;
+
+        //true if ChunkCompressor can do the filtering itself
+        bool direct() const;
+
+        size_t chunk_events; //0 for contiguous
+        bool shuffle;
+        int filter; //0 for none
+        int level;
+        std::vector<unsigned int> options;
+
+};
+
+// Threads that shuffle and deflate the chunks of trace datasets, which the
+// calling thread writes out directly as they finish, so compression does not
+// hold up the writer. Filters other than shuffle and deflate are run by HDF5
+// on the calling thread.
+class ChunkCompressor {
+
+    public:
+
+        //without threads HDF5 does all filtering
+        ChunkCompressor(size_t nthreads);
+
+        virtual ~ChunkCompressor();
+
+        //writes the n oldest events of column (rows of width values) into
+        //rows [row,row+n) of dataset, created with compression's properties;
+        //rows not starting a chunk are left to HDF5
+        template <typename T> void write(H5::DataSet &dataset, const H5::DataType &type, const Compression &compression, EventStore &store, size_t column, size_t n, size_t width, hsize_t row = 0) {
+            if (!workers.size() || !compression.chunk_events || !compression.direct() || !n || !width || row%compression.chunk_events) {
+                store.write<T>(dataset, type, column, n, width, row);
+            } else if (!store.counting()) {
+                writeChunks(dataset, compression, store, column, n, width, sizeof(T), row);
+            }
+        }
+
+        inline size_t threads() {
+            return workers.size();
+        }
+
+    protected:
+
+        typedef struct {
+            size_t first, rows;
+            std::vector<char> data;
+            bool done;
+        } chunk;
+
+        pthread_mutex_t mutex;
+        pthread_cond_t work, done;
+        std::vector<pthread_t> workers;
+        bool quit;
+
+        //chunks of the dataset being written, all guarded by mutex
+        std::vector<chunk> chunks;
+        size_t next;
+        const Compression *compression;
+        EventStore *store;
+        size_t column, width, elemsize, chunk_rows;
+        std::string error;
+
+        void writeChunks(H5::DataSet &dataset, const Compression &compression, EventStore &store, size_t column, size_t n, size_t width, size_t elemsize, hsize_t row);
+
+        //gathers, shuffles, and deflates a chunk, called without mutex
+        void compress(chunk &c);
+
+        static void *worker_thread(void *_self);
+
+};
+
+// The dataset at path for n more rows of width values (single values if width
+// is 0). It is created to fit them, or when appending, created extendible on
+// the first batch and extended by n on later ones. row is set to where the new
+// rows start.
+H5::DataSet outputDataSet(H5::H5File &file, const std::string &path, const H5::DataType &type, size_t n, size_t width, const Compression &compression, bool append, hsize_t &row);
+
+// True if path already exists in file, as it does for groups written by an
+// earlier batch when appending
+bool outputExists(H5::H5File &file, const std::string &path);
+
+#endif
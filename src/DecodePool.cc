@@ -0,0 +1,95 @@
+/**
+ *  Copyright 2014 by Benjamin Land (a.k.a. BenLand100)
+ *
+ *  WbLSdaq is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  WbLSdaq is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdexcept>
+
+#include "DecodePool.hh"
+
+using namespace std;
+
+DecodePool::DecodePool(size_t nthreads) : quit(false), generation(0), next(0), pending(0), decoders(NULL), buffers(NULL) {
+    pthread_mutex_init(&mutex,NULL);
+    pthread_cond_init(&work,NULL);
+    pthread_cond_init(&done,NULL);
+    workers.resize(nthreads > 1 ? nthreads-1 : 0);
+    for (size_t i = 0; i < workers.size(); i++) {
+        pthread_create(&workers[i],NULL,&DecodePool::worker_thread,this);
+    }
+}
+
+DecodePool::~DecodePool() {
+    pthread_mutex_lock(&mutex);
+    quit = true;
+    pthread_cond_broadcast(&work);
+    pthread_mutex_unlock(&mutex);
+    for (size_t i = 0; i < workers.size(); i++) {
+        pthread_join(workers[i],NULL);
+    }
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&work);
+    pthread_cond_destroy(&done);
+}
+
+void DecodePool::decode(vector<Decoder*> &_decoders, vector<Buffer*> &_buffers) {
+    pthread_mutex_lock(&mutex);
+    decoders = &_decoders;
+    buffers = &_buffers;
+    tasks.clear();
+    for (size_t i = 0; i < buffers->size(); i++) {
+        if ((*buffers)[i]->fill() > 0) tasks.push_back(i);
+    }
+    next = 0;
+    pending = tasks.size();
+    error.clear();
+    generation++;
+    if (tasks.size() > 1) pthread_cond_broadcast(&work);
+    runTasks();
+    while (pending) pthread_cond_wait(&done,&mutex);
+    const string failed = error;
+    pthread_mutex_unlock(&mutex);
+    if (failed.size()) throw runtime_error(failed);
+}
+
+void DecodePool::runTasks() {
+    while (next < tasks.size()) {
+        const size_t i = tasks[next++];
+        pthread_mutex_unlock(&mutex);
+        string failed;
+        try {
+            (*decoders)[i]->decode(*(*buffers)[i]);
+        } catch (exception &e) {
+            failed = e.what();
+        }
+        pthread_mutex_lock(&mutex);
+        if (failed.size() && error.empty()) error = failed;
+        if (--pending == 0) pthread_cond_signal(&done);
+    }
+}
+
+void *DecodePool::worker_thread(void *_self) {
+    DecodePool *self = (DecodePool*)_self;
+    pthread_mutex_lock(&self->mutex);
+    size_t seen = self->generation;
+    while (true) {
+        while (!self->quit && self->generation == seen) pthread_cond_wait(&self->work,&self->mutex);
+        if (self->quit) break;
+        seen = self->generation;
+        self->runTasks();
+    }
+    pthread_mutex_unlock(&self->mutex);
+    pthread_exit(NULL);
+}
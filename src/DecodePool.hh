@@ -0,0 +1,70 @@
+/**
+ *  Copyright 2014 by Benjamin Land (a.k.a. BenLand100)
+ *
+ *  WbLSdaq is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  WbLSdaq is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+#include <string>
+#include <pthread.h>
+
+#include "Digitizer.hh"
+#include "Buffer.hh"
+
+#ifndef DecodePool__hh
+#define DecodePool__hh
+
+// Runs Decoder::decode for every Buffer holding data, one task per Buffer, on
+// a pool of worker threads. A decoder only touches its own Buffer and event
+// storage, so tasks are independent. The calling thread works on tasks too,
+// and decode() returns only once all of them have finished.
+class DecodePool {
+
+    public:
+
+        //nthreads includes the calling thread, so 1 decodes sequentially
+        DecodePool(size_t nthreads);
+
+        virtual ~DecodePool();
+
+        //rethrows the first error any decoder raised
+        void decode(std::vector<Decoder*> &decoders, std::vector<Buffer*> &buffers);
+
+        inline size_t threads() {
+            return workers.size()+1;
+        }
+
+    protected:
+
+        pthread_mutex_t mutex;
+        pthread_cond_t work, done;
+        std::vector<pthread_t> workers;
+        bool quit;
+
+        //current batch of tasks, all guarded by mutex
+        size_t generation, next, pending;
+        std::vector<size_t> tasks;
+        std::vector<Decoder*> *decoders;
+        std::vector<Buffer*> *buffers;
+        std::string error;
+
+        static void *worker_thread(void *_self);
+
+        //takes tasks of the current generation until none are left, called
+        //and returns with mutex held
+        void runTasks();
+
+};
+
+#endif
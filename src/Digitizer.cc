@@ -15,8 +15,12 @@
  *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
  */
  
+#include <stdexcept>
+
 #include "Digitizer.hh"
 
+using namespace std;
+
     
 DigitizerSettings::DigitizerSettings(std::string _index) : index(_index) {
 
@@ -26,8 +30,30 @@ DigitizerSettings::~DigitizerSettings() {
 
 }
 
-Digitizer::Digitizer(VMEBridge &bridge, uint32_t baseaddr) : VMECard(bridge, baseaddr) {
+IntegrateSpec* DigitizerSettings::getIntegration(const string &channel) {
+    map<string,IntegrateSpec>::iterator it = integrations.find(channel);
+    return it == integrations.end() ? NULL : &it->second;
+}
+
+void DigitizerSettings::readIntegrations(RunDB &db) {
+    vector<RunTable> tables = db.getGroup("INTEGRATE");
+    const string prefix = "/" + index + "/";
+    for (size_t i = 0; i < tables.size(); i++) {
+        IntegrateSpec spec(tables[i]);
+        if (spec.channel.compare(0,prefix.size(),prefix) != 0) continue;
+        if (integrations.count(spec.channel)) throw runtime_error("Channel " + spec.channel + " has more than one INTEGRATE table");
+        integrations[spec.channel] = spec;
+    }
+}
 
+void DigitizerSettings::readCompression(RunTable &digitizer) {
+    if (digitizer.isMember("compression")) compression = Compression(digitizer["compression"]);
+}
+
+Digitizer::Digitizer(VMEBridge &bridge, uint32_t baseaddr) : VMECard(bridge, baseaddr) {
+    transfer_size = 0;
+    xfer_calls = xfer_bytes = xfer_empty = 0;
+    for (size_t i = 0; i < 32; i++) xfer_hist[i] = 0;
 }
 
 Digitizer::~Digitizer() {
@@ -36,10 +62,62 @@ Digitizer::~Digitizer() {
 
 size_t Digitizer::readoutBLT(char *buffer, size_t buffer_size) {
     size_t offset = 0, size = 0;
-    while (offset < buffer_size && (size = readBLT(0x0000, buffer+offset, 4093))) {
+    if (!transfer_size) {
+        while (offset < buffer_size) {
+            const size_t request = buffer_size-offset < 4093 ? buffer_size-offset : 4093;
+            size = readBLT(0x0000, buffer+offset, request);
+            recordTransfer(size);
+            if (!size) break;
+            offset += size;
+        }
+        return offset;
+    }
+    //decoders resume partial events, so this only stops when the board is
+    //empty or the buffer is full
+    while (true) {
+        const size_t free = (buffer_size-offset) & ~(size_t)7;
+        const size_t request = transfer_size < free ? transfer_size : free;
+        if (!request) break;
+        size = readFIFOBLT(0x0000, buffer+offset, request);
+        recordTransfer(size);
+        if (!size) break;
         offset += size;
     }
     return offset;
 }
 
+void Digitizer::setTransferSize(size_t bytes) {
+    transfer_size = bytes & ~(size_t)7;
+}
+
+void Digitizer::transferReport(ostream &out) {
+    out << "	calls: " << xfer_calls 
+        << "	MiB: " << xfer_bytes/1024.0/1024.0
+        << "	avg: " << (xfer_calls-xfer_empty ? xfer_bytes/(xfer_calls-xfer_empty) : 0) << " B/call"
+        << "	empty: " << xfer_empty << endl;
+    for (size_t bin = 0; bin < 32; bin++) {
+        if (!xfer_hist[bin]) continue;
+        out << "		[" << (1ul << bin) << ", " << (2ul << bin) << ") B: " << xfer_hist[bin] << endl;
+    }
+}
+
+bool Decoder::heldBack() {
+    return false;
+}
+
 void Decoder::dispatch(int nfd, int *fds) { }
+
+string Decoder::report() {
+    const string logged = log.str();
+    log.str("");
+    return logged;
+}
+
+DecodedBatch::DecodedBatch(Decoder *_decoder, vector<EventStore*> &_stores, size_t _nEvents) : decoder(_decoder), stores(_stores), nEvents(_nEvents) {
+}
+
+DecodedBatch::~DecodedBatch() {
+    for (size_t i = 0; i < stores.size(); i++) {
+        if (stores[i]) delete stores[i];
+    }
+}
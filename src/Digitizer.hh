@@ -16,9 +16,16 @@
  */
 
 #include <vector>
+#include <map>
+#include <ostream>
+#include <sstream>
 
 #include "VMECard.hh"
 #include "Buffer.hh"
+#include "RunDB.hh"
+#include "Integrate.hh"
+#include "EventStore.hh"
+#include "Compression.hh"
 #include <H5Cpp.h>
 
 #ifndef Digitizer__hh
@@ -34,9 +41,28 @@ class DigitizerSettings {
         
         inline std::string getIndex() { return index; }
         
+        //INTEGRATE table of a channel (e.g. /master/ch0), NULL if it has none
+        IntegrateSpec* getIntegration(const std::string &channel);
+        
+        inline std::map<std::string,IntegrateSpec>& getIntegrations() { return integrations; }
+        
+        //layout of the trace datasets
+        inline Compression& getCompression() { return compression; }
+        
     protected:
     
         std::string index;
+        
+        //by channel
+        std::map<std::string,IntegrateSpec> integrations;
+        
+        Compression compression;
+        
+        //reads the INTEGRATE tables naming channels of this digitizer
+        void readIntegrations(RunDB &db);
+        
+        //reads the optional compression table of this digitizer
+        void readCompression(RunTable &digitizer);
 
 };
 
@@ -62,7 +88,38 @@ class Digitizer : public VMECard {
         
         virtual bool readoutReady() = 0;
         
+        //raise a RORA interrupt on VME IRQ level while events (aggregates for
+        //DPP firmware) are stored, level 0 disables the interrupt
+        virtual void setInterrupt(uint32_t level, uint32_t events) = 0;
+        
         virtual size_t readoutBLT(char *buffer, size_t buffer_size);
+        
+        //0 keeps the 4093 byte BLT loop, otherwise FIFO BLTs of up to bytes
+        //(rounded down to the 8 byte MBLT word), which may end partway
+        //through an event
+        void setTransferSize(size_t bytes);
+        
+        //per call byte counts of every block transfer so far
+        void transferReport(std::ostream &out);
+        
+    protected:
+    
+        size_t transfer_size;
+        
+        size_t xfer_calls, xfer_bytes, xfer_empty;
+        size_t xfer_hist[32]; //calls by floor(log2(bytes moved))
+        
+        inline void recordTransfer(size_t bytes) {
+            xfer_calls++;
+            xfer_bytes += bytes;
+            if (!bytes) {
+                xfer_empty++;
+                return;
+            }
+            size_t bin = 0;
+            while (bytes >>= 1) bin++;
+            xfer_hist[bin < 31 ? bin : 31]++;
+        }
  
 };
 
@@ -76,6 +133,8 @@ inline void writeall(const int fd, const void *ptr, int len) {
     }
 }
 
+class DecodedBatch;
+
 class Decoder {
     
     public:
@@ -84,10 +143,57 @@ class Decoder {
         
         virtual size_t eventsReady() = 0;
         
-        virtual void writeOut(H5::H5File &file, size_t nEvents) = 0;
+        //moves the nEvents oldest events of every channel into a batch that
+        //can be written out on another thread while decoding carries on
+        virtual DecodedBatch* detach(size_t nEvents) = 0;
+        
+        //saves stores detached from this decoder, each holding nEvents, with
+        //this decoder's settings, compressing traces with compressor; with
+        //append the events go on the end of extendible datasets, which the
+        //first batch of the file creates. What is created is listed to out.
+        virtual void writeOut(H5::H5File &file, std::vector<EventStore*> &stores, size_t nEvents, ChunkCompressor &compressor, bool append, std::ostream &out) = 0;
+        
+        //bytes the last decode left in its Buffer, a trailing partial
+        //aggregate or data there was no event memory for
+        virtual size_t leftover() = 0;
+        
+        //true if the last decode held back whole aggregates for want of
+        //event memory, which only a writeout can give back
+        virtual bool heldBack();
         
         // length, lvdsidx, dsize, nsamples, samples[], strlen, strname[]
         virtual void dispatch(int nfd, int *fds);
+        
+        //what decoding has logged since the last call, which decode leaves
+        //to its caller to print since it may run on a pool thread
+        std::string report();
+        
+    protected:
+        
+        std::ostringstream log;
+};
+
+// A file's worth (or a streamed part of one) of events detached from a decoder, one store per store the
+// decoder keeps (NULL where it has none). Deleting it returns the events'
+// chunks to the pool.
+class DecodedBatch {
+
+    public:
+    
+        DecodedBatch(Decoder *decoder, std::vector<EventStore*> &stores, size_t nEvents);
+        
+        virtual ~DecodedBatch();
+        
+        inline void writeOut(H5::H5File &file, ChunkCompressor &compressor, bool append, std::ostream &out) {
+            decoder->writeOut(file,stores,nEvents,compressor,append,out);
+        }
+        
+    protected:
+    
+        Decoder *decoder;
+        std::vector<EventStore*> stores;
+        size_t nEvents;
+        
 };
 
 #endif
@@ -0,0 +1,185 @@
+/**
+ *  Copyright 2014 by Benjamin Land (a.k.a. BenLand100)
+ *
+ *  WbLSdaq is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  WbLSdaq is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdexcept>
+#include <string>
+#include <cstring>
+
+#include "EventStore.hh"
+
+using namespace std;
+
+EventPool::EventPool(size_t _chunk_bytes, size_t budget_bytes) : chunk_bytes(_chunk_bytes), used_chunks(0), failed(0), quotas(0), beyond(0) {
+    if (!chunk_bytes) throw runtime_error("Event chunks must be nonzero size");
+    pthread_mutex_init(&mutex,NULL);
+    setBudget(budget_bytes);
+}
+
+EventPool::~EventPool() {
+    for (size_t i = 0; i < spare.size(); i++) delete [] spare[i];
+    pthread_mutex_destroy(&mutex);
+}
+
+char* EventPool::take(size_t store, bool force) {
+    char *chunk = NULL;
+    pthread_mutex_lock(&mutex);
+    const bool guaranteed = held[store] < quota[store];
+    if (guaranteed || force || quotas + beyond < max_chunks) {
+        if (!guaranteed) beyond++;
+        held[store]++;
+        used_chunks++;
+        if (spare.size()) {
+            chunk = spare.back();
+            spare.pop_back();
+        } else {
+            chunk = new char[chunk_bytes];
+        }
+    } else {
+        failed++;
+    }
+    pthread_mutex_unlock(&mutex);
+    return chunk;
+}
+
+void EventPool::give(size_t store, char *chunk) {
+    pthread_mutex_lock(&mutex);
+    if (held[store] > quota[store]) beyond--;
+    held[store]--;
+    used_chunks--;
+    spare.push_back(chunk);
+    pthread_mutex_unlock(&mutex);
+}
+
+size_t EventPool::chunksFor(size_t store, size_t nEvents) {
+    //the oldest event can sit anywhere in its chunk
+    return nEvents/per_chunk[store] + (nEvents%per_chunk[store] ? 2 : 1);
+}
+
+size_t EventPool::bytesFor(size_t nEvents) {
+    size_t total = 0;
+    pthread_mutex_lock(&mutex);
+    for (size_t i = 0; i < per_chunk.size(); i++) {
+        total += chunksFor(i,nEvents)*chunk_bytes;
+    }
+    pthread_mutex_unlock(&mutex);
+    return total;
+}
+
+void EventPool::setQuota(size_t nEvents) {
+    pthread_mutex_lock(&mutex);
+    quotas = beyond = 0;
+    for (size_t i = 0; i < per_chunk.size(); i++) {
+        quota[i] = chunksFor(i,nEvents);
+        quotas += quota[i];
+        if (held[i] > quota[i]) beyond += held[i] - quota[i];
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+size_t EventPool::attach(size_t events_per_chunk) {
+    pthread_mutex_lock(&mutex);
+    const size_t id = per_chunk.size();
+    per_chunk.push_back(events_per_chunk);
+    held.push_back(0);
+    quota.push_back(0);
+    pthread_mutex_unlock(&mutex);
+    return id;
+}
+
+EventStore::EventStore() : pool(NULL), id(0), per_chunk(0), head(0), count(0) {
+}
+
+EventStore::EventStore(EventPool *_pool, const vector<size_t> &column_bytes) : pool(_pool), id(0), widths(column_bytes), head(0), count(0) {
+    if (!pool) {
+        per_chunk = 0;
+        return;
+    }
+    size_t row = 0;
+    for (size_t c = 0; c < widths.size(); c++) row += widths[c];
+    //columns start 8 byte aligned, which may cost a few events per chunk
+    for (per_chunk = pool->chunkBytes()/row; per_chunk > 0; per_chunk--) {
+        size_t pos = 0;
+        offsets.clear();
+        for (size_t c = 0; c < widths.size(); c++) {
+            offsets.push_back(pos);
+            pos = (pos + per_chunk*widths[c] + 7) & ~(size_t)7;
+        }
+        if (pos <= pool->chunkBytes()) break;
+    }
+    if (!per_chunk) throw runtime_error("Event chunks of " + to_string(pool->chunkBytes()) + " bytes cannot hold an event of " + to_string(row) + " bytes");
+    id = pool->attach(per_chunk);
+}
+
+EventStore::~EventStore() {
+    for (size_t i = 0; i < chunks.size(); i++) pool->give(id,chunks[i]);
+}
+
+bool EventStore::reserve(size_t n) {
+    if (!pool) return true;
+    while (chunks.size()*per_chunk < head + count + n) {
+        char *chunk = pool->take(id);
+        if (!chunk) return false;
+        chunks.push_back(chunk);
+    }
+    return true;
+}
+
+void EventStore::unreserved() {
+    throw runtime_error("Event stored without reserving room");
+}
+
+void EventStore::pop(size_t n) {
+    count -= n;
+    if (!pool) return;
+    head += n;
+    while (head >= per_chunk) {
+        pool->give(id,chunks.front());
+        chunks.pop_front();
+        head -= per_chunk;
+    }
+}
+
+EventStore* EventStore::detach(size_t n) {
+    EventStore *batch = new EventStore();
+    batch->pool = pool;
+    batch->id = id;
+    batch->offsets = offsets;
+    batch->widths = widths;
+    batch->per_chunk = per_chunk;
+    batch->head = head;
+    batch->count = n;
+    count -= n;
+    if (!pool) return batch;
+    const size_t end = head + n;
+    for (size_t i = 0; i < end/per_chunk; i++) {
+        batch->chunks.push_back(chunks.front());
+        chunks.pop_front();
+    }
+    head = end%per_chunk;
+    if (head) {
+        char *shared = chunks.front();
+        char *split = pool->take(id,true);
+        const size_t rows = (head + count < per_chunk ? head + count : per_chunk) - head;
+        for (size_t c = 0; c < widths.size(); c++) {
+            const size_t pos = offsets[c] + head*widths[c];
+            memcpy(split + pos, shared + pos, rows*widths[c]);
+        }
+        batch->chunks.push_back(shared);
+        chunks.front() = split;
+    }
+    return batch;
+}
@@ -0,0 +1,197 @@
+/**
+ *  Copyright 2014 by Benjamin Land (a.k.a. BenLand100)
+ *
+ *  WbLSdaq is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  WbLSdaq is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstddef>
+#include <vector>
+#include <deque>
+#include <pthread.h>
+#include <H5Cpp.h>
+
+#ifndef EventStore__hh
+#define EventStore__hh
+
+// Fixed-size chunks of event memory shared by all decoders, handed out until
+// a budget is spent. Each store is guaranteed enough chunks for a file's worth
+// of events, so a busy channel can only use up the rest of the budget. A
+// decoder reserving for several stores at once (a V1730 board aggregate) can
+// still be held back by its busy one, which the decode thread resolves by
+// cutting the file short, or fails on as an overflow if there is nothing to
+// write. Chunks given back are kept for reuse rather than freed. Decoders run
+// on several threads, so all of this is locked.
+class EventPool {
+
+    public:
+
+        EventPool(size_t chunk_bytes, size_t budget_bytes);
+
+        virtual ~EventPool();
+
+        //NULL if the budget is spent, unless forced over it for the one
+        //chunk detaching a batch of events can cost
+        char* take(size_t store, bool force = false);
+
+        void give(size_t store, char *chunk);
+
+        inline size_t chunkBytes() {
+            return chunk_bytes;
+        }
+
+        inline size_t budget() {
+            return max_chunks*chunk_bytes;
+        }
+
+        inline void setBudget(size_t budget_bytes) {
+            max_chunks = budget_bytes/chunk_bytes;
+        }
+
+        //times take found the budget spent
+        inline size_t misses() {
+            pthread_mutex_lock(&mutex);
+            const size_t n = failed;
+            pthread_mutex_unlock(&mutex);
+            return n;
+        }
+
+        //bytes the stores using this pool need to hold nEvents each
+        size_t bytesFor(size_t nEvents);
+
+        //guarantees each store room for nEvents, which bytesFor(nEvents) of
+        //the budget must cover
+        void setQuota(size_t nEvents);
+
+        //stores using this pool register their events per chunk to get an id
+        size_t attach(size_t events_per_chunk);
+
+    protected:
+
+        pthread_mutex_t mutex;
+        size_t chunk_bytes, max_chunks, used_chunks, failed;
+        std::vector<char*> spare;
+        
+        //per store events per chunk, chunks held, and chunks guaranteed
+        std::vector<size_t> per_chunk, held, quota;
+        size_t quotas, beyond; //sum of quotas, chunks held beyond them
+        
+        size_t chunksFor(size_t store, size_t nEvents);
+
+};
+
+// Events of one channel (or group) held in chunks from an EventPool. Each
+// event has a row in every column (samples, times, ...) and a chunk holds the
+// same number of events for all columns, each column contiguous within it.
+// Without a pool events are only counted.
+class EventStore {
+
+    public:
+
+        EventStore();
+
+        //column_bytes is the size of one event's row in each column
+        EventStore(EventPool *pool, const std::vector<size_t> &column_bytes);
+
+        virtual ~EventStore();
+
+        //events stored
+        inline size_t size() {
+            return count;
+        }
+
+        //true without a pool
+        inline bool counting() {
+            return !pool;
+        }
+
+        //makes room for n more events without further allocation, false if
+        //the pool could not provide it
+        bool reserve(size_t n);
+
+        //adds a newest event, throws if there was no room reserved for it
+        inline void push() {
+            if (pool && chunks.size()*per_chunk == head + count) unreserved();
+            count++;
+        }
+
+        //drops the n oldest events, returning emptied chunks to the pool
+        void pop(size_t n);
+
+        //moves the n oldest events into a new store, which returns their
+        //chunks to the pool once deleted. The chunk the n-th event ends in
+        //goes along, so the events after it are copied into a fresh one.
+        EventStore* detach(size_t n);
+
+        //chunk holding the i-th oldest event and its row there, to reach
+        //several of the event's columns with one lookup
+        inline char* chunk(size_t i, size_t &row) {
+            const size_t pos = head + i;
+            row = pos%per_chunk;
+            return chunks[pos/per_chunk];
+        }
+
+        template <typename T> inline T* in(char *chunk, size_t column, size_t row) {
+            return (T*)(chunk + offsets[column] + row*widths[column]);
+        }
+
+        //row of the i-th oldest event in column
+        template <typename T> inline T* at(size_t column, size_t i) {
+            size_t row;
+            char *c = chunk(i,row);
+            return in<T>(c,column,row);
+        }
+
+        template <typename T> inline T* back(size_t column) {
+            return at<T>(column,count-1);
+        }
+
+        //how many events from the i-th oldest on (up to n) are contiguous
+        inline size_t span(size_t i, size_t n) {
+            const size_t left = per_chunk - (head + i)%per_chunk;
+            return left < n ? left : n;
+        }
+
+        //writes the n oldest events of column (rows of width values) into
+        //rows [row,row+n) of dataset, one write per chunk (nothing without a
+        //pool)
+        template <typename T> void write(H5::DataSet &dataset, const H5::DataType &type, size_t column, size_t n, size_t width = 1, hsize_t row = 0) {
+            if (!pool) return;
+            H5::DataSpace filespace = dataset.getSpace();
+            const int rank = filespace.getSimpleExtentNdims();
+            for (size_t i = 0; i < n; ) {
+                hsize_t offset[2] = { row + i, 0 };
+                hsize_t rows[2] = { span(i,n-i), width };
+                filespace.selectHyperslab(H5S_SELECT_SET, rows, offset);
+                dataset.write(at<T>(column,i), type, H5::DataSpace(rank, rows), filespace);
+                i += rows[0];
+            }
+        }
+
+    protected:
+
+        EventPool *pool;
+        size_t id;
+        std::vector<size_t> offsets, widths;
+        size_t per_chunk, head, count;
+        std::deque<char*> chunks;
+
+        [[noreturn]] void unreserved() __attribute__((noinline,cold));
+
+        //stores own their chunks
+        EventStore(const EventStore &other);
+        EventStore& operator=(const EventStore &other);
+
+};
+
+#endif
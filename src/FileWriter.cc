@@ -0,0 +1,194 @@
+/**
+ *  Copyright 2014 by Benjamin Land (a.k.a. BenLand100)
+ *
+ *  WbLSdaq is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  WbLSdaq is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <H5Cpp.h>
+
+#include "FileWriter.hh"
+
+using namespace std;
+
+static double seconds_since(const struct timespec &start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    return (now.tv_sec - start.tv_sec)+1e-9*(now.tv_nsec - start.tv_nsec);
+}
+
+WriteJob::WriteJob() : opens(true), closes(true) {
+
+}
+
+WriteJob::~WriteJob() {
+
+}
+
+FileWriter::FileWriter(size_t _depth, size_t compress_threads, pthread_mutex_t *_iomutex, pthread_cond_t *_newdata) : iomutex(_iomutex), newdata(_newdata), compressor(compress_threads), depth(_depth), quit(false), finished(false) {
+    files = jobs = bytes = max_depth = 0;
+    write_s = max_write_s = queued_s = max_queued_s = push_wait_s = file_s = 0.0;
+    pthread_mutex_init(&mutex,NULL);
+    pthread_cond_init(&ready,NULL);
+    pthread_cond_init(&room,NULL);
+    pthread_create(&thread,NULL,&FileWriter::writer_thread,this);
+}
+
+FileWriter::~FileWriter() {
+    finish();
+    for (size_t i = 0; i < queue.size(); i++) delete queue[i];
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&ready);
+    pthread_cond_destroy(&room);
+}
+
+void FileWriter::push(WriteJob *job) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC,&start);
+    pthread_mutex_lock(&mutex);
+    //the front of the queue is the job being written
+    while (queue.size() > depth && failure.empty()) pthread_cond_wait(&room,&mutex);
+    if (failure.size()) {
+        const string failed = failure;
+        pthread_mutex_unlock(&mutex);
+        delete job;
+        throw runtime_error("Writing files failed: " + failed);
+    }
+    push_wait_s += seconds_since(start);
+    clock_gettime(CLOCK_MONOTONIC,&job->queued);
+    queue.push_back(job);
+    if (queue.size()-1 > max_depth) max_depth = queue.size()-1;
+    pthread_cond_signal(&ready);
+    pthread_mutex_unlock(&mutex);
+}
+
+void FileWriter::finish() {
+    pthread_mutex_lock(&mutex);
+    if (finished) {
+        pthread_mutex_unlock(&mutex);
+        return;
+    }
+    finished = quit = true;
+    pthread_cond_signal(&ready);
+    pthread_mutex_unlock(&mutex);
+    pthread_join(thread,NULL);
+}
+
+size_t FileWriter::written() {
+    pthread_mutex_lock(&mutex);
+    const size_t n = jobs;
+    pthread_mutex_unlock(&mutex);
+    return n;
+}
+
+size_t FileWriter::pending() {
+    pthread_mutex_lock(&mutex);
+    const size_t n = queue.size();
+    pthread_mutex_unlock(&mutex);
+    return n;
+}
+
+string FileWriter::error() {
+    pthread_mutex_lock(&mutex);
+    const string failed = failure;
+    pthread_mutex_unlock(&mutex);
+    return failed;
+}
+
+void FileWriter::report(ostream &out) {
+    pthread_mutex_lock(&mutex);
+    const double mib = bytes/1024.0/1024.0;
+    out << "Writer: " << files << " files in " << jobs << " writes\t" << mib << " MiB (" << (write_s > 0 ? mib/write_s : 0.0) << " MiB/s)"
+        << "\twrite: " << (jobs ? write_s/jobs : 0.0) << " s avg " << max_write_s << " s max"
+        << "\tqueued: " << (jobs ? queued_s/jobs : 0.0) << " s avg " << max_queued_s << " s max, " << max_depth << " / " << depth << " deep"
+        << "\tdecoding waited: " << push_wait_s << " s" << endl;
+    pthread_mutex_unlock(&mutex);
+}
+
+void *FileWriter::writer_thread(void *_self) {
+    FileWriter *self = (FileWriter*)_self;
+    self->run();
+    pthread_exit(NULL);
+}
+
+void FileWriter::run() {
+    pthread_mutex_lock(&mutex);
+    while (true) {
+        while (!quit && queue.empty()) pthread_cond_wait(&ready,&mutex);
+        if (queue.empty()) break;
+        WriteJob *job = queue.front();
+        const bool skip = failure.size();
+        pthread_mutex_unlock(&mutex);
+
+        const double waited = seconds_since(job->queued);
+        if (!skip && job->opens) {
+            pthread_mutex_lock(iomutex);
+            cout << "Saving data to " << job->fname << endl;
+            pthread_mutex_unlock(iomutex);
+        }
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC,&start);
+        string failed;
+        size_t size = 0;
+        //decoding prints while this writes, so the listing waits for iomutex
+        ostringstream listing;
+        try {
+            if (!skip) size = job->write(compressor,listing);
+        } catch (exception &e) {
+            failed = e.what();
+        } catch (H5::Exception &e) {
+            failed = e.getDetailMsg();
+        }
+        const double took = seconds_since(start);
+        const string fname = job->fname;
+        const bool opens = job->opens, closes = job->closes;
+        //the job holds the events' memory until it is gone
+        delete job;
+
+        pthread_mutex_lock(&mutex);
+        queue.pop_front();
+        const size_t waiting = queue.size();
+        pthread_cond_signal(&room);
+        if (failed.size() && failure.empty()) failure = fname + ": " + failed;
+        if (!skip && failed.empty()) {
+            jobs++;
+            if (opens) file_s = 0.0;
+            file_s += took;
+            if (closes) {
+                files++;
+                bytes += size;
+            }
+            write_s += took;
+            queued_s += waited;
+            if (took > max_write_s) max_write_s = took;
+            if (waited > max_queued_s) max_queued_s = waited;
+        }
+        const double file_took = file_s;
+        pthread_mutex_unlock(&mutex);
+
+        pthread_mutex_lock(iomutex);
+        cout << listing.str();
+        if (!skip && failed.empty() && closes) {
+            cout << "Wrote " << fname << " (" << size/1024.0/1024.0 << " MiB) in " << file_took << " s after " << waited << " s queued, " << waiting << " writes waiting" << endl;
+        }
+        pthread_cond_signal(newdata);
+        pthread_mutex_unlock(iomutex);
+
+        pthread_mutex_lock(&mutex);
+    }
+    pthread_mutex_unlock(&mutex);
+}
@@ -0,0 +1,111 @@
+/**
+ *  Copyright 2014 by Benjamin Land (a.k.a. BenLand100)
+ *
+ *  WbLSdaq is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  WbLSdaq is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <deque>
+#include <string>
+#include <ostream>
+#include <ctime>
+#include <pthread.h>
+
+#include "Compression.hh"
+
+#ifndef FileWriter__hh
+#define FileWriter__hh
+
+// Everything that goes into one output file, or a part of it when a file is
+// streamed out over several jobs, owned by the job so it can be written while
+// the data for the next one is still being decoded.
+class WriteJob {
+
+    public:
+
+        //a whole file
+        WriteJob();
+
+        virtual ~WriteJob();
+
+        //writes to the file, listing what it creates to out, returns its size
+        //in bytes once closed
+        virtual size_t write(ChunkCompressor &compressor, std::ostream &out) = 0;
+
+        std::string fname;
+
+        //whether this job creates the file, and whether it finishes it
+        bool opens, closes;
+
+        struct timespec queued;
+
+};
+
+// Writes files on its own thread, in the order they were queued. At most depth
+// jobs wait behind the one being written, beyond that push waits for room.
+// Once a write fails the error is kept and later jobs are dropped unwritten.
+class FileWriter {
+
+    public:
+
+        //signals newdata (under iomutex) after each job, as writing frees
+        //the event memory decoders may be waiting on, and compresses traces
+        //on compress_threads more
+        FileWriter(size_t depth, size_t compress_threads, pthread_mutex_t *iomutex, pthread_cond_t *newdata);
+
+        virtual ~FileWriter();
+
+        //takes ownership of job, throws if an earlier write failed
+        void push(WriteJob *job);
+
+        //writes the jobs still queued and stops the thread
+        void finish();
+
+        //jobs written so far
+        size_t written();
+
+        //jobs queued or being written, which still hold their events' memory
+        size_t pending();
+
+        //first error any write raised, empty if none
+        std::string error();
+
+        //files, jobs, bytes, time spent writing and time jobs spent queued
+        void report(std::ostream &out);
+
+    protected:
+
+        pthread_mutex_t *iomutex;
+        pthread_cond_t *newdata;
+
+        pthread_mutex_t mutex;
+        pthread_cond_t ready, room;
+        pthread_t thread;
+        ChunkCompressor compressor;
+
+        //guarded by mutex
+        size_t depth;
+        std::deque<WriteJob*> queue;
+        bool quit, finished;
+        std::string failure;
+        size_t files, jobs, bytes, max_depth;
+        double write_s, max_write_s, queued_s, max_queued_s, push_wait_s;
+        double file_s; //writing the file still open
+
+        static void *writer_thread(void *_self);
+
+        void run();
+
+};
+
+#endif
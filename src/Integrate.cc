@@ -0,0 +1,178 @@
+/**
+ *  Copyright 2014 by Benjamin Land (a.k.a. BenLand100)
+ *
+ *  WbLSdaq is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  WbLSdaq is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+#include "Integrate.hh"
+#include "Compression.hh"
+
+using namespace std;
+using namespace H5;
+
+IntegrateSpec::IntegrateSpec() :
+    pedstart(-1),
+    pedend(-1),
+    pedcut(0.0),
+    sigstart(-1),
+    sigend(-1),
+    threshold(0.0),
+    cfdwindow(-1),
+    save_samples(true),
+    maxval(0xFFFF),
+    ps_sample(1.0),
+    V_adc(1.0) {
+}
+
+IntegrateSpec::IntegrateSpec(RunTable &tbl) : IntegrateSpec() {
+    name = tbl.getIndex();
+    channel = tbl["channel"].cast<string>();
+    if (tbl.isMember("pedstart")) pedstart = tbl["pedstart"].cast<int>();
+    if (tbl.isMember("pedend")) pedend = tbl["pedend"].cast<int>();
+    if (tbl.isMember("pedcut")) pedcut = tbl["pedcut"].cast<double>();
+    sigstart = tbl["sigstart"].cast<int>();
+    sigend = tbl["sigend"].cast<int>();
+    if (tbl.isMember("threshold")) threshold = tbl["threshold"].cast<double>();
+    if (tbl.isMember("cfdwindow")) cfdwindow = tbl["cfdwindow"].cast<int>();
+    if (tbl.isMember("save_samples")) save_samples = tbl["save_samples"].cast<bool>();
+    if (!check()) throw runtime_error("INTEGRATE " + name + " needs a signal window, and a pedestal window to use a threshold");
+}
+
+IntegrateSpec::~IntegrateSpec() {
+
+}
+
+bool IntegrateSpec::check() {
+    return (threshold == 0.0 ? !((pedstart != -1) ^ (pedend != -1)) && (cfdwindow == -1) : (pedstart != -1) && (pedend != -1))
+           && (sigstart != -1) && (sigend != -1) && name.length() != 0;
+}
+
+void IntegrateSpec::validate(size_t nsamples) {
+    if (pedstart != -1 && (pedstart >= pedend || (size_t)pedend > nsamples)) throw runtime_error("Pedestal window of " + name + " does not fit in " + to_string(nsamples) + " samples");
+    //crossings interpolate from the sample before
+    if (sigstart < (threshold != 0.0 ? 1 : 0) || sigstart >= sigend || (size_t)sigend + (cfdwindow != -1 ? 1 : 0) > nsamples) throw runtime_error("Signal window of " + name + " does not fit in " + to_string(nsamples) + " samples");
+}
+
+void IntegrateSpec::setADC(uint32_t bits, double vpp, double ns_sample) {
+    V_adc = vpp/pow(2,bits);
+    maxval = 1<<bits;
+    ps_sample = 1000.0 * ns_sample;
+    //convert threshold from mV to ADC here
+    threshold /= V_adc*1000.0;
+}
+
+void IntegrateSpec::integrate(const uint16_t *samples, integral &result) {
+    const uint16_t top = maxval;
+    auto sample = [samples,top](int j) -> uint16_t { return samples[j] > top ? 0 : samples[j]; };
+
+    double pedmean = 0;
+    result.pedmean = 0.0;
+    result.pedvalid = 0;
+    result.time = -1.0;
+    if (pedstart != -1) {
+        uint16_t pedmin = 0xFFFF;
+        uint16_t pedmax = 0;
+        for (int j = pedstart; j < pedend; j++) {
+            const uint16_t val = sample(j);
+            pedmean += val;
+            if (val > pedmax) pedmax = val;
+            if (val < pedmin) pedmin = val;
+        }
+        pedmean /= (pedend - pedstart);
+        result.pedmean = 1000.0*V_adc*pedmean;
+        if (pedcut > 0) {
+            result.pedvalid = (pedmax-pedmin)*V_adc*1000.0 < pedcut ? 1 : 0;
+        }
+    }
+    double sigcharge = 0;
+    if (threshold == 0.0) {
+        for (int j = sigstart; j < sigend; j++) {
+            sigcharge += sample(j);
+        }
+    } else {
+        bool crossed = false;
+        if (threshold > 0.0) { //downward going pulses
+            for (int j = sigstart; j < sigend; j++) {
+                sigcharge += sample(j);
+                if (!crossed && pedmean-sample(j) > threshold) {
+                    if (cfdwindow != -1) {
+                        //the CFD search window includes sample sigend
+                        const int end = sigend < (j + cfdwindow) ? sigend : (j + cfdwindow);
+                        const int begin = sigstart > (j - cfdwindow) ? sigstart : (j - cfdwindow);
+                        uint16_t peak = pedmean;
+                        for (int k = j; k <= end; k++) if (sample(k) < peak) peak = sample(k);
+                        double thresh = round((pedmean-peak)*0.5);
+                        if (thresh < threshold) continue;
+                        for (int k = begin; k <= end; k++) {
+                            if (pedmean-sample(k) > thresh) {
+                                const double prev = pedmean-sample(k-1);
+                                const double cur = pedmean-sample(k);
+                                result.time = ps_sample*((thresh-prev)/(cur-prev)+k);
+                                crossed = true;
+                                break;
+                            }
+                        }
+                    } else {
+                        const double prev = pedmean-sample(j-1);
+                        const double cur = pedmean-sample(j);
+                        result.time = ps_sample*((threshold-prev)/(cur-prev)+j);
+                        crossed = true;
+                    }
+                }
+            }
+        } else { //upward going pulses
+            for (int j = sigstart; j < sigend; j++) {
+                sigcharge += sample(j);
+                if (!crossed && pedmean-sample(j) < threshold) {
+                    const double prev = sample(j-1)-pedmean;
+                    const double cur = sample(j)-pedmean;
+                    result.time = ps_sample*((-threshold-prev)/(cur-prev)+j);
+                    crossed = true;
+                }
+            }
+        }
+    }
+    sigcharge -= pedmean * (sigend - sigstart);
+    result.sigcharge = -ps_sample * V_adc * sigcharge;
+}
+
+void IntegrateSpec::write(H5File &file, const string &channel, EventStore &store, size_t first_column, size_t n, bool append, ostream &out) {
+    const string groupname = channel + "/" + name;
+    if (!append || !outputExists(file, groupname)) {
+        out << "\t" << groupname << endl;
+        file.createGroup(groupname);
+    }
+    
+    const Compression contiguous;
+    hsize_t row;
+    
+    if (pedstart != -1) {
+        DataSet pedmean_ds = outputDataSet(file, groupname+"/pedmean", PredType::NATIVE_DOUBLE, n, 0, contiguous, append, row);
+        store.write<double>(pedmean_ds, PredType::NATIVE_DOUBLE, first_column+0, n, 1, row);
+    }
+    if (pedcut != 0.0) {
+        DataSet pedvalid_ds = outputDataSet(file, groupname+"/pedvalid", PredType::NATIVE_UINT8, n, 0, contiguous, append, row);
+        store.write<uint8_t>(pedvalid_ds, PredType::NATIVE_UINT8, first_column+1, n, 1, row);
+    }
+    if (threshold != 0.0) {
+        DataSet times_ds = outputDataSet(file, groupname+"/times", PredType::NATIVE_DOUBLE, n, 0, contiguous, append, row);
+        store.write<double>(times_ds, PredType::NATIVE_DOUBLE, first_column+2, n, 1, row);
+    }
+    DataSet sigcharge_ds = outputDataSet(file, groupname+"/sigcharge", PredType::NATIVE_DOUBLE, n, 0, contiguous, append, row);
+    store.write<double>(sigcharge_ds, PredType::NATIVE_DOUBLE, first_column+3, n, 1, row);
+}
@@ -0,0 +1,84 @@
+/**
+ *  Copyright 2014 by Benjamin Land (a.k.a. BenLand100)
+ *
+ *  WbLSdaq is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  WbLSdaq is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <ostream>
+
+#include "RunDB.hh"
+#include "EventStore.hh"
+
+#ifndef Integrate__hh
+#define Integrate__hh
+
+typedef struct {
+    double pedmean; // mV
+    uint8_t pedvalid;
+    double sigcharge; // V*ps
+    double time; // ps, -1 if the threshold was not crossed
+} integral;
+
+// Pedestal, charge, and threshold or CFD crossing of one trace. The integrator
+// program computes these from saved traces, and digitizers configured with an
+// INTEGRATE table compute them for each event as it is decoded.
+class IntegrateSpec {
+
+    public:
+
+        //nothing set, fields are filled in directly
+        IntegrateSpec();
+
+        //from an INTEGRATE table, named by its index
+        IntegrateSpec(RunTable &tbl);
+
+        virtual ~IntegrateSpec();
+
+        //true if enough fields are set to integrate
+        bool check();
+
+        //throws if the windows do not fit in traces of nsamples
+        void validate(size_t nsamples);
+
+        //sets the scale of the digitizer's samples, converting the threshold
+        //from mV to ADC counts
+        void setADC(uint32_t bits, double vpp, double ns_sample);
+
+        //samples above the ADC range are taken as bottomed out (0)
+        void integrate(const uint16_t *samples, integral &result);
+        
+        //writes the n oldest results held in store, as pedmean (double),
+        //pedvalid (uint8), times (double), and sigcharge (double) columns from
+        //first_column on, to the datasets the integrator program would make
+        //in a group named name under channel, appended to them if append
+        void write(H5::H5File &file, const std::string &channel, EventStore &store, size_t first_column, size_t n, bool append, std::ostream &out);
+
+        std::string name, channel;
+        int pedstart, pedend;
+        double pedcut;
+        int sigstart, sigend;
+        double threshold;
+        int cfdwindow;
+        bool save_samples;
+
+        uint16_t maxval;
+        double ps_sample;
+        double V_adc;
+
+};
+
+#endif
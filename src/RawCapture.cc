@@ -0,0 +1,215 @@
+/**
+ *  Copyright 2014 by Benjamin Land (a.k.a. BenLand100)
+ *
+ *  WbLSdaq is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  WbLSdaq is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <stdexcept>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "RawCapture.hh"
+#include "Compression.hh"
+
+using namespace std;
+using namespace H5;
+
+//O_DIRECT needs buffers, sizes, and offsets aligned to the device's blocks
+static const size_t ALIGN = 4096;
+
+RawCapture::RawCapture(const string &_index, const string &basename, size_t _block_bytes) : index(_index), fname(basename + ".raw"), idx(NULL), block(NULL), block_fill(0), bytes(0), aggregates(0), ready(0), held(0), written(0) {
+    block_bytes = (_block_bytes + ALIGN - 1)/ALIGN*ALIGN;
+    if (!block_bytes) block_bytes = ALIGN;
+    if (posix_memalign((void**)&block, ALIGN, block_bytes)) throw runtime_error("Could not allocate raw capture block");
+
+    direct = true;
+    fd = open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (fd < 0 && errno == EINVAL) {
+        //tmpfs and some network filesystems refuse O_DIRECT
+        direct = false;
+        fd = open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (fd < 0) throw runtime_error("Could not open " + fname + ": " + strerror(errno));
+
+    idx = fopen((basename + ".idx").c_str(), "wb");
+    if (!idx) {
+        close(fd);
+        throw runtime_error("Could not open " + basename + ".idx: " + strerror(errno));
+    }
+
+    cout << "Capturing " << index << " to " << fname << " in " << block_bytes/1024 << " KiB blocks" << (direct ? " (O_DIRECT)" : "") << endl;
+    clock_gettime(CLOCK_MONOTONIC,&began);
+}
+
+RawCapture::~RawCapture() {
+    try {
+        finish();
+    } catch (runtime_error &e) {
+        cout << "Raw capture " << fname << " not finished: " << e.what() << endl;
+    }
+    free(block);
+}
+
+void RawCapture::decode(Buffer &buffer) {
+    const size_t size = buffer.fill();
+    log << index << " capturing " << size << " bytes." << endl;
+    uint32_t *start = (uint32_t*)buffer.rptr(), *next = start;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    const uint64_t ns = (now.tv_sec - began.tv_sec)*1000000000ul + now.tv_nsec - began.tv_nsec;
+
+    //a trailing partial aggregate stays in buffer like it would for a decoder
+    size_t consumed = 0;
+    pending.resize(0);
+    while (consumed < size) {
+        size_t words = (size - consumed)/4;
+        uint32_t *agg = next;
+        if (words && agg[0] == 0xFFFFFFFF) {
+            agg++; //sometimes padded
+            words--;
+        }
+        if (!words) break;
+        if ((agg[0] & 0xF0000000) != 0xA0000000) throw runtime_error("Aggregate missing tag in " + index + " readout");
+        const uint32_t aggwords = agg[0] & 0x0FFFFFFF;
+        if (aggwords < 4) throw runtime_error("Aggregate shorter than its header in " + index + " readout");
+        if (aggwords > words) {
+            if (!consumed && size + 8 > buffer.capacity()) throw runtime_error("Readout buffer for " + index + " is too small for one aggregate");
+            break;
+        }
+        RawAggregate entry;
+        entry.offset = bytes + (agg - start)*4;
+        entry.ns = ns;
+        entry.words = aggwords;
+        entry.counter = agg[2];
+        entry.timetag = agg[3];
+        entry.reserved = 0;
+        pending.push_back(entry);
+        next = agg + aggwords;
+        consumed = (next - start)*4;
+    }
+
+    append((const char*)start, consumed);
+    if (pending.size() && fwrite(pending.data(), sizeof(RawAggregate), pending.size(), idx) != pending.size()) {
+        throw runtime_error("Could not write index of " + fname);
+    }
+    buffer.dec(consumed);
+    held = size - consumed;
+    aggregates += pending.size();
+    ready += pending.size();
+}
+
+size_t RawCapture::eventsReady() {
+    return ready;
+}
+
+DecodedBatch* RawCapture::detach(size_t nEvents) {
+    ready -= nEvents;
+    vector<EventStore*> none;
+    return new DecodedBatch(this,none,nEvents);
+}
+
+void RawCapture::writeOut(H5File &file, vector<EventStore*> &stores, size_t nEvents, ChunkCompressor &compressor, bool append, ostream &out) {
+    out << "\t/" << index << endl;
+
+    DataSpace scalar(0,NULL);
+    uint64_t count = nEvents;
+    if (!append || !outputExists(file, "/"+index)) {
+        Group group = file.createGroup("/"+index);
+
+        StrType fnametype(PredType::C_S1, fname.size());
+        Attribute raw_file = group.createAttribute("raw_file",fnametype,scalar);
+        raw_file.write(fnametype,fname.c_str());
+
+        Attribute first = group.createAttribute("first_aggregate",PredType::NATIVE_UINT64,scalar);
+        first.write(PredType::NATIVE_UINT64,&written);
+
+        Attribute aggs = group.createAttribute("aggregates",PredType::NATIVE_UINT64,scalar);
+        aggs.write(PredType::NATIVE_UINT64,&count);
+    } else {
+        Attribute aggs = file.openGroup("/"+index).openAttribute("aggregates");
+        uint64_t before;
+        aggs.read(PredType::NATIVE_UINT64,&before);
+        count += before;
+        aggs.write(PredType::NATIVE_UINT64,&count);
+    }
+    written += nEvents;
+}
+
+size_t RawCapture::leftover() {
+    return held;
+}
+
+void RawCapture::finish() {
+    if (fd < 0) return;
+
+    //direct writes are whole aligned blocks, so the tail is padded and the
+    //padding cut off afterwards
+    const size_t tail = direct ? (block_fill + ALIGN - 1)/ALIGN*ALIGN : block_fill;
+    memset(block + block_fill, 0, tail - block_fill);
+    string failed;
+    try {
+        writeBlock(tail);
+    } catch (runtime_error &e) {
+        failed = e.what();
+    }
+    if (failed.empty() && ftruncate(fd, bytes) != 0) failed = "Could not truncate " + fname + ": " + strerror(errno);
+    close(fd);
+    fd = -1;
+    fclose(idx);
+    idx = NULL;
+    if (failed.size()) throw runtime_error(failed);
+
+    cout << "Captured " << aggregates << " aggregates (" << bytes/1024.0/1024.0 << " MiB) to " << fname << endl;
+}
+
+void RawCapture::append(const char *data, size_t size) {
+    bytes += size;
+    while (size) {
+        const size_t take = size < block_bytes - block_fill ? size : block_bytes - block_fill;
+        memcpy(block + block_fill, data, take);
+        block_fill += take;
+        data += take;
+        size -= take;
+        if (block_fill == block_bytes) {
+            writeBlock(block_bytes);
+            block_fill = 0;
+        }
+    }
+}
+
+void RawCapture::writeBlock(size_t size) {
+    for (size_t done = 0; done < size; ) {
+        const ssize_t res = write(fd, block + done, size - done);
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0) throw runtime_error("Could not write " + fname + ": " + strerror(errno));
+        done += res;
+    }
+    //the index follows the data onto disk
+    fflush(idx);
+}
+
+vector<RawAggregate> RawCapture::readIndex(const string &fname) {
+    FILE *in = fopen(fname.c_str(), "rb");
+    if (!in) throw runtime_error("Could not open " + fname + ": " + strerror(errno));
+    vector<RawAggregate> entries;
+    RawAggregate entry;
+    while (fread(&entry, sizeof(RawAggregate), 1, in) == 1) entries.push_back(entry);
+    fclose(in);
+    return entries;
+}
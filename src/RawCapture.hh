@@ -0,0 +1,102 @@
+/**
+ *  Copyright 2014 by Benjamin Land (a.k.a. BenLand100)
+ *
+ *  WbLSdaq is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  WbLSdaq is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <ctime>
+#include <H5Cpp.h>
+
+#include "Digitizer.hh"
+#include "Buffer.hh"
+
+#ifndef RawCapture__hh
+#define RawCapture__hh
+
+// One entry of a raw capture's index (.idx) per V1730 board aggregate or V1742
+// event structure, which share the same header: 0xA and the size in words,
+// then two words, then the counter and the time tag. Offsets are in bytes
+// into the .raw file and point at the header, after any 0xFFFFFFFF filler.
+typedef struct {
+    uint64_t offset;
+    uint64_t ns; //since the capture began, when it was taken from readout
+    uint32_t words;
+    uint32_t counter; //header words 2 and 3 as read
+    uint32_t timetag;
+    uint32_t reserved;
+} RawAggregate;
+
+// Stands in for a card's decoder, appending whole aggregates from its Buffer,
+// undecoded, to <basename>.raw in aligned blocks of block_bytes, with O_DIRECT
+// where the filesystem allows it, and indexing them in <basename>.idx. Events
+// are aggregates here, so run types split files by aggregates, and the files
+// written only record which aggregates of the capture they cover.
+class RawCapture : public Decoder {
+
+    public:
+
+        RawCapture(const std::string &index, const std::string &basename, size_t block_bytes);
+
+        //finishes the file if that has not been done
+        virtual ~RawCapture();
+
+        virtual void decode(Buffer &buffer);
+
+        virtual size_t eventsReady();
+
+        virtual DecodedBatch* detach(size_t nEvents);
+
+        //the group of the card holds raw_file, first_aggregate and the number
+        //of aggregates
+        virtual void writeOut(H5::H5File &file, std::vector<EventStore*> &stores, size_t nEvents, ChunkCompressor &compressor, bool append, std::ostream &out);
+
+        virtual size_t leftover();
+
+        //writes the partial last block and closes the files
+        void finish();
+
+        //reads a whole .idx file
+        static std::vector<RawAggregate> readIndex(const std::string &fname);
+
+    protected:
+
+        std::string index, fname;
+        int fd;
+        FILE *idx;
+        bool direct;
+
+        //aligned block being filled
+        char *block;
+        size_t block_bytes, block_fill;
+
+        //appended to the file, including the partial block
+        uint64_t bytes;
+        size_t aggregates, ready, held;
+        std::vector<RawAggregate> pending;
+        struct timespec began;
+
+        //aggregates already in output files, only touched by writeOut
+        uint64_t written;
+
+        void append(const char *data, size_t size);
+
+        void writeBlock(size_t size);
+
+};
+
+#endif
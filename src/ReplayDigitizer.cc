@@ -0,0 +1,165 @@
+/**
+ *  Copyright 2014 by Benjamin Land (a.k.a. BenLand100)
+ *
+ *  WbLSdaq is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  WbLSdaq is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ReplayDigitizer.hh"
+#include "V1730_dpppsd.hh"
+
+using namespace std;
+
+//every replay is created before acquisition starts and only read afterwards
+vector<ReplayDigitizer*> ReplayDigitizer::replays;
+
+ReplayDigitizer::ReplayDigitizer(VMEBridge &bridge, uint32_t baseaddr, const string &capture, double _speed) : Digitizer(bridge,baseaddr), fname(capture + ".raw"), speed(_speed), data(NULL), size(0), pos(0), due(0), sent(0), started(false), max_lag(0.0) {
+    index = RawCapture::readIndex(capture + ".idx");
+
+    const int fd = open(fname.c_str(), O_RDONLY);
+    if (fd < 0) throw runtime_error("Could not open " + fname + ": " + strerror(errno));
+    struct stat st;
+    if (fstat(fd,&st) != 0) {
+        close(fd);
+        throw runtime_error("Could not stat " + fname + ": " + strerror(errno));
+    }
+    size = st.st_size;
+    if (size) {
+        void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            throw runtime_error("Could not map " + fname + ": " + strerror(errno));
+        }
+        madvise(map, size, MADV_SEQUENTIAL);
+        data = (const char*)map;
+    }
+    close(fd);
+
+    if (index.size() && index.back().offset + index.back().words*4 > size) {
+        if (data) munmap((void*)data, size);
+        throw runtime_error("Index of " + fname + " runs past its end");
+    }
+    next_ns = index.size() ? index[0].ns : UINT64_MAX;
+    replays.push_back(this);
+    cout << "Replaying " << index.size() << " aggregates (" << size/1024.0/1024.0 << " MiB) from " << fname;
+    if (speed > 0) {
+        cout << " at " << speed << "x the recorded pace" << endl;
+    } else {
+        cout << " as fast as possible" << endl;
+    }
+}
+
+ReplayDigitizer::~ReplayDigitizer() {
+    replays.erase(find(replays.begin(), replays.end(), this));
+    if (data) munmap((void*)data, size);
+}
+
+bool ReplayDigitizer::program(DigitizerSettings &settings) {
+    V1730Settings *v1730 = dynamic_cast<V1730Settings*>(&settings);
+    if (v1730) {
+        try {
+            v1730->validate();
+        } catch (runtime_error &e) {
+            cout << "Could not program V1730: " << e.what() << endl;
+            return false;
+        }
+        v1730->roundRecordLengths();
+    }
+    return true;
+}
+
+bool ReplayDigitizer::checkTemps(vector<uint32_t> &temps, uint32_t danger) {
+    temps.resize(0);
+    return false;
+}
+
+void ReplayDigitizer::softTrig() {
+
+}
+
+void ReplayDigitizer::startAcquisition() {
+    clock_gettime(CLOCK_MONOTONIC,&start);
+    started = true;
+}
+
+void ReplayDigitizer::stopAcquisition() {
+    if (!started) return;
+    started = false;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    const double elapsed = (now.tv_sec - start.tv_sec)+1e-9*(now.tv_nsec - start.tv_nsec);
+    const double mib = pos/1024.0/1024.0;
+    cout << "Replayed " << sent << " / " << index.size() << " aggregates (" << mib << " MiB) of " << fname << " in " << elapsed << " s: "
+         << sent/elapsed << " aggregates/s " << mib/elapsed << " MiB/s";
+    if (speed > 0) cout << ", up to " << max_lag << " s behind";
+    cout << endl;
+}
+
+bool ReplayDigitizer::acquisitionRunning() {
+    return pos < size;
+}
+
+bool ReplayDigitizer::readoutReady() {
+    return started && pos < dueBytes();
+}
+
+void ReplayDigitizer::setInterrupt(uint32_t level, uint32_t events) {
+    if (level) throw runtime_error("Replayed cards cannot raise interrupts");
+}
+
+size_t ReplayDigitizer::readoutBLT(char *buffer, size_t buffer_size) {
+    const size_t end = dueBytes();
+    //readout buffers hold whole words
+    size_t bytes = end - pos < buffer_size ? end - pos : buffer_size;
+    bytes &= ~(size_t)3;
+    memcpy(buffer, data + pos, bytes);
+    pos += bytes;
+    recordTransfer(bytes);
+    while (sent < index.size() && index[sent].offset + index[sent].words*4 <= pos) sent++;
+    next_ns = sent < index.size() ? index[sent].ns : UINT64_MAX;
+    return bytes;
+}
+
+size_t ReplayDigitizer::dueBytes() {
+    if (speed > 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC,&now);
+        const double elapsed = (now.tv_sec - start.tv_sec)+1e-9*(now.tv_nsec - start.tv_nsec);
+        while (due < index.size() && 1e-9*index[due].ns/speed <= elapsed) due++;
+        //how long the oldest aggregate not yet read out has been waiting
+        if (sent < due) {
+            const double lag = elapsed - 1e-9*index[sent].ns/speed;
+            if (lag > max_lag) max_lag = lag;
+        }
+    } else {
+        uint64_t horizon = UINT64_MAX;
+        for (size_t i = 0; i < replays.size(); i++) {
+            if (replays[i]->speed > 0) continue;
+            const uint64_t ns = replays[i]->next_ns;
+            if (ns < horizon) horizon = ns;
+        }
+        while (due < index.size() && index[due].ns <= horizon) due++;
+    }
+    if (due == index.size()) return size;
+    return due ? index[due-1].offset + index[due-1].words*4 : 0;
+}
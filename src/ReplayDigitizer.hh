@@ -0,0 +1,96 @@
+/**
+ *  Copyright 2014 by Benjamin Land (a.k.a. BenLand100)
+ *
+ *  WbLSdaq is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  WbLSdaq is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string>
+#include <vector>
+#include <ctime>
+#include <atomic>
+
+#include "Digitizer.hh"
+#include "RawCapture.hh"
+
+#ifndef ReplayDigitizer__hh
+#define ReplayDigitizer__hh
+
+// Stands in for a card by serving the aggregates of a raw capture
+// (<capture>.raw and .idx, see RawCapture) to readout, which decodes and
+// writes them as it would a live card's. Aggregates come due at the time they
+// were captured divided by speed, counted from startAcquisition. If speed is 0
+// they come due as soon as no replayed card has an earlier one left to read
+// out, so cards keep their recorded order and a run is limited only by how
+// fast it reads out, decodes, and writes. Acquisition ends once the whole
+// capture is read out.
+class ReplayDigitizer : public Digitizer {
+
+    public:
+
+        ReplayDigitizer(VMEBridge &bridge, uint32_t baseaddr, const std::string &capture, double speed);
+
+        virtual ~ReplayDigitizer();
+
+        //applies what programming the card changed in its settings
+        virtual bool program(DigitizerSettings &settings);
+
+        //there are no temperatures to report
+        virtual bool checkTemps(std::vector<uint32_t> &temps, uint32_t danger);
+
+        virtual void softTrig();
+
+        virtual void startAcquisition();
+
+        //reports how fast the capture was replayed and how far it fell behind
+        virtual void stopAcquisition();
+
+        virtual bool acquisitionRunning();
+
+        virtual bool readoutReady();
+
+        //replays never raise interrupts, so only level 0 is accepted
+        virtual void setInterrupt(uint32_t level, uint32_t events);
+
+        //whatever is due, up to buffer_size, possibly ending partway through
+        //an aggregate like a FIFO BLT
+        virtual size_t readoutBLT(char *buffer, size_t buffer_size);
+
+    protected:
+
+        std::string fname;
+        double speed;
+        std::vector<RawAggregate> index;
+
+        //the mapped .raw file
+        const char *data;
+        size_t size;
+
+        //bytes read out, aggregates due, and the first not fully read out
+        size_t pos, due, sent;
+
+        bool started;
+        struct timespec start;
+        double max_lag;
+
+        //capture time of the first aggregate not fully read out, for the
+        //other cards replayed with speed 0
+        std::atomic<uint64_t> next_ns;
+        static std::vector<ReplayDigitizer*> replays;
+
+        //bytes due by now
+        size_t dueBytes();
+
+};
+
+#endif
@@ -0,0 +1,627 @@
+/**
+ *  Copyright 2014 by Benjamin Land (a.k.a. BenLand100)
+ *
+ *  WbLSdaq is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  WbLSdaq is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include "SimVMEBridge.hh"
+#include "V1730_dpppsd.hh"
+#include "V1742.hh"
+#include "V65XX.hh"
+
+using namespace std;
+
+SimCard::SimCard(string _index) : index(_index) {
+
+}
+
+SimCard::~SimCard() {
+
+}
+
+uint32_t SimCard::read(uint32_t reg) {
+    return get(reg);
+}
+
+void SimCard::write(uint32_t reg, uint32_t data) {
+    regs[reg] = data;
+}
+
+uint32_t SimCard::blt(uint32_t reg, char *buffer, uint32_t size, bool &berr) {
+    berr = true;
+    return 0;
+}
+
+uint32_t SimCard::irq() {
+    return 0;
+}
+
+uint32_t SimCard::chainOrder(uint32_t addr) {
+    return 0;
+}
+
+SimDigitizer::SimDigitizer(string index, double _rate) : SimCard(index), rate(_rate), running(false) {
+    triggered = stored = readout = dropped = 0;
+    block_pos = 0;
+}
+
+SimDigitizer::~SimDigitizer() {
+
+}
+
+void SimDigitizer::startRun() {
+    prepare();
+    running = true;
+    triggered = stored = readout = dropped = 0;
+    block.clear();
+    block_pos = 0;
+    clock_gettime(CLOCK_MONOTONIC,&start_time);
+}
+
+void SimDigitizer::stopRun() {
+    pending();
+    running = false;
+    cout << "Simulated " << index << ": " << triggered << " triggers, " << readout << " read out, " << dropped << " dropped (board full)" << endl;
+}
+
+size_t SimDigitizer::pending() {
+    if (!running) return stored;
+    struct timespec cur_time;
+    clock_gettime(CLOCK_MONOTONIC,&cur_time);
+    double time_int = (cur_time.tv_sec - start_time.tv_sec)+1e-9*(cur_time.tv_nsec - start_time.tv_nsec);
+    const uint64_t expected = (uint64_t)(time_int*rate);
+    if (expected > triggered) {
+        const uint64_t arrived = expected - triggered;
+        const uint64_t space = capacity() > stored ? capacity() - stored : 0;
+        const uint64_t accepted = arrived < space ? arrived : space;
+        stored += accepted;
+        dropped += arrived - accepted;
+        triggered = expected;
+    }
+    return stored;
+}
+
+uint32_t SimDigitizer::blt(uint32_t reg, char *buffer, uint32_t size, bool &berr) {
+    if (block_pos == block.size()*4) {
+        block.clear();
+        block_pos = 0;
+        if (pending()) buildBlock();
+    }
+    const size_t avail = block.size()*4 - block_pos;
+    const uint32_t bytes = size < avail ? size : avail;
+    memcpy(buffer,((char*)block.data())+block_pos,bytes);
+    block_pos += bytes;
+    //the board ends the transfer with a bus error once the block is exhausted
+    berr = bytes == avail;
+    return bytes;
+}
+
+uint32_t SimDigitizer::irq() {
+    //same register locations on the V1730 and V1742
+    const uint32_t level = get(V1730::REG_READOUT_CONTROL) & 0x7;
+    const uint32_t count = get(V1730::REG_INTERRUPT_EVENT_NUMBER) & 0x3FF;
+    if (!running || !level || !count) return 0;
+    return pending() >= count*readyThreshold() ? 1 << (level-1) : 0;
+}
+
+SimV1730::SimV1730(string index, double rate) : SimDigitizer(index,rate) {
+    aggregate_counter = 0;
+    couple_mask = enable_mask = 0;
+    for (int gr = 0; gr < 8; gr++) nsamples[gr] = 0;
+}
+
+SimV1730::~SimV1730() {
+
+}
+
+uint32_t SimV1730::read(uint32_t reg) {
+    if ((reg & 0xF0FF) == V1730::REG_CHANNEL_TEMP) return 45;
+    switch (reg) {
+        case V1730::REG_ACQUISITION_STATUS: {
+            const bool ready = pending() >= readyThreshold() || (!running && stored > 0) || block_pos < block.size()*4;
+            return (running ? 1 << 2 : 0) | (ready ? 1 << 3 : 0) | (1 << 7) | (1 << 8);
+        }
+        case V1730::REG_EVENT_SIZE: {
+            if (block_pos < block.size()*4) return block.size() - block_pos/4;
+            const size_t nev = pending() < eventsPerAggregate() ? stored : eventsPerAggregate();
+            return nev ? aggregateWords(nev) : 0;
+        }
+        default:
+            return get(reg);
+    }
+}
+
+void SimV1730::write(uint32_t reg, uint32_t data) {
+    switch (reg) {
+        case V1730::REG_BOARD_CONFIGURATION_RELOAD:
+        case V1730::REG_SOFTWARE_RESET:
+            if (running) stopRun();
+            regs.clear();
+            stored = 0;
+            block.clear();
+            block_pos = 0;
+            break;
+        case V1730::REG_SOFTWARE_CLEAR:
+            stored = 0;
+            block.clear();
+            block_pos = 0;
+            break;
+        case V1730::REG_CONFIG_SET:
+            set(V1730::REG_CONFIG,get(V1730::REG_CONFIG) | data);
+            break;
+        case V1730::REG_CONFIG_CLEAR:
+            set(V1730::REG_CONFIG,get(V1730::REG_CONFIG) & ~data);
+            break;
+        case V1730::REG_SOFTWARE_TRIGGER:
+            if (running && pending() < capacity()) stored++;
+            break;
+        case V1730::REG_ACQUISITION_CONTROL:
+            regs[reg] = data;
+            if ((data & (1 << 2)) && !running) startRun();
+            if (!(data & (1 << 2)) && running) stopRun();
+            break;
+        default:
+            regs[reg] = data;
+    }
+}
+
+uint32_t SimV1730::chainOrder(uint32_t addr) {
+    const uint32_t mcst = get(V1730::REG_MCST_CBLT);
+    if ((mcst & 0xFF) != addr) return 0;
+    switch ((mcst >> 8) & 0x3) {
+        case 2: return 1; //first
+        case 3: return 2 + (get(V1730::REG_BOARD_ID) & 0x1F); //intermediate
+        case 1: return 64; //last
+        default: return 0;
+    }
+}
+
+uint32_t SimV1730::eventsPerAggregate() {
+    for (uint32_t gr = 0; gr < 8; gr++) {
+        if (couple_mask & (1 << gr)) {
+            const uint32_t nev = get(V1730::REG_NEV_AGGREGATE|((gr*2)<<8)) & 0x3FF;
+            return nev ? nev : 1;
+        }
+    }
+    return 1;
+}
+
+size_t SimV1730::capacity() {
+    uint32_t buff_org = get(V1730::REG_BUFF_ORG);
+    if (buff_org < 0x2 || buff_org > 0xA) buff_org = 0xA;
+    return (1 << buff_org) * eventsPerAggregate();
+}
+
+size_t SimV1730::readyThreshold() {
+    return eventsPerAggregate();
+}
+
+void SimV1730::prepare() {
+    enable_mask = get(V1730::REG_CHANNEL_ENABLE_MASK) & 0xFFFF;
+    couple_mask = 0;
+    for (uint32_t gr = 0; gr < 8; gr++) {
+        if (!(enable_mask & (3 << (gr*2)))) continue;
+        couple_mask |= 1 << gr;
+        nsamples[gr] = (get(V1730::REG_RECORD_LENGTH|((gr*2)<<8)) & 0xFFFF)*8;
+        const uint32_t pre = get(V1730::REG_PRE_TRG|((gr*2)<<8))*4;
+        //negative going pulse on a 14 bit baseline, two samples per word
+        waveforms[gr].resize(nsamples[gr]/2);
+        for (uint32_t i = 0; i < nsamples[gr]; i++) {
+            const double pulse = i >= pre ? 1000.0*exp(-(double)(i-pre)/20.0) : 0.0;
+            const uint32_t sample = ((uint32_t)(8000.0 - pulse)) & 0x3FFF;
+            if (i%2) {
+                waveforms[gr][i/2] |= sample << 16;
+            } else {
+                waveforms[gr][i/2] = sample;
+            }
+        }
+    }
+}
+
+bool SimV1730::waveformsEnabled() {
+    return get(V1730::REG_CONFIG) & (1 << 16);
+}
+
+bool SimV1730::extrasEnabled() {
+    return get(V1730::REG_CONFIG) & (1 << 17);
+}
+
+uint32_t SimV1730::eventWords(uint32_t gr) {
+    return (waveformsEnabled() ? nsamples[gr]/2 : 0) + (extrasEnabled() ? 1 : 0) + 2;
+}
+
+size_t SimV1730::aggregateWords(size_t nev) {
+    size_t words = 4;
+    for (uint32_t gr = 0; gr < 8; gr++) {
+        if (!(couple_mask & (1 << gr))) continue;
+        const size_t nch = ((enable_mask >> (gr*2)) & 1) + ((enable_mask >> (gr*2+1)) & 1);
+        words += 2 + nev*nch*eventWords(gr);
+    }
+    return words;
+}
+
+void SimV1730::buildBlock() {
+    uint32_t max_agg = get(V1730::REG_READOUT_BLT_AGGREGATE_NUMBER) & 0x3FF;
+    if (!max_agg) max_agg = 1;
+    for (uint32_t agg = 0; agg < max_agg && stored > 0; agg++) {
+        const size_t nev = stored < eventsPerAggregate() ? stored : eventsPerAggregate();
+        buildAggregate(nev);
+        stored -= nev;
+        readout += nev;
+    }
+    //align64 pads the transfer to a whole 64 bit word
+    if ((get(V1730::REG_READOUT_CONTROL) & (1 << 5)) && block.size() % 2) block.push_back(0xFFFFFFFF);
+}
+
+void SimV1730::buildAggregate(size_t nev) {
+    const size_t words = aggregateWords(nev);
+    const size_t offset = block.size();
+    block.resize(offset+words);
+    uint32_t *agg = &block[offset];
+
+    agg[0] = 0xA0000000 | words;
+    agg[1] = ((get(V1730::REG_BOARD_ID) & 0x1F) << 27) | (couple_mask & 0xFF);
+    agg[2] = aggregate_counter++ & 0x7FFFFF;
+    agg[3] = (uint32_t)(readout/rate*5e8);
+
+    uint32_t *chan = agg+4;
+    for (uint32_t gr = 0; gr < 8; gr++) {
+        if (!(couple_mask & (1 << gr))) continue;
+        const size_t nch = ((enable_mask >> (gr*2)) & 1) + ((enable_mask >> (gr*2+1)) & 1);
+        const uint32_t evwords = eventWords(gr);
+        const bool waveform = waveformsEnabled(), extras = extrasEnabled();
+        const uint32_t samples = waveform ? nsamples[gr] : 0;
+        chan[0] = 0x80000000 | ((2 + nev*nch*evwords) & 0x3FFFFF);
+        chan[1] = ((nsamples[gr]/8) & 0xFFFF)
+                | (waveform << 27)
+                | (extras << 28)
+                | (1 << 29) // time
+                | (1 << 30);// charge
+        uint32_t *event = chan+2;
+        for (size_t ev = 0; ev < nev; ev++) {
+            const uint64_t timetag = (uint64_t)((readout+ev)/rate*5e8);
+            for (uint32_t odd = 0; odd < 2; odd++) {
+                if (!(enable_mask & (1 << (gr*2+odd)))) continue;
+                event[0] = (odd << 31) | (timetag & 0x7FFFFFFF);
+                memcpy(event+1,waveforms[gr].data(),samples/2*4);
+                if (extras) event[1+samples/2] = 8000 | (((timetag >> 31) & 0xFFFF) << 16);
+                event[evwords-1] = 500 | (1000 << 16);
+                event += evwords;
+            }
+        }
+        chan = event;
+    }
+}
+
+SimV1742::SimV1742(string index, double rate) : SimDigitizer(index,rate) {
+    group_mask = 0;
+    nsamples = 1024;
+    tr_readout = false;
+}
+
+SimV1742::~SimV1742() {
+
+}
+
+uint32_t SimV1742::read(uint32_t reg) {
+    if ((reg & 0xF0FF) == V1742::REG_DRS4_TEMP) return 40;
+    switch (reg) {
+        case V1742::REG_ACQUISITION_STATUS: {
+            const bool ready = pending() >= readyThreshold() || block_pos < block.size()*4;
+            return (running ? 1 << 2 : 0) | (ready ? 1 << 3 : 0) | (1 << 7) | (1 << 8);
+        }
+        case V1742::REG_EVENT_SIZE:
+            if (block_pos < block.size()*4) return block.size() - block_pos/4;
+            return pending() ? eventWords() : 0;
+        case V1742::REG_EVENTS_STORED:
+            return pending();
+        case 0x8124: //firmware revision
+            return 0x04010000;
+        default:
+            return get(reg);
+    }
+}
+
+void SimV1742::write(uint32_t reg, uint32_t data) {
+    switch (reg) {
+        case V1742::REG_BOARD_CONFIGURATION_RELOAD:
+        case V1742::REG_SOFTWARE_RESET:
+            if (running) stopRun();
+            regs.clear();
+            stored = 0;
+            block.clear();
+            block_pos = 0;
+            break;
+        case V1742::REG_SOFTWARE_CLEAR:
+            stored = 0;
+            block.clear();
+            block_pos = 0;
+            break;
+        case V1742::REG_SOFTWARE_TRIGGER:
+            if (running && pending() < capacity()) stored++;
+            break;
+        case V1742::REG_ACQUISITION_CONTROL:
+            regs[reg] = data;
+            if ((data & (1 << 2)) && !running) startRun();
+            if (!(data & (1 << 2)) && running) stopRun();
+            break;
+        default:
+            regs[reg] = data;
+    }
+}
+
+size_t SimV1742::capacity() {
+    return 128;
+}
+
+size_t SimV1742::readyThreshold() {
+    return 1;
+}
+
+void SimV1742::prepare() {
+    static const uint32_t sizes[4] = {1024, 520, 256, 136};
+    group_mask = get(V1742::REG_GROUP_ENABLE) & 0xF;
+    nsamples = sizes[get(V1742::REG_CUSTOM_SIZE) & 0x3];
+    tr_readout = (get(V1742::REG_GROUP_CONFIG) >> 11) & 0x1;
+
+    //same 12 bit pulse on every channel, 8 channels packed into 3 words per sample
+    vector<uint32_t> trace(nsamples);
+    for (uint32_t i = 0; i < nsamples; i++) {
+        const double pulse = i >= nsamples/2 ? 500.0*exp(-(double)(i-nsamples/2)/10.0) : 0.0;
+        trace[i] = ((uint32_t)(2000.0 - pulse)) & 0xFFF;
+    }
+    group_data.resize(nsamples*3);
+    for (uint32_t s = 0; s < nsamples; s++) {
+        const uint32_t v = trace[s];
+        group_data[s*3+0] = v | (v << 12) | ((v & 0xFF) << 24);
+        group_data[s*3+1] = ((v >> 8) & 0xF) | (v << 4) | (v << 16) | ((v & 0xF) << 28);
+        group_data[s*3+2] = ((v >> 4) & 0xFF) | (v << 8) | (v << 20);
+    }
+    //the TR channel packs 8 consecutive samples into 3 words
+    tr_data.resize(nsamples/8*3);
+    for (uint32_t s = 0; s < nsamples; s += 8) {
+        const uint32_t *v = &trace[s];
+        tr_data[s/8*3+0] = v[0] | (v[1] << 12) | ((v[2] & 0xFF) << 24);
+        tr_data[s/8*3+1] = ((v[2] >> 8) & 0xF) | (v[3] << 4) | (v[4] << 16) | ((v[5] & 0xF) << 28);
+        tr_data[s/8*3+2] = ((v[5] >> 4) & 0xFF) | (v[6] << 8) | (v[7] << 20);
+    }
+}
+
+size_t SimV1742::eventWords() {
+    size_t words = 4;
+    for (uint32_t gr = 0; gr < 4; gr++) {
+        if (group_mask & (1 << gr)) words += 2 + group_data.size() + (tr_readout ? tr_data.size() : 0);
+    }
+    return words;
+}
+
+void SimV1742::buildBlock() {
+    uint32_t max_ev = get(V1742::REG_MAX_EVENT_BLT) & 0x3FF;
+    if (!max_ev) max_ev = 1;
+    for (uint32_t ev = 0; ev < max_ev && stored > 0; ev++) {
+        buildEvent();
+        stored--;
+        readout++;
+    }
+}
+
+void SimV1742::buildEvent() {
+    const size_t words = eventWords();
+    const size_t offset = block.size();
+    block.resize(offset+words);
+    uint32_t *event = &block[offset];
+
+    const uint32_t timetag = (uint32_t)(readout/rate/8.5e-9);
+    event[0] = 0xA0000000 | words;
+    event[1] = group_mask;
+    event[2] = readout & 0x3FFFFF;
+    event[3] = timetag;
+
+    const uint32_t freq = get(V1742::REG_SAMPLE_FREQ) & 0x3;
+    uint32_t *group = event+4;
+    for (uint32_t gr = 0; gr < 4; gr++) {
+        if (!(group_mask & (1 << gr))) continue;
+        const uint32_t cell = (readout*7919+gr*131) % 1024;
+        group[0] = (cell << 20) | (freq << 16) | ((tr_readout ? 1 : 0) << 12) | group_data.size();
+        memcpy(group+1,group_data.data(),group_data.size()*4);
+        group += 1 + group_data.size();
+        if (tr_readout) {
+            memcpy(group,tr_data.data(),tr_data.size()*4);
+            group += tr_data.size();
+        }
+        group[0] = timetag;
+        group++;
+    }
+}
+
+SimV65XX::SimV65XX(string index, RunTable &config) : SimCard(index) {
+    const uint32_t nChans = 6;
+    set(V65XX::REG_NUM_CHANS,nChans);
+    set(V65XX::REG_BOARD_VMAX,4000);
+    set(V65XX::REG_BOARD_IMAX,3000);
+    //polarity is fixed in hardware, so guess it from the requested voltages
+    for (uint32_t ch = 0; ch < nChans; ch++) {
+        string field = "ch"+to_string(ch);
+        bool positive = true;
+        if (config.isMember(field)) {
+            json::Value &chan = config[field];
+            if (chan.isMember("v_set") && chan["v_set"].cast<double>() < 0.0) positive = false;
+            if (chan.isMember("v_max") && chan["v_max"].cast<double>() < 0.0) positive = false;
+        }
+        set((0x80*(ch+1))|V65XX::REG_POLARITY,positive ? 1 : 0);
+        set((0x80*(ch+1))|V65XX::REG_TEMP,25);
+    }
+}
+
+SimV65XX::~SimV65XX() {
+
+}
+
+uint32_t SimV65XX::read(uint32_t reg) {
+    const uint32_t ch = reg/0x80;
+    if (ch < 1 || ch > get(V65XX::REG_NUM_CHANS)) return get(reg);
+    const uint32_t base = 0x80*ch;
+    const bool on = get(base|V65XX::REG_ENABLE);
+    switch (reg & 0x7F) {
+        case V65XX::REG_STATUS:
+            return on ? V65XX::CH_ON : 0;
+        case V65XX::REG_VMON:
+            return on ? get(base|V65XX::REG_VSET) : 0;
+        default:
+            return get(reg);
+    }
+}
+
+SimVMEBridge::SimVMEBridge(RunDB &db, int link, int board) : VMEBridge() {
+    init(link,board);
+    //nothing to settle, so writes go out immediately unless configured otherwise
+    timing[VME_WRITE].mode = TIMING_NONE;
+    timing[VME_WRITE].delay_us = 0;
+
+    RunTable run = db.getTable("RUN");
+    const double rate = run.isMember("sim_rate") ? run["sim_rate"].cast<double>() : 100.0;
+
+    vector<RunTable> tables = db.getGroup("V1730");
+    for (size_t i = 0; i < tables.size(); i++) {
+        RunTable &tbl = tables[i];
+        const double r = tbl.isMember("sim_rate") ? tbl["sim_rate"].cast<double>() : rate;
+        cards[tbl["base_address"].cast<int>() & 0xFFFF0000] = new SimV1730(tbl.getIndex(),r);
+    }
+    tables = db.getGroup("V1742");
+    for (size_t i = 0; i < tables.size(); i++) {
+        RunTable &tbl = tables[i];
+        const double r = tbl.isMember("sim_rate") ? tbl["sim_rate"].cast<double>() : rate;
+        cards[tbl["base_address"].cast<int>() & 0xFFFF0000] = new SimV1742(tbl.getIndex(),r);
+    }
+    tables = db.getGroup("V65XX");
+    for (size_t i = 0; i < tables.size(); i++) {
+        RunTable &tbl = tables[i];
+        cards[tbl["base_address"].cast<int>() & 0xFFFF0000] = new SimV65XX(tbl.getIndex(),tbl);
+    }
+}
+
+SimVMEBridge::~SimVMEBridge() noexcept(false) {
+    for (map<uint32_t,SimCard*>::iterator it = cards.begin(); it != cards.end(); it++) {
+        delete it->second;
+    }
+}
+
+SimCard* SimVMEBridge::card(uint32_t addr) {
+    map<uint32_t,SimCard*>::iterator it = cards.find(addr & 0xFFFF0000);
+    return it == cards.end() ? NULL : it->second;
+}
+
+int SimVMEBridge::rawRead(uint32_t addr, uint32_t *data, CVDataWidth width) {
+    SimCard *c = card(addr);
+    if (!c) return cvBusError;
+    *data = c->read(addr & 0xFFFF);
+    if (width == cvD16) *data &= 0xFFFF;
+    return cvSuccess;
+}
+
+int SimVMEBridge::rawWrite(uint32_t addr, uint32_t *data, CVDataWidth width) {
+    SimCard *c = card(addr);
+    if (c) {
+        c->write(addr & 0xFFFF, width == cvD16 ? *data & 0xFFFF : *data);
+        return cvSuccess;
+    }
+    //multicast write to every card configured for the MCST address
+    bool found = false;
+    for (map<uint32_t,SimCard*>::iterator it = cards.begin(); it != cards.end(); it++) {
+        if (!it->second->chainOrder(addr >> 24)) continue;
+        it->second->write(addr & 0xFFFF, width == cvD16 ? *data & 0xFFFF : *data);
+        found = true;
+    }
+    return found ? cvSuccess : cvBusError;
+}
+
+int SimVMEBridge::rawBLT(uint32_t addr, void *buffer, uint32_t size, int *bytes) {
+    SimCard *c = card(addr);
+    *bytes = 0;
+    if (!c) return chainBLT(addr, (char*)buffer, size, bytes);
+    bool berr = false;
+    *bytes = c->blt(addr & 0xFFFF, (char*)buffer, size, berr);
+    return berr ? cvBusError : cvSuccess;
+}
+
+int SimVMEBridge::chainBLT(uint32_t addr, char *buffer, uint32_t size, int *bytes) {
+    const uint32_t chain_addr = addr >> 24;
+    map<uint32_t,SimCard*> chain;
+    for (map<uint32_t,SimCard*>::iterator it = cards.begin(); it != cards.end(); it++) {
+        const uint32_t order = it->second->chainOrder(chain_addr);
+        if (order) chain[order] = it->second;
+    }
+    if (!chain.size()) return cvBusError;
+    //the token passes down the chain as each board ends its part with a bus error
+    size_t &token = tokens[chain_addr];
+    map<uint32_t,SimCard*>::iterator it = chain.begin();
+    for (size_t i = 0; i < token && it != chain.end(); i++) it++;
+    uint32_t done = 0;
+    for ( ; it != chain.end() && done < size; it++, token++) {
+        bool berr = false;
+        done += it->second->blt(0, buffer + done, size - done, berr);
+        if (!berr) break;
+    }
+    *bytes = done;
+    if (it == chain.end()) {
+        token = 0;
+        return cvBusError;
+    }
+    return cvSuccess;
+}
+
+int SimVMEBridge::rawFIFOBLT(uint32_t addr, void *buffer, uint32_t size, int *bytes) {
+    //the modeled output buffers ignore the address offset anyway
+    return rawBLT(addr, buffer, size, bytes);
+}
+
+int SimVMEBridge::rawIRQEnable(uint32_t mask) {
+    return cvSuccess;
+}
+
+int SimVMEBridge::rawIRQWait(uint32_t mask, uint32_t timeout_ms) {
+    struct timespec start, cur;
+    clock_gettime(CLOCK_MONOTONIC,&start);
+    while (true) {
+        for (map<uint32_t,SimCard*>::iterator it = cards.begin(); it != cards.end(); it++) {
+            if (it->second->irq() & mask) return cvSuccess;
+        }
+        clock_gettime(CLOCK_MONOTONIC,&cur);
+        if (elapsed(start,cur)*1e3 >= timeout_ms) return cvTimeoutError;
+        usleep(50);
+    }
+}
+
+int SimVMEBridge::rawMultiRead(uint32_t *addrs, uint32_t *data, CVDataWidth *widths, CVErrorCodes *errs, int n) {
+    int res = cvSuccess;
+    for (int i = 0; i < n; i++) {
+        errs[i] = (CVErrorCodes)rawRead(addrs[i], &data[i], widths[i]);
+        if (errs[i]) res = cvGenericError;
+    }
+    return res;
+}
+
+int SimVMEBridge::rawMultiWrite(uint32_t *addrs, uint32_t *data, CVDataWidth *widths, CVErrorCodes *errs, int n) {
+    int res = cvSuccess;
+    for (int i = 0; i < n; i++) {
+        errs[i] = (CVErrorCodes)rawWrite(addrs[i], &data[i], widths[i]);
+        if (errs[i]) res = cvGenericError;
+    }
+    return res;
+}
@@ -0,0 +1,247 @@
+/**
+ *  Copyright 2014 by Benjamin Land (a.k.a. BenLand100)
+ *
+ *  WbLSdaq is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  WbLSdaq is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <map>
+#include <vector>
+#include <string>
+#include <ctime>
+
+#include "VMEBridge.hh"
+#include "RunDB.hh"
+
+#ifndef SimVMEBridge__hh
+#define SimVMEBridge__hh
+
+// Register level model of a card in the crate
+class SimCard {
+
+    public:
+
+        SimCard(std::string index);
+
+        virtual ~SimCard();
+
+        virtual uint32_t read(uint32_t reg);
+
+        virtual void write(uint32_t reg, uint32_t data);
+
+        //returns bytes copied, sets berr when the board terminates the transfer
+        virtual uint32_t blt(uint32_t reg, char *buffer, uint32_t size, bool &berr);
+
+        //IRQ lines (as a CAENVME mask) the card is asserting
+        virtual uint32_t irq();
+
+        //nonzero sort key of the card's place in the CBLT/MCST chain at A31..A24 = addr
+        virtual uint32_t chainOrder(uint32_t addr);
+
+    protected:
+
+        std::string index;
+        std::map<uint32_t,uint32_t> regs;
+
+        inline uint32_t get(uint32_t reg) {
+            std::map<uint32_t,uint32_t>::iterator it = regs.find(reg);
+            return it == regs.end() ? 0 : it->second;
+        }
+
+        inline void set(uint32_t reg, uint32_t data) {
+            regs[reg] = data;
+        }
+
+};
+
+// Trigger generation and block transfer behavior shared by the digitizers.
+// Triggers arrive at a fixed rate while acquisition is running and are stored
+// until the modeled board memory is full, after which they are dropped.
+class SimDigitizer : public SimCard {
+
+    public:
+
+        SimDigitizer(std::string index, double rate);
+
+        virtual ~SimDigitizer();
+
+        virtual uint32_t blt(uint32_t reg, char *buffer, uint32_t size, bool &berr);
+
+        //RORA interrupt, asserted while the interrupt event number of readouts are stored
+        virtual uint32_t irq();
+
+    protected:
+
+        double rate;
+        bool running;
+        struct timespec start_time;
+        uint64_t triggered, stored, readout, dropped;
+
+        std::vector<uint32_t> block;
+        size_t block_pos;
+
+        void startRun();
+
+        void stopRun();
+
+        //updates stored/dropped for triggers up to now and returns stored events
+        size_t pending();
+
+        //events the board memory can hold
+        virtual size_t capacity() = 0;
+
+        //events needed before the board reports data ready
+        virtual size_t readyThreshold() = 0;
+
+        //appends the next transfer worth of data to block, consuming stored events
+        virtual void buildBlock() = 0;
+
+        //called on acquisition start to precompute waveforms
+        virtual void prepare() = 0;
+
+};
+
+// V1730 with DPP-PSD firmware, producing board aggregates
+class SimV1730 : public SimDigitizer {
+
+    public:
+
+        SimV1730(std::string index, double rate);
+
+        virtual ~SimV1730();
+
+        virtual uint32_t read(uint32_t reg);
+
+        virtual void write(uint32_t reg, uint32_t data);
+
+        virtual uint32_t chainOrder(uint32_t addr);
+
+    protected:
+
+        uint32_t aggregate_counter;
+        uint32_t couple_mask, enable_mask;
+        uint32_t nsamples[8];
+        std::vector<uint32_t> waveforms[8];
+
+        virtual size_t capacity();
+
+        virtual size_t readyThreshold();
+
+        virtual void buildBlock();
+
+        virtual void prepare();
+
+        uint32_t eventsPerAggregate();
+
+        //event format from the board configuration
+        bool waveformsEnabled();
+
+        bool extrasEnabled();
+
+        uint32_t eventWords(uint32_t gr);
+
+        size_t aggregateWords(size_t nev);
+
+        void buildAggregate(size_t nev);
+
+};
+
+// V1742 producing event structures
+class SimV1742 : public SimDigitizer {
+
+    public:
+
+        SimV1742(std::string index, double rate);
+
+        virtual ~SimV1742();
+
+        virtual uint32_t read(uint32_t reg);
+
+        virtual void write(uint32_t reg, uint32_t data);
+
+    protected:
+
+        uint32_t group_mask, nsamples;
+        bool tr_readout;
+        std::vector<uint32_t> group_data, tr_data;
+
+        virtual size_t capacity();
+
+        virtual size_t readyThreshold();
+
+        virtual void buildBlock();
+
+        virtual void prepare();
+
+        size_t eventWords();
+
+        void buildEvent();
+
+};
+
+// V65XX high voltage supply, channels ramp instantly
+class SimV65XX : public SimCard {
+
+    public:
+
+        SimV65XX(std::string index, RunTable &config);
+
+        virtual ~SimV65XX();
+
+        virtual uint32_t read(uint32_t reg);
+
+};
+
+// Stand-in for the V1718 that routes cycles to simulated cards by base address.
+// Every V1730, V1742, and V65XX table in the RunDB gets a card at its
+// base_address; digitizers trigger at RUN[sim_rate] Hz unless the card table
+// has its own sim_rate.
+class SimVMEBridge : public VMEBridge {
+
+    public:
+
+        SimVMEBridge(RunDB &db, int link, int board);
+
+        virtual ~SimVMEBridge() noexcept(false);
+
+    protected:
+
+        std::map<uint32_t,SimCard*> cards;
+
+        //chain address -> index of the board holding the CBLT token
+        std::map<uint32_t,size_t> tokens;
+
+        SimCard* card(uint32_t addr);
+
+        //chained block transfer through every card in the chain at addr
+        int chainBLT(uint32_t addr, char *buffer, uint32_t size, int *bytes);
+
+        virtual int rawRead(uint32_t addr, uint32_t *data, CVDataWidth width);
+
+        virtual int rawWrite(uint32_t addr, uint32_t *data, CVDataWidth width);
+
+        virtual int rawBLT(uint32_t addr, void *buffer, uint32_t size, int *bytes);
+        
+        virtual int rawFIFOBLT(uint32_t addr, void *buffer, uint32_t size, int *bytes);
+        
+        virtual int rawIRQEnable(uint32_t mask);
+        
+        virtual int rawIRQWait(uint32_t mask, uint32_t timeout_ms);
+        
+        virtual int rawMultiRead(uint32_t *addrs, uint32_t *data, CVDataWidth *widths, CVErrorCodes *errs, int n);
+        
+        virtual int rawMultiWrite(uint32_t *addrs, uint32_t *data, CVDataWidth *widths, CVErrorCodes *errs, int n);
+
+};
+
+#endif
@@ -0,0 +1,242 @@
+/**
+ *  Copyright 2014 by Benjamin Land (a.k.a. BenLand100)
+ *
+ *  WbLSdaq is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  WbLSdaq is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <stdexcept>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+
+#include "SlowControl.hh"
+
+using namespace std;
+using namespace H5;
+
+//samples held for the decode thread, enough for hours at typical periods
+#define MONITOR_SAMPLES 4096
+
+SlowControl::SlowControl(vector<Digitizer*> &_digitizers, vector<DigitizerSettings*> &_settings, vector<V65XX*> &_hvs, vector<string> &_hvnames, pthread_mutex_t *_iomutex, uint32_t _period, uint32_t _danger) :
+    digitizers(_digitizers), settings(_settings), hvs(_hvs), hvnames(_hvnames), iomutex(_iomutex), period(_period), danger(_danger),
+    running(false), alarmed(false), dropped(0),
+    sample_size(sampleSize(_digitizers,_hvs,ntemps)), samples(sample_size*MONITOR_SAMPLES) {
+
+}
+
+SlowControl::~SlowControl() {
+    stop();
+}
+
+size_t SlowControl::sampleSize(vector<Digitizer*> &digitizers, vector<V65XX*> &hvs, vector<size_t> &ntemps) {
+    size_t size = sizeof(double);
+    vector<uint32_t> temps;
+    for (size_t i = 0; i < digitizers.size(); i++) {
+        digitizers[i]->checkTemps(temps,0xFFFFFFFF);
+        ntemps.push_back(temps.size());
+        size += (temps.size()+1)*sizeof(uint32_t);
+    }
+    for (size_t i = 0; i < hvs.size(); i++) {
+        size += hvs[i]->getNumChans()*(2*sizeof(float)+sizeof(uint32_t));
+    }
+    //keep the time of each sample aligned
+    return size%8 ? (size/8+1)*8 : size;
+}
+
+void SlowControl::start() {
+    if (running.load()) return;
+    running.store(true);
+    pthread_create(&thread,NULL,&SlowControl::poll_thread,this);
+}
+
+void SlowControl::stop() {
+    if (!running.load()) return;
+    running.store(false);
+    pthread_join(thread,NULL);
+    if (dropped) cout << "Slow control dropped " << dropped << " samples (decode thread not keeping up)" << endl;
+}
+
+void *SlowControl::poll_thread(void *_self) {
+    SlowControl *self = (SlowControl*)_self;
+    try {
+        while (self->running.load()) {
+            self->poll();
+            //sleep in short steps so stop() does not wait out a whole period
+            for (uint32_t t = 0; t < self->period*10 && self->running.load(); t++) usleep(100000);
+        }
+    } catch (runtime_error &e) {
+        self->alarmed.store(true);
+        pthread_mutex_lock(self->iomutex);
+        cout << "Slow control aborted: " << e.what() << endl;
+        pthread_mutex_unlock(self->iomutex);
+    }
+    pthread_exit(NULL);
+}
+
+void SlowControl::poll() {
+    //the sample is built in place when there is room, otherwise only checked
+    vector<char> spare;
+    char *sample;
+    if (samples.free() >= sample_size) {
+        sample = samples.wptr();
+    } else {
+        spare.resize(sample_size);
+        sample = spare.data();
+        dropped++;
+    }
+    char *pos = sample;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME,&now);
+    *(double*)pos = now.tv_sec + 1e-9*now.tv_nsec;
+    pos += sizeof(double);
+
+    vector<vector<uint32_t>> temps(digitizers.size());
+    bool overtemp = false;
+    for (size_t i = 0; i < digitizers.size(); i++) {
+        overtemp |= digitizers[i]->checkTemps(temps[i],danger);
+        if (temps[i].size() != ntemps[i]) throw runtime_error("Temperature count changed for " + settings[i]->getIndex());
+        memcpy(pos,temps[i].data(),ntemps[i]*sizeof(uint32_t));
+        pos += ntemps[i]*sizeof(uint32_t);
+        *(uint32_t*)pos = digitizers[i]->acquisitionRunning() ? 1 : 0;
+        pos += sizeof(uint32_t);
+    }
+
+    vector<float> V, I;
+    vector<uint32_t> status;
+    vector<string> hvwarnings;
+    for (size_t i = 0; i < hvs.size(); i++) {
+        hvs[i]->monitor(V,I,status);
+        for (size_t ch = 0; ch < V.size(); ch++) {
+            memcpy(pos,&V[ch],sizeof(float));
+            pos += sizeof(float);
+            memcpy(pos,&I[ch],sizeof(float));
+            pos += sizeof(float);
+            memcpy(pos,&status[ch],sizeof(uint32_t));
+            pos += sizeof(uint32_t);
+            if (status[ch] & (V65XX::CH_OVERI | V65XX::CH_OVERV | V65XX::CH_UNDERV | V65XX::CH_MAXV | V65XX::CH_MAXI | V65XX::CH_TRIP | V65XX::CH_OVER_POWER | V65XX::CH_OVER_TEMP)) {
+                hvwarnings.push_back(hvnames[i] + " ch" + to_string(ch));
+            }
+        }
+    }
+
+    if (sample != spare.data()) samples.inc(sample_size);
+
+    pthread_mutex_lock(iomutex);
+    cout << "Temperature check..." << endl;
+    for (size_t i = 0; i < digitizers.size(); i++) {
+        cout << settings[i]->getIndex() << " : [";
+        for (size_t t = 0; t < temps[i].size(); t++) cout << (t ? ", " : " ") << temps[i][t];
+        cout << " ]" << endl;
+    }
+    if (overtemp) {
+        cout << "Overtemp! Aborting readout." << endl;
+        alarmed.store(true);
+    }
+    for (size_t i = 0; i < hvwarnings.size(); i++) {
+        cout << "HV warning on " << hvwarnings[i] << "! Aborting readout." << endl;
+        alarmed.store(true);
+    }
+    pthread_mutex_unlock(iomutex);
+}
+
+void SlowControl::writeOut(H5File &file, ostream &out) {
+    const size_t n = samples.fill()/sample_size;
+
+    out << "\t/monitor" << endl;
+
+    Group group = file.createGroup("/monitor");
+
+    DataSpace scalar(0,NULL);
+    Attribute period_s = group.createAttribute("period_s",PredType::NATIVE_UINT32,scalar);
+    period_s.write(PredType::NATIVE_UINT32,&period);
+
+    //unpack the samples into one array per dataset
+    vector<double> times(n);
+    vector<vector<uint32_t>> temps(digitizers.size()), running(digitizers.size());
+    vector<vector<float>> V(hvs.size()), I(hvs.size());
+    vector<vector<uint32_t>> status(hvs.size());
+    for (size_t i = 0; i < digitizers.size(); i++) {
+        temps[i].resize(n*ntemps[i]);
+        running[i].resize(n);
+    }
+    for (size_t i = 0; i < hvs.size(); i++) {
+        V[i].resize(n*hvs[i]->getNumChans());
+        I[i].resize(n*hvs[i]->getNumChans());
+        status[i].resize(n*hvs[i]->getNumChans());
+    }
+    for (size_t s = 0; s < n; s++) {
+        const char *pos = samples.rptr() + s*sample_size;
+        times[s] = *(const double*)pos;
+        pos += sizeof(double);
+        for (size_t i = 0; i < digitizers.size(); i++) {
+            memcpy(&temps[i][s*ntemps[i]],pos,ntemps[i]*sizeof(uint32_t));
+            pos += ntemps[i]*sizeof(uint32_t);
+            running[i][s] = *(const uint32_t*)pos;
+            pos += sizeof(uint32_t);
+        }
+        for (size_t i = 0; i < hvs.size(); i++) {
+            const size_t nch = hvs[i]->getNumChans();
+            for (size_t ch = 0; ch < nch; ch++) {
+                memcpy(&V[i][s*nch+ch],pos,sizeof(float));
+                pos += sizeof(float);
+                memcpy(&I[i][s*nch+ch],pos,sizeof(float));
+                pos += sizeof(float);
+                memcpy(&status[i][s*nch+ch],pos,sizeof(uint32_t));
+                pos += sizeof(uint32_t);
+            }
+        }
+    }
+    samples.dec(n*sample_size);
+
+    hsize_t dimensions[2];
+    dimensions[0] = n;
+    DataSpace timespace(1, dimensions);
+    DataSet times_ds = file.createDataSet("/monitor/unix_time", PredType::NATIVE_DOUBLE, timespace);
+    times_ds.write(times.data(), PredType::NATIVE_DOUBLE);
+
+    for (size_t i = 0; i < digitizers.size(); i++) {
+        string groupname = "/monitor/"+settings[i]->getIndex();
+        file.createGroup(groupname);
+        out << "\t" << groupname << endl;
+
+        dimensions[1] = ntemps[i];
+        DataSpace tempspace(2, dimensions);
+        DataSet temps_ds = file.createDataSet(groupname+"/temps", PredType::NATIVE_UINT32, tempspace);
+        //replayed cards have no temperatures
+        if (ntemps[i]) temps_ds.write(temps[i].data(), PredType::NATIVE_UINT32);
+
+        DataSet running_ds = file.createDataSet(groupname+"/running", PredType::NATIVE_UINT32, timespace);
+        running_ds.write(running[i].data(), PredType::NATIVE_UINT32);
+    }
+
+    for (size_t i = 0; i < hvs.size(); i++) {
+        string groupname = "/monitor/"+hvnames[i];
+        file.createGroup(groupname);
+        out << "\t" << groupname << endl;
+
+        dimensions[1] = hvs[i]->getNumChans();
+        DataSpace chanspace(2, dimensions);
+
+        DataSet V_ds = file.createDataSet(groupname+"/V", PredType::NATIVE_FLOAT, chanspace);
+        V_ds.write(V[i].data(), PredType::NATIVE_FLOAT);
+
+        DataSet I_ds = file.createDataSet(groupname+"/I", PredType::NATIVE_FLOAT, chanspace);
+        I_ds.write(I[i].data(), PredType::NATIVE_FLOAT);
+
+        DataSet status_ds = file.createDataSet(groupname+"/status", PredType::NATIVE_UINT32, chanspace);
+        status_ds.write(status[i].data(), PredType::NATIVE_UINT32);
+    }
+}
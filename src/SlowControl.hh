@@ -0,0 +1,85 @@
+/**
+ *  Copyright 2014 by Benjamin Land (a.k.a. BenLand100)
+ *
+ *  WbLSdaq is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  WbLSdaq is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <vector>
+#include <string>
+#include <pthread.h>
+
+#include "Digitizer.hh"
+#include "V65XX.hh"
+#include "Buffer.hh"
+#include <H5Cpp.h>
+
+#ifndef SlowControl__hh
+#define SlowControl__hh
+
+// Polls digitizer temperatures and acquisition status and V65XX channels on
+// its own thread so the readout loop never waits on slow register reads. Each
+// poll is packed into a fixed size sample and handed to the decode thread
+// through a Buffer; writeOut stores the samples since the last file as time
+// series under /monitor. Readout only has to check alarm().
+class SlowControl {
+
+    public:
+
+        SlowControl(std::vector<Digitizer*> &digitizers, std::vector<DigitizerSettings*> &settings, std::vector<V65XX*> &hvs, std::vector<std::string> &hvnames, pthread_mutex_t *iomutex, uint32_t period, uint32_t danger);
+
+        virtual ~SlowControl();
+
+        void start();
+
+        //stops polling and waits for the thread to finish
+        void stop();
+
+        //set once any digitizer is over temperature or an HV channel reports a problem
+        inline bool alarm() {
+            return alarmed.load(std::memory_order_relaxed);
+        }
+
+        //called from the file writer only, listing what it creates to out
+        void writeOut(H5::H5File &file, std::ostream &out);
+
+    protected:
+
+        std::vector<Digitizer*> digitizers;
+        std::vector<DigitizerSettings*> settings;
+        std::vector<V65XX*> hvs;
+        std::vector<std::string> hvnames;
+        pthread_mutex_t *iomutex;
+        uint32_t period, danger;
+
+        pthread_t thread;
+        std::atomic<bool> running, alarmed;
+        size_t dropped;
+
+        //layout of one sample: unix time, then per digitizer its temperatures
+        //and running flag, then per HV channel V, I, and status
+        std::vector<size_t> ntemps;
+        size_t sample_size;
+        Buffer samples;
+
+        static void *poll_thread(void *_self);
+
+        void poll();
+
+        //digitizer and V65XX temps/channels are read once to size the samples
+        static size_t sampleSize(std::vector<Digitizer*> &digitizers, std::vector<V65XX*> &hvs, std::vector<size_t> &ntemps);
+
+};
+
+#endif
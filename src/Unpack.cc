@@ -0,0 +1,358 @@
+/**
+ *  Copyright 2014 by Benjamin Land (a.k.a. BenLand100)
+ *
+ *  WbLSdaq is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  WbLSdaq is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <immintrin.h>
+
+#include "Unpack.hh"
+
+// 12 bit packing is little endian: value k of a block occupies bits 12k..12k+11
+// of the 96 bits in three words. The vector kernels shuffle each 12 byte block
+// into 16 bit lanes holding bytes (3j,3j+1) and (3j+1,3j+2), then mask the even
+// lanes and shift the odd ones. Loads are 16 bytes, so the last block of the
+// input is always left to the scalar code to avoid reading past the data.
+
+static void unpack12_channels_scalar(const uint32_t *word, uint16_t *const *data, size_t nsamples) {
+    for (size_t s = 0; s < nsamples; s++, word += 3) {
+        data[0][s] = word[0]&0xFFF;
+        data[1][s] = (word[0]>>12)&0xFFF;
+        data[2][s] = ((word[1]&0xF)<<8)|((word[0]>>24)&0xFF);
+        data[3][s] = (word[1]>>4)&0xFFF;
+        data[4][s] = (word[1]>>16)&0xFFF;
+        data[5][s] = ((word[2]&0xFF)<<4)|((word[1]>>28)&0xF);
+        data[6][s] = (word[2]>>8)&0xFFF;
+        data[7][s] = (word[2]>>20)&0xFFF;
+    }
+}
+
+static void unpack12_stream_scalar(const uint32_t *word, uint16_t *data, size_t nsamples) {
+    for (size_t s = 0; s < nsamples; word += 3) {
+        data[s++] = word[0]&0xFFF;
+        data[s++] = (word[0]>>12)&0xFFF;
+        data[s++] = ((word[1]&0xF)<<8)|((word[0]>>24)&0xFF);
+        data[s++] = (word[1]>>4)&0xFFF;
+        data[s++] = (word[1]>>16)&0xFFF;
+        data[s++] = ((word[2]&0xFF)<<4)|((word[1]>>28)&0xF);
+        data[s++] = (word[2]>>8)&0xFFF;
+        data[s++] = (word[2]>>20)&0xFFF;
+    }
+}
+
+static void unpack14_pairs_scalar(const uint32_t *word, uint16_t *data, uint8_t *probes, size_t nsamples) {
+    for (size_t s = 0; s < nsamples; word++, s += 2) {
+        data[s+0] = *word & 0x3FFF;
+        data[s+1] = (*word >> 16) & 0x3FFF;
+    }
+    if (!probes) return;
+    word -= nsamples/2;
+    for (size_t s = 0; s < nsamples; word++, s += 2) {
+        probes[s+0] = (*word >> 14) & 0x3;
+        probes[s+1] = (*word >> 30) & 0x3;
+    }
+}
+
+//subtracts the DRS4 offsets of a channel, leaving the rails alone and clamping to them
+static void drs4_offsets_scalar(uint16_t *data, const int16_t *seq, const int16_t *cell, size_t nsamples) {
+    for (size_t i = 0; i < nsamples; i++) {
+        if (data[i] == 0 || data[i] == 4095) continue; //don't correct rails
+        uint16_t s = data[i] - seq[i] - cell[i];
+        if (s >= 0xF000) {
+            s = 0; //fix correction below lower rail
+        } else if (s >= 0x0FFF) {
+            s = 0x0FFF; //fix correction above upper rail
+        }
+        data[i] = s;
+    }
+}
+
+//one position of the spike correction, i and the positions after it wrap
+static inline void drs4_spike_at(uint16_t *const *data, size_t nchannels, size_t i, size_t nsamples) {
+    const size_t i1 = (i+1)%nsamples, i2 = (i+2)%nsamples, i3 = (i+3)%nsamples;
+    int identified = 0;
+    for (size_t ch = 0; ch < nchannels; ch++) {
+        if (data[ch][i]-data[ch][i1] > 30 && data[ch][i3]-data[ch][i2] > 30) identified++;
+    }
+    if (identified > 4) {
+        for (size_t ch = 0; ch < 8; ch++) {
+            data[ch][i1] += 53;
+            data[ch][i2] += 53;
+        }
+    }
+}
+
+static void drs4_spikes_scalar(uint16_t *const *data, size_t nchannels, size_t nsamples) {
+    for (size_t i = 0; i < nsamples; i++) drs4_spike_at(data, nchannels, i, nsamples);
+}
+
+//finishes a channel unpack from sample s with the scalar kernel
+static inline void unpack12_channels_tail(const uint32_t *words, uint16_t *const *data, size_t s, size_t nsamples) {
+    uint16_t *tail[8];
+    for (size_t ch = 0; ch < 8; ch++) tail[ch] = data[ch] + s;
+    unpack12_channels_scalar(words + 3*s, tail, nsamples - s);
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i unpack12_sse41(const char *block) {
+    const __m128i shuf = _mm_setr_epi8(0,1, 1,2, 3,4, 4,5, 6,7, 7,8, 9,10, 10,11);
+    const __m128i x = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)block), shuf);
+    return _mm_blend_epi16(_mm_and_si128(x, _mm_set1_epi16(0x0FFF)), _mm_srli_epi16(x, 4), 0xAA);
+}
+
+// The 14 bit pairs are already in sample order as 16 bit lanes, so the vector
+// kernels only mask the samples and shift the probe bits down, packing them
+// to bytes when they are wanted.
+
+__attribute__((target("sse4.1")))
+static void unpack14_pairs_sse41(const uint32_t *words, uint16_t *data, uint8_t *probes, size_t nsamples) {
+    const __m128i mask = _mm_set1_epi16(0x3FFF);
+    size_t s = 0;
+    for ( ; s + 8 <= nsamples; s += 8) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)(words + s/2));
+        _mm_storeu_si128((__m128i*)(data + s), _mm_and_si128(x, mask));
+        if (probes) {
+            const __m128i p = _mm_srli_epi16(x, 14);
+            _mm_storel_epi64((__m128i*)(probes + s), _mm_packus_epi16(p, p));
+        }
+    }
+    unpack14_pairs_scalar(words + s/2, data + s, probes ? probes + s : NULL, nsamples - s);
+}
+
+__attribute__((target("sse4.1")))
+static void unpack12_channels_sse41(const uint32_t *words, uint16_t *const *data, size_t nsamples) {
+    const char *bytes = (const char*)words;
+    size_t s = 0;
+    //8 samples of 8 channels, transposed so each channel gets 8 samples
+    for ( ; s + 8 < nsamples; s += 8) {
+        __m128i r[8], t[8], u[8];
+        for (size_t k = 0; k < 8; k++) r[k] = unpack12_sse41(bytes + 12*(s+k));
+        for (size_t k = 0; k < 4; k++) {
+            t[2*k] = _mm_unpacklo_epi16(r[2*k], r[2*k+1]);
+            t[2*k+1] = _mm_unpackhi_epi16(r[2*k], r[2*k+1]);
+        }
+        u[0] = _mm_unpacklo_epi32(t[0], t[2]); u[1] = _mm_unpackhi_epi32(t[0], t[2]);
+        u[2] = _mm_unpacklo_epi32(t[1], t[3]); u[3] = _mm_unpackhi_epi32(t[1], t[3]);
+        u[4] = _mm_unpacklo_epi32(t[4], t[6]); u[5] = _mm_unpackhi_epi32(t[4], t[6]);
+        u[6] = _mm_unpacklo_epi32(t[5], t[7]); u[7] = _mm_unpackhi_epi32(t[5], t[7]);
+        for (size_t k = 0; k < 4; k++) {
+            _mm_storeu_si128((__m128i*)(data[2*k] + s), _mm_unpacklo_epi64(u[k], u[k+4]));
+            _mm_storeu_si128((__m128i*)(data[2*k+1] + s), _mm_unpackhi_epi64(u[k], u[k+4]));
+        }
+    }
+    unpack12_channels_tail(words, data, s, nsamples);
+}
+
+__attribute__((target("sse4.1")))
+static void unpack12_stream_sse41(const uint32_t *words, uint16_t *data, size_t nsamples) {
+    const char *bytes = (const char*)words;
+    size_t s = 0;
+    for ( ; s + 8 < nsamples; s += 8) {
+        _mm_storeu_si128((__m128i*)(data + s), unpack12_sse41(bytes + s/8*12));
+    }
+    unpack12_stream_scalar(words + s/8*3, data + s, nsamples - s);
+}
+
+// The offset kernels subtract in 16 bit lanes, which wraps exactly like the
+// scalar code's truncation, then clamp with unsigned min/max. The spike
+// kernels count dipping channels for a block of positions at once; only a
+// block with a spike, which changes the samples the next positions look at,
+// is redone one position at a time, as are the last positions that wrap.
+
+__attribute__((target("sse4.1")))
+static void drs4_offsets_sse41(uint16_t *data, const int16_t *seq, const int16_t *cell, size_t nsamples) {
+    const __m128i upper = _mm_set1_epi16(0x0FFF), negative = _mm_set1_epi16((short)0xF000), zero = _mm_setzero_si128();
+    size_t i = 0;
+    for ( ; i + 8 <= nsamples; i += 8) {
+        const __m128i s = _mm_loadu_si128((const __m128i*)(data + i));
+        const __m128i offset = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(seq + i)), _mm_loadu_si128((const __m128i*)(cell + i)));
+        const __m128i r = _mm_sub_epi16(s, offset);
+        const __m128i below = _mm_cmpeq_epi16(_mm_max_epu16(r, negative), r);
+        const __m128i c = _mm_andnot_si128(below, _mm_min_epu16(r, upper));
+        const __m128i rail = _mm_or_si128(_mm_cmpeq_epi16(s, zero), _mm_cmpeq_epi16(s, upper));
+        _mm_storeu_si128((__m128i*)(data + i), _mm_blendv_epi8(c, s, rail));
+    }
+    drs4_offsets_scalar(data + i, seq + i, cell + i, nsamples - i);
+}
+
+__attribute__((target("sse4.1")))
+static void drs4_spikes_sse41(uint16_t *const *data, size_t nchannels, size_t nsamples) {
+    const __m128i dip = _mm_set1_epi16(30), many = _mm_set1_epi16(4);
+    size_t i = 0;
+    while (i + 8 + 3 <= nsamples) {
+        __m128i count = _mm_setzero_si128();
+        for (size_t ch = 0; ch < nchannels; ch++) {
+            const uint16_t *d = data[ch] + i;
+            const __m128i s0 = _mm_loadu_si128((const __m128i*)(d+0)), s1 = _mm_loadu_si128((const __m128i*)(d+1));
+            const __m128i s2 = _mm_loadu_si128((const __m128i*)(d+2)), s3 = _mm_loadu_si128((const __m128i*)(d+3));
+            const __m128i hit = _mm_and_si128(_mm_cmpgt_epi16(_mm_sub_epi16(s0, s1), dip), _mm_cmpgt_epi16(_mm_sub_epi16(s3, s2), dip));
+            count = _mm_sub_epi16(count, hit);
+        }
+        const __m128i spikes = _mm_cmpgt_epi16(count, many);
+        if (_mm_testz_si128(spikes, spikes)) {
+            i += 8;
+            continue;
+        }
+        for (const size_t end = i + 8; i < end; i++) drs4_spike_at(data, nchannels, i, nsamples);
+    }
+    for ( ; i < nsamples; i++) drs4_spike_at(data, nchannels, i, nsamples);
+}
+
+//as unpack12_sse41 for two blocks at once, one per 128 bit lane
+__attribute__((target("avx2")))
+static inline __m256i unpack12_avx2(const char *lo, const char *hi) {
+    const __m256i shuf = _mm256_setr_epi8(0,1, 1,2, 3,4, 4,5, 6,7, 7,8, 9,10, 10,11,
+                                          0,1, 1,2, 3,4, 4,5, 6,7, 7,8, 9,10, 10,11);
+    const __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)lo)), _mm_loadu_si128((const __m128i*)hi), 1);
+    const __m256i x = _mm256_shuffle_epi8(in, shuf);
+    return _mm256_blend_epi16(_mm256_and_si256(x, _mm256_set1_epi16(0x0FFF)), _mm256_srli_epi16(x, 4), 0xAA);
+}
+
+__attribute__((target("avx2")))
+static void unpack14_pairs_avx2(const uint32_t *words, uint16_t *data, uint8_t *probes, size_t nsamples) {
+    const __m256i mask = _mm256_set1_epi16(0x3FFF);
+    size_t s = 0;
+    for ( ; s + 16 <= nsamples; s += 16) {
+        const __m256i x = _mm256_loadu_si256((const __m256i*)(words + s/2));
+        _mm256_storeu_si256((__m256i*)(data + s), _mm256_and_si256(x, mask));
+        if (probes) {
+            //packus works within lanes, so gather the low half of each lane
+            const __m256i p = _mm256_srli_epi16(x, 14);
+            const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(p, p), 0x08);
+            _mm_storeu_si128((__m128i*)(probes + s), _mm256_castsi256_si128(packed));
+        }
+    }
+    unpack14_pairs_scalar(words + s/2, data + s, probes ? probes + s : NULL, nsamples - s);
+}
+
+__attribute__((target("avx2")))
+static void unpack12_channels_avx2(const uint32_t *words, uint16_t *const *data, size_t nsamples) {
+    const char *bytes = (const char*)words;
+    size_t s = 0;
+    //samples s..s+7 in the low lanes and s+8..s+15 in the high lanes, the
+    //in-lane transpose then leaves 16 consecutive samples per channel
+    for ( ; s + 16 < nsamples; s += 16) {
+        __m256i r[8], t[8], u[8];
+        for (size_t k = 0; k < 8; k++) r[k] = unpack12_avx2(bytes + 12*(s+k), bytes + 12*(s+k+8));
+        for (size_t k = 0; k < 4; k++) {
+            t[2*k] = _mm256_unpacklo_epi16(r[2*k], r[2*k+1]);
+            t[2*k+1] = _mm256_unpackhi_epi16(r[2*k], r[2*k+1]);
+        }
+        u[0] = _mm256_unpacklo_epi32(t[0], t[2]); u[1] = _mm256_unpackhi_epi32(t[0], t[2]);
+        u[2] = _mm256_unpacklo_epi32(t[1], t[3]); u[3] = _mm256_unpackhi_epi32(t[1], t[3]);
+        u[4] = _mm256_unpacklo_epi32(t[4], t[6]); u[5] = _mm256_unpackhi_epi32(t[4], t[6]);
+        u[6] = _mm256_unpacklo_epi32(t[5], t[7]); u[7] = _mm256_unpackhi_epi32(t[5], t[7]);
+        for (size_t k = 0; k < 4; k++) {
+            _mm256_storeu_si256((__m256i*)(data[2*k] + s), _mm256_unpacklo_epi64(u[k], u[k+4]));
+            _mm256_storeu_si256((__m256i*)(data[2*k+1] + s), _mm256_unpackhi_epi64(u[k], u[k+4]));
+        }
+    }
+    unpack12_channels_tail(words, data, s, nsamples);
+}
+
+__attribute__((target("avx2")))
+static void unpack12_stream_avx2(const uint32_t *words, uint16_t *data, size_t nsamples) {
+    const char *bytes = (const char*)words;
+    size_t s = 0;
+    for ( ; s + 16 < nsamples; s += 16) {
+        _mm256_storeu_si256((__m256i*)(data + s), unpack12_avx2(bytes + s/8*12, bytes + s/8*12 + 12));
+    }
+    unpack12_stream_scalar(words + s/8*3, data + s, nsamples - s);
+}
+
+__attribute__((target("avx2")))
+static void drs4_offsets_avx2(uint16_t *data, const int16_t *seq, const int16_t *cell, size_t nsamples) {
+    const __m256i upper = _mm256_set1_epi16(0x0FFF), negative = _mm256_set1_epi16((short)0xF000), zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for ( ; i + 16 <= nsamples; i += 16) {
+        const __m256i s = _mm256_loadu_si256((const __m256i*)(data + i));
+        const __m256i offset = _mm256_add_epi16(_mm256_loadu_si256((const __m256i*)(seq + i)), _mm256_loadu_si256((const __m256i*)(cell + i)));
+        const __m256i r = _mm256_sub_epi16(s, offset);
+        const __m256i below = _mm256_cmpeq_epi16(_mm256_max_epu16(r, negative), r);
+        const __m256i c = _mm256_andnot_si256(below, _mm256_min_epu16(r, upper));
+        const __m256i rail = _mm256_or_si256(_mm256_cmpeq_epi16(s, zero), _mm256_cmpeq_epi16(s, upper));
+        _mm256_storeu_si256((__m256i*)(data + i), _mm256_blendv_epi8(c, s, rail));
+    }
+    drs4_offsets_scalar(data + i, seq + i, cell + i, nsamples - i);
+}
+
+__attribute__((target("avx2")))
+static void drs4_spikes_avx2(uint16_t *const *data, size_t nchannels, size_t nsamples) {
+    const __m256i dip = _mm256_set1_epi16(30), many = _mm256_set1_epi16(4);
+    size_t i = 0;
+    while (i + 16 + 3 <= nsamples) {
+        __m256i count = _mm256_setzero_si256();
+        for (size_t ch = 0; ch < nchannels; ch++) {
+            const uint16_t *d = data[ch] + i;
+            const __m256i s0 = _mm256_loadu_si256((const __m256i*)(d+0)), s1 = _mm256_loadu_si256((const __m256i*)(d+1));
+            const __m256i s2 = _mm256_loadu_si256((const __m256i*)(d+2)), s3 = _mm256_loadu_si256((const __m256i*)(d+3));
+            const __m256i hit = _mm256_and_si256(_mm256_cmpgt_epi16(_mm256_sub_epi16(s0, s1), dip), _mm256_cmpgt_epi16(_mm256_sub_epi16(s3, s2), dip));
+            count = _mm256_sub_epi16(count, hit);
+        }
+        const __m256i spikes = _mm256_cmpgt_epi16(count, many);
+        if (_mm256_testz_si256(spikes, spikes)) {
+            i += 16;
+            continue;
+        }
+        for (const size_t end = i + 16; i < end; i++) drs4_spike_at(data, nchannels, i, nsamples);
+    }
+    for ( ; i < nsamples; i++) drs4_spike_at(data, nchannels, i, nsamples);
+}
+
+void (*unpack12_channels)(const uint32_t *words, uint16_t *const *channels, size_t nsamples) = &unpack12_channels_scalar;
+void (*unpack12_stream)(const uint32_t *words, uint16_t *data, size_t nsamples) = &unpack12_stream_scalar;
+void (*unpack14_pairs)(const uint32_t *words, uint16_t *data, uint8_t *probes, size_t nsamples) = &unpack14_pairs_scalar;
+void (*drs4_offsets)(uint16_t *data, const int16_t *seq, const int16_t *cell, size_t nsamples) = &drs4_offsets_scalar;
+void (*drs4_spikes)(uint16_t *const *channels, size_t nchannels, size_t nsamples) = &drs4_spikes_scalar;
+
+static UnpackISA selected = unpack_select();
+
+UnpackISA unpack_select(UnpackISA isa) {
+    __builtin_cpu_init();
+    if (isa >= UNPACK_AVX2 && __builtin_cpu_supports("avx2")) {
+        unpack12_channels = &unpack12_channels_avx2;
+        unpack12_stream = &unpack12_stream_avx2;
+        unpack14_pairs = &unpack14_pairs_avx2;
+        drs4_offsets = &drs4_offsets_avx2;
+        drs4_spikes = &drs4_spikes_avx2;
+        selected = UNPACK_AVX2;
+    } else if (isa >= UNPACK_SSE41 && __builtin_cpu_supports("sse4.1")) {
+        unpack12_channels = &unpack12_channels_sse41;
+        unpack12_stream = &unpack12_stream_sse41;
+        unpack14_pairs = &unpack14_pairs_sse41;
+        drs4_offsets = &drs4_offsets_sse41;
+        drs4_spikes = &drs4_spikes_sse41;
+        selected = UNPACK_SSE41;
+    } else {
+        unpack12_channels = &unpack12_channels_scalar;
+        unpack12_stream = &unpack12_stream_scalar;
+        unpack14_pairs = &unpack14_pairs_scalar;
+        drs4_offsets = &drs4_offsets_scalar;
+        drs4_spikes = &drs4_spikes_scalar;
+        selected = UNPACK_SCALAR;
+    }
+    return selected;
+}
+
+UnpackISA unpack_selected() {
+    return selected;
+}
+
+const char* unpack_name(UnpackISA isa) {
+    switch (isa) {
+        case UNPACK_AVX2: return "avx2";
+        case UNPACK_SSE41: return "sse4.1";
+        default: return "scalar";
+    }
+}
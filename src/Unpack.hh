@@ -0,0 +1,62 @@
+/**
+ *  Copyright 2014 by Benjamin Land (a.k.a. BenLand100)
+ *
+ *  WbLSdaq is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  WbLSdaq is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include <cstddef>
+
+#ifndef Unpack__hh
+#define Unpack__hh
+
+// Sample unpacking and correction kernels used by the decoders. Each kernel
+// has a scalar version and vector versions; the best one the CPU supports is
+// selected at startup by feature detection, and a lower level can be selected
+// to compare them (see unpackbench). The Makefile builds with -march=native,
+// so binaries are still only meant for the machine that built them.
+
+enum UnpackISA { UNPACK_SCALAR, UNPACK_SSE41, UNPACK_AVX2 };
+
+//selects the kernels for isa, or the best supported level below it, and
+//returns the level selected
+UnpackISA unpack_select(UnpackISA isa = UNPACK_AVX2);
+
+UnpackISA unpack_selected();
+
+const char* unpack_name(UnpackISA isa);
+
+//V1742 group data: every 3 words hold one 12 bit sample of each of 8 channels,
+//written to channels[ch][0..nsamples)
+extern void (*unpack12_channels)(const uint32_t *words, uint16_t *const *channels, size_t nsamples);
+
+//V1742 TR data: every 3 words hold 8 consecutive 12 bit samples
+extern void (*unpack12_stream)(const uint32_t *words, uint16_t *data, size_t nsamples);
+
+//V1730 DPP waveform: every word holds two 14 bit samples, each followed by its
+//two digital probe bits. If probes is not NULL the probe bits of each sample
+//are also written there (bit 0 = DP1, bit 1 = DP2).
+extern void (*unpack14_pairs)(const uint32_t *words, uint16_t *data, uint8_t *probes, size_t nsamples);
+
+//V1742 DRS4 offset correction in place: data[i] -= seq[i] + cell[i], where
+//cell is the cell offset table already rotated to the event's start cell.
+//Samples on the 0 and 4095 rails are left alone and results clamp to 12 bits.
+extern void (*drs4_offsets)(uint16_t *data, const int16_t *seq, const int16_t *cell, size_t nsamples);
+
+//V1742 DRS4 spike correction: where more than 4 of the first nchannels show a
+//two sample dip of more than 30 counts, the dip is raised by 53 in the first 8
+//channels. Positions wrap around the end of the event.
+extern void (*drs4_spikes)(uint16_t *const *channels, size_t nchannels, size_t nsamples);
+
+#endif
@@ -16,10 +16,12 @@
  */
  
 #include <cmath>
+#include <cstring>
 #include <iostream>
 #include <stdexcept>
  
 #include "V1730_dpppsd.hh"
+#include "Unpack.hh"
 
 using namespace std;
 
@@ -28,8 +30,10 @@ V1730Settings::V1730Settings() : DigitizerSettings("") {
     card.dual_trace = 0; // 1 bit
     card.analog_probe = 0; // 2 bit (see docs)
     card.oscilloscope_mode = 1; // 1 bit
+    card.extras = 1; // 1 bit
     card.digital_virt_probe_1 = 0; // 3 bit (see docs)
     card.digital_virt_probe_2 = 0; // 3 bit (see docs)
+    card.save_probes = 0; // 1 bit
     card.coincidence_window = 1; // 3 bit
     card.global_majority_level = 0; // 3 bit
     card.external_global_trigger = 0; // 1 bit
@@ -39,6 +43,10 @@ V1730Settings::V1730Settings() : DigitizerSettings("") {
     card.external_trg_out = 0; // 1 bit
     card.software_trg_out = 0; // 1 bit
     card.max_board_agg_blt = 5;
+    card.board_id = 0; // 5 bit
+    card.chain_addr = 0; // 8 bit
+    card.chain_pos = 0; // 2 bit
+    card.chain_align = 0; // 1 bit
     
     for (uint32_t ch = 0; ch < 16; ch++) {
         chanDefaults(ch);
@@ -50,9 +58,11 @@ V1730Settings::V1730Settings(RunTable &digitizer, RunDB &db) : DigitizerSettings
     
     card.dual_trace = 0; // 1 bit
     card.analog_probe = 0; // 2 bit (see docs)
-    card.oscilloscope_mode = 1; // 1 bit
-    card.digital_virt_probe_1 = 0; // 3 bit (see docs)
-    card.digital_virt_probe_2 = 0; // 3 bit (see docs)
+    card.oscilloscope_mode = !digitizer.isMember("record_waveforms") || digitizer["record_waveforms"].cast<bool>() ? 1 : 0; // 1 bit
+    card.extras = !digitizer.isMember("record_extras") || digitizer["record_extras"].cast<bool>() ? 1 : 0; // 1 bit
+    card.digital_virt_probe_1 = digitizer.isMember("digital_probe_1") ? digitizer["digital_probe_1"].cast<int>() : 0; // 3 bit (see docs)
+    card.digital_virt_probe_2 = digitizer.isMember("digital_probe_2") ? digitizer["digital_probe_2"].cast<int>() : 0; // 3 bit (see docs)
+    card.save_probes = digitizer.isMember("save_digital_probes") && digitizer["save_digital_probes"].cast<bool>() ? 1 : 0; // 1 bit
     
     card.coincidence_window = digitizer["coincidence_window"].cast<int>(); // 3 bit
     card.global_majority_level = digitizer["global_majority_level"].cast<int>(); // 3 bit
@@ -64,6 +74,23 @@ V1730Settings::V1730Settings(RunTable &digitizer, RunDB &db) : DigitizerSettings
     card.software_trg_out = digitizer["external_trigger_out"].cast<bool>() ? 1 : 0; // 1 bit
     card.max_board_agg_blt = digitizer["aggregates_per_transfer"].cast<int>(); 
     
+    card.board_id = 0; // 5 bit
+    card.chain_addr = 0; // 8 bit
+    card.chain_pos = 0; // 2 bit
+    card.chain_align = 0; // 1 bit
+    vector<RunTable> chains = db.getGroup("CHAIN");
+    for (size_t i = 0; i < chains.size(); i++) {
+        vector<string> boards = chains[i]["boards"].toVector<string>();
+        for (size_t pos = 0; pos < boards.size(); pos++) {
+            if (boards[pos] != index) continue;
+            if (boards.size() < 2) throw runtime_error("CHAIN " + chains[i].getIndex() + " needs at least two boards");
+            card.board_id = pos;
+            card.chain_addr = chains[i]["cblt_address"].cast<int>();
+            card.chain_pos = pos == 0 ? 2 : (pos == boards.size()-1 ? 1 : 3);
+            card.chain_align = !chains[i].isMember("cblt_readout") || chains[i]["cblt_readout"].cast<bool>() ? 1 : 0;
+        }
+    }
+    
     for (int ch = 0; ch < 16; ch++) {
         if (ch%2 == 0) {
             string grname = "GR"+to_string(ch/2);
@@ -115,13 +142,25 @@ V1730Settings::V1730Settings(RunTable &digitizer, RunDB &db) : DigitizerSettings
             chans[ch].trigger_config = channel["trigger_type"].cast<int>(); // 2 bit (see docs)
         }
     }
+    
+    readIntegrations(db);
+    readCompression(digitizer);
 }
 
 V1730Settings::~V1730Settings() {
 
 }
         
+void V1730Settings::roundRecordLengths() {
+    for (int gr = 0; gr < 8; gr++) {
+        groups[gr].record_length = (groups[gr].record_length+7)/8*8;
+    }
+}
+        
 void V1730Settings::validate() { //FIXME validate bit fields too
+    if (card.board_id > 31) throw runtime_error("Board id exceeds 31 (too many boards in chain)");
+    if (card.chain_addr > 255) throw runtime_error("CBLT address exceeds 0xFF (only A31..A24 are set)");
+    if (card.save_probes && !card.oscilloscope_mode) throw runtime_error("Digital probes cannot be saved without recording waveforms");
     for (int ch = 0; ch < 16; ch++) {
         if (ch % 2 == 0) {
             if (groups[ch/2].record_length > 65535) throw runtime_error("Number of samples exceeds 65535 (gr " + to_string(ch/2) + ")");
@@ -197,6 +236,13 @@ bool V1730::program(DigitizerSettings &_settings) {
     //Fully reset the board just in case
     write32(REG_BOARD_CONFIGURATION_RELOAD,0);
     
+    //Everything else goes out in as few transactions as possible
+    beginBatch();
+    
+    //Position in a CBLT chain, board id tags the aggregates
+    write32(REG_BOARD_ID,settings.card.board_id);
+    write32(REG_MCST_CBLT,settings.card.chain_addr | (settings.card.chain_pos << 8));
+    
     //Front panel config
     data = (1<<0) //ttl
          | (0<<2) | (0<<3) | (0<<4) | (0<<5) //LVDS all input
@@ -215,13 +261,15 @@ bool V1730::program(DigitizerSettings &_settings) {
          | (settings.card.dual_trace << 11) 
          | (settings.card.analog_probe << 12) 
          | (settings.card.oscilloscope_mode << 16) 
-         | (1 << 17) //enable extras
+         | (settings.card.extras << 17)
          | (1 << 18) //time stamp (reserved)
          | (1 << 19) //charge record (reserved)
          | (settings.card.digital_virt_probe_1 << 23)
          | (settings.card.digital_virt_probe_2 << 26);
     write32(REG_CONFIG,data);
 
+    settings.roundRecordLengths();
+    
     //build masks while configuring channels
     uint32_t channel_enable_mask = 0;
     uint32_t global_trigger_mask = (settings.card.coincidence_window << 20)
@@ -243,9 +291,8 @@ bool V1730::program(DigitizerSettings &_settings) {
             global_trigger_mask |= (settings.groups[ch/2].global_trigger << (ch/2));
             trigger_out_mask |= (settings.groups[ch/2].trg_out << (ch/2));
             
-            data = settings.groups[ch/2].record_length%8 ?  settings.groups[ch/2].record_length/8+1 : settings.groups[ch/2].record_length/8;
-            write32(REG_RECORD_LENGTH|(ch<<8),data);
-            settings.groups[ch/2].record_length = read32(REG_RECORD_LENGTH|(ch<<8))*8;
+            //the register holds samples/8, so this is what the board will record
+            write32(REG_RECORD_LENGTH|(ch<<8),settings.groups[ch/2].record_length/8);
             
             data = settings.groups[ch/2].valid_mask
                  | (settings.groups[ch/2].valid_mode << 8)
@@ -256,7 +303,8 @@ bool V1730::program(DigitizerSettings &_settings) {
         }
         
         if (settings.chans[ch].enabled) {
-            buffer_sizes[ch/2] = (2 + settings.groups[ch/2].record_length/8)*settings.groups[ch/2].ev_per_buffer;
+            const uint32_t recorded = settings.card.oscilloscope_mode ? settings.groups[ch/2].record_length : 0;
+            buffer_sizes[ch/2] = (2 + recorded/8)*settings.groups[ch/2].ev_per_buffer;
         }
         
         write32(REG_NEV_AGGREGATE|(ch<<8),settings.groups[ch/2].ev_per_buffer);
@@ -302,8 +350,10 @@ bool V1730::program(DigitizerSettings &_settings) {
     //Set max board aggregates to transver per readout
     write16(REG_READOUT_BLT_AGGREGATE_NUMBER,settings.card.max_board_agg_blt);
     
-    //Enable VME BLT readout
-    write16(REG_READOUT_CONTROL,1<<4);
+    //Enable VME BLT readout, chained boards pad to 64 bit so the chain stays aligned
+    write16(REG_READOUT_CONTROL,(1<<4)|(settings.card.chain_align<<5));
+    
+    endBatch();
     
     return true;
 }
@@ -328,12 +378,19 @@ bool V1730::readoutReady() {
     return read32(REG_ACQUISITION_STATUS) & (1 << 3);
 }
 
+void V1730::setInterrupt(uint32_t level, uint32_t events) {
+    write32(REG_INTERRUPT_EVENT_NUMBER,events);
+    write16(REG_READOUT_CONTROL,(read16(REG_READOUT_CONTROL)&~0x7)|(level&0x7));
+}
+
 
 bool V1730::checkTemps(vector<uint32_t> &temps, uint32_t danger) {
     temps.resize(16);
+    uint32_t regs[16];
+    for (int ch = 0; ch < 16; ch++) regs[ch] = REG_CHANNEL_TEMP|(ch<<8);
+    readBatch(regs,temps.data(),16);
     bool over = false;
     for (int ch = 0; ch < 16; ch++) {
-        temps[ch] = read32(REG_CHANNEL_TEMP|(ch<<8));
         if (temps[ch] >= danger) over = true;
     }
     return over;
@@ -366,50 +423,225 @@ size_t V1730::readoutBLT_evtsz(char *buffer, size_t buffer_size) {
 
 
 
-V1730Decoder::V1730Decoder(size_t _eventBuffer, V1730Settings &_settings) : eventBuffer(_eventBuffer), settings(_settings) {
+V1730Chain::V1730Chain(VMEBridge &bridge, RunTable &chain, vector<V1730*> &_boards, vector<Buffer*> &_buffers) : VMECard(bridge,chain["cblt_address"].cast<int>()<<24), index(chain.getIndex()), boards(_boards), buffers(_buffers) {
+    transfer_size = chain.isMember("blt_bytes") ? chain["blt_bytes"].cast<int>() : 1024*1024;
+    transfer_size &= ~(size_t)7;
+    if (!transfer_size) throw runtime_error("CHAIN " + index + " blt_bytes must be at least 8");
+    mcst_program = chain.isMember("mcst_program") ? chain["mcst_program"].cast<bool>() : true;
+    mcst_start = chain.isMember("mcst_start") ? chain["mcst_start"].cast<bool>() : true;
+    cblt_readout = chain.isMember("cblt_readout") ? chain["cblt_readout"].cast<bool>() : true;
+    tail = 0;
+}
+
+V1730Chain::~V1730Chain() {
+
+}
+
+bool V1730Chain::program(vector<V1730Settings*> &settings) {
+    //collect what each board would have written
+    vector<vector<uint32_t>> addrs(boards.size()), data(boards.size());
+    vector<vector<CVDataWidth>> widths(boards.size());
+    for (size_t i = 0; i < boards.size(); i++) {
+        boards[i]->holdBatch(true);
+        const bool ok = boards[i]->program(*settings[i]);
+        boards[i]->holdBatch(false);
+        boards[i]->takeBatch(addrs[i],data[i],widths[i]);
+        if (!ok) return false;
+    }
+    
+    //every board runs the same sequence, so the k-th writes line up and any
+    //that match on all boards can go out once to the MCST address
+    vector<uint32_t> mcst_addrs, mcst_data;
+    vector<CVDataWidth> mcst_widths;
+    size_t shared = 0, individual = 0;
+    const size_t nwrites = addrs[0].size();
+    bool aligned = true;
+    for (size_t i = 1; i < boards.size(); i++) aligned = aligned && addrs[i].size() == nwrites;
+    for (size_t k = 0; k < nwrites; k++) {
+        bool same = aligned;
+        for (size_t i = 1; same && i < boards.size(); i++) {
+            same = (addrs[i][k] & 0xFFFF) == (addrs[0][k] & 0xFFFF) && data[i][k] == data[0][k] && widths[i][k] == widths[0][k];
+        }
+        if (same) {
+            mcst_addrs.push_back(baseaddr | (addrs[0][k] & 0xFFFF));
+            mcst_data.push_back(data[0][k]);
+            mcst_widths.push_back(widths[0][k]);
+            shared++;
+        } else {
+            for (size_t i = 0; i < boards.size(); i++) {
+                if (k >= addrs[i].size()) continue;
+                mcst_addrs.push_back(addrs[i][k]);
+                mcst_data.push_back(data[i][k]);
+                mcst_widths.push_back(widths[i][k]);
+                individual++;
+            }
+        }
+    }
+    //boards with extra writes finish individually
+    for (size_t i = 0; i < boards.size(); i++) {
+        for (size_t k = nwrites; k < addrs[i].size(); k++) {
+            mcst_addrs.push_back(addrs[i][k]);
+            mcst_data.push_back(data[i][k]);
+            mcst_widths.push_back(widths[i][k]);
+            individual++;
+        }
+    }
+    
+    bridge.multiWrite(mcst_addrs.data(),mcst_data.data(),mcst_widths.data(),mcst_addrs.size());
+    cout << "CHAIN " << index << " programmed " << shared << " registers by MCST and " << individual << " individually" << endl;
+    
+    return true;
+}
+
+void V1730Chain::startAcquisition() {
+    write32(V1730::REG_ACQUISITION_CONTROL,1<<2);
+}
+
+void V1730Chain::stopAcquisition() {
+    write32(V1730::REG_ACQUISITION_CONTROL,0);
+}
+
+size_t V1730Chain::readout() {
+    size_t total = 0;
+    while (true) {
+        //the whole transfer could come from one board, so it must fit in every Buffer
+        size_t request = transfer_size;
+        for (size_t i = 0; i < buffers.size(); i++) {
+            const size_t free = buffers[i]->free();
+            if (free < request + tail) request = free > tail ? free - tail : 0;
+        }
+        request &= ~(size_t)7;
+        if (!request) break;
+        if (scratch.size() < tail + request) scratch.resize(tail + request);
+        const size_t read = readFIFOBLT(0x0000, scratch.data() + tail, request);
+        if (!read) break;
+        tail += read;
+        total += split();
+        //the last board ends the chained transfer with a bus error
+        if (read < request) break;
+    }
+    return total;
+}
+
+bool V1730Chain::acquisitionRunning() {
+    for (size_t i = 0; i < boards.size(); i++) {
+        if (!boards[i]->acquisitionRunning()) return false;
+    }
+    return true;
+}
+
+size_t V1730Chain::split() {
+    uint32_t *words = (uint32_t*)scratch.data();
+    const size_t nwords = tail/4;
+    vector<size_t> offsets(buffers.size(),0);
+    size_t pos = 0;
+    while (pos < nwords) {
+        if (words[pos] == 0xFFFFFFFF) { //64 bit alignment filler
+            pos++;
+            continue;
+        }
+        if ((words[pos] & 0xF0000000) != 0xA0000000) throw runtime_error("CHAIN " + index + " board aggregate missing tag");
+        if (pos + 2 > nwords) break;
+        const size_t size = words[pos] & 0x0FFFFFFF;
+        if (size < 4) throw runtime_error("CHAIN " + index + " board aggregate shorter than its header");
+        if (pos + size > nwords) break;
+        const uint32_t board = (words[pos+1] >> 27) & 0x1F;
+        if (board >= buffers.size()) throw runtime_error("CHAIN " + index + " aggregate from unknown board " + to_string(board));
+        memcpy(buffers[board]->wptr() + offsets[board], words + pos, size*4);
+        offsets[board] += size*4;
+        pos += size;
+    }
+    size_t moved = 0;
+    for (size_t i = 0; i < buffers.size(); i++) {
+        if (!offsets[i]) continue;
+        buffers[i]->inc(offsets[i]);
+        moved += offsets[i];
+    }
+    tail -= pos*4;
+    if (tail) memmove(scratch.data(), scratch.data() + pos*4, tail);
+    return moved;
+}
+
+V1730Decoder::V1730Decoder(EventPool *_pool, V1730Settings &_settings) : pool(_pool), settings(_settings) {
 
     dispatch_index = decode_counter = chanagg_counter = boardagg_counter = 0;
+    decode_size = decode_held = 0;
+    decode_full = false;
     
     for (size_t ch = 0; ch < 16; ch++) {
+        chan2idx[ch] = NO_INDEX;
         if (settings.getEnabled(ch)) {
             chan2idx[ch] = nsamples.size();
-            idx2chan[nsamples.size()] = ch;
-            nsamples.push_back(settings.getRecordLength(ch));
-            grabbed.push_back(0);
-            if (eventBuffer > 0) {
-                grabs.push_back(new uint16_t[eventBuffer*nsamples.back()]);
-                patterns.push_back(new uint16_t[eventBuffer]);
-                baselines.push_back(new uint16_t[eventBuffer]);
-                qshorts.push_back(new uint16_t[eventBuffer]);
-                qlongs.push_back(new uint16_t[eventBuffer]);
-                times.push_back(new uint64_t[eventBuffer]);
+            idx2chan.push_back(ch);
+            nsamples.push_back(settings.getWaveforms() ? settings.getRecordLength(ch) : 0);
+            IntegrateSpec *spec = settings.getIntegration("/"+settings.getIndex()+"/ch"+to_string(ch));
+            if (spec) {
+                if (!nsamples.back()) throw runtime_error("INTEGRATE " + spec->name + " needs waveforms");
+                spec->validate(nsamples.back());
+                spec = new IntegrateSpec(*spec);
+                spec->setADC(14,2.0,2.0);
+                if (scratch.size() < nsamples.back()) scratch.resize(nsamples.back());
+            }
+            integrations.push_back(spec);
+            if (pool) {
+                vector<size_t> columns(COL_SIGCHARGES+1);
+                columns[COL_SAMPLES] = !spec || spec->save_samples ? nsamples.back()*sizeof(uint16_t) : 0;
+                columns[COL_PATTERNS] = columns[COL_QSHORTS] = columns[COL_QLONGS] = sizeof(uint16_t);
+                columns[COL_BASELINES] = settings.getExtras() ? sizeof(uint16_t) : 0;
+                columns[COL_TIMES] = sizeof(uint64_t);
+                columns[COL_PROBES] = settings.getSaveProbes() ? nsamples.back()*sizeof(uint8_t) : 0;
+                columns[COL_PEDMEANS] = columns[COL_CROSSTIMES] = columns[COL_SIGCHARGES] = spec ? sizeof(double) : 0;
+                columns[COL_PEDVALID] = spec ? sizeof(uint8_t) : 0;
+                grabbed.push_back(new EventStore(pool,columns));
+            } else {
+                grabbed.push_back(new EventStore());
             }
         }
     }
     
+    map<string,IntegrateSpec> &specs = settings.getIntegrations();
+    for (map<string,IntegrateSpec>::iterator it = specs.begin(); it != specs.end(); it++) {
+        bool found = false;
+        for (size_t i = 0; i < idx2chan.size(); i++) found |= it->first == "/"+settings.getIndex()+"/ch"+to_string(idx2chan[i]);
+        if (!found) throw runtime_error("INTEGRATE " + it->second.name + " names " + it->first + " which is not an enabled channel");
+    }
+    
     clock_gettime(CLOCK_MONOTONIC,&last_decode_time);
 
 }
 
 V1730Decoder::~V1730Decoder() {
-    for (size_t i = 0; i < grabs.size(); i++) {
-        delete [] grabs[i];
-        delete [] patterns[i];
-        delete [] baselines[i];
-        delete [] qshorts[i];
-        delete [] qlongs[i];
-        delete [] times[i];
+    for (size_t i = 0; i < grabbed.size(); i++) {
+        delete grabbed[i];
+        if (integrations[i]) delete integrations[i];
     }
 }
 
 void V1730Decoder::decode(Buffer &buf) {
-    vector<size_t> lastgrabbed(grabbed);
+    vector<size_t> lastgrabbed;
+    for (size_t i = 0; i < grabbed.size(); i++) lastgrabbed.push_back(grabbed[i]->size());
     
     decode_size = buf.fill();
-    cout << settings.getIndex() << " decoding " << decode_size << " bytes." << endl;
+    log << settings.getIndex() << " decoding " << decode_size << " bytes." << endl;
     uint32_t *next = (uint32_t*)buf.rptr(), *start = (uint32_t*)buf.rptr();
-    while ((size_t)((next = decode_board_agg(next)) - start + 1)*4 < decode_size);
-    buf.dec(decode_size);
+    //a trailing partial aggregate stays in buf to be finished by later
+    //readouts, as do aggregates without room in the event pool until a
+    //writeout frees some (holding back readout meanwhile)
+    size_t consumed = 0;
+    decode_full = false;
+    while (consumed < decode_size) {
+        const bool whole = whole_board_agg(next, decode_size - consumed);
+        if (!whole && !consumed && decode_size + 8 > buf.capacity()) throw runtime_error("Readout buffer for " + settings.getIndex() + " is too small for one aggregate");
+        if (!whole || !reserve_board_agg(next)) {
+            if (whole) log << "\tevent memory full, holding " << decode_size - consumed << " bytes" << endl;
+            decode_full = whole;
+            break;
+        }
+        next = decode_board_agg(next);
+        consumed = (next - start)*4;
+    }
+    buf.dec(consumed);
+    decode_held = decode_size - consumed;
     decode_counter++;
     
     struct timespec cur_time;
@@ -418,14 +650,22 @@ void V1730Decoder::decode(Buffer &buf) {
     last_decode_time = cur_time;
     
     for (size_t i = 0; i < idx2chan.size(); i++) {
-        cout << "\tch" << idx2chan[i] << "\tev: " << grabbed[i]-lastgrabbed[i] << " / " << (grabbed[i]-lastgrabbed[i])/time_int << " Hz / " << grabbed[i] << " total" << endl;
+        log << "\tch" << idx2chan[i] << "\tev: " << grabbed[i]->size()-lastgrabbed[i] << " / " << (grabbed[i]->size()-lastgrabbed[i])/time_int << " Hz / " << grabbed[i]->size() << " total" << endl;
     }
 }
 
+size_t V1730Decoder::leftover() {
+    return decode_held;
+}
+
+bool V1730Decoder::heldBack() {
+    return decode_full;
+}
+
 size_t V1730Decoder::eventsReady() {
-    size_t grabs = grabbed[0];
+    size_t grabs = grabbed[0]->size();
     for (size_t idx = 1; idx < grabbed.size(); idx++) {
-        if (grabbed[idx] < grabs) grabs = grabbed[idx];
+        if (grabbed[idx]->size() < grabs) grabs = grabbed[idx]->size();
     }
     return grabs;
 }
@@ -436,12 +676,19 @@ void V1730Decoder::dispatch(int nfd, int *fds) {
     
     size_t ready = eventsReady();
     
+    //there are no traces to show in list mode
+    if (!settings.getWaveforms()) {
+        dispatch_index = ready;
+        return;
+    }
+    
     for ( ; dispatch_index < ready; dispatch_index++) {
         for (size_t i = 0; i < nsamples.size(); i++) {
-            uint8_t lvdsidx = patterns[i][dispatch_index] & 0xFF; 
+            if (integrations[i] && !integrations[i]->save_samples) continue;
+            uint8_t lvdsidx = *grabbed[i]->at<uint16_t>(COL_PATTERNS,dispatch_index) & 0xFF; 
             uint8_t dsize = 2;
             uint16_t nsamps = nsamples[i];
-            uint16_t *samples = &grabs[i][nsamps*dispatch_index];
+            uint16_t *samples = grabbed[i]->at<uint16_t>(COL_SAMPLES,dispatch_index);
             string strname = "/"+settings.getIndex()+"/ch" + to_string(idx2chan[i]);
             uint16_t strlen = strname.length();
             uint16_t length = 2+strlen+2+nsamps*2+1+1;
@@ -460,91 +707,111 @@ void V1730Decoder::dispatch(int nfd, int *fds) {
 
 using namespace H5;
 
-void V1730Decoder::writeOut(H5File &file, size_t nEvents) {
+DecodedBatch* V1730Decoder::detach(size_t nEvents) {
+    vector<EventStore*> stores;
+    for (size_t i = 0; i < grabbed.size(); i++) {
+        stores.push_back(grabbed[i]->detach(nEvents));
+    }
+    dispatch_index = dispatch_index > nEvents ? dispatch_index - nEvents : 0;
+    return new DecodedBatch(this,stores,nEvents);
+}
 
-    cout << "\t/" << settings.getIndex() << endl;
+void V1730Decoder::writeOut(H5File &file, vector<EventStore*> &stores, size_t nEvents, ChunkCompressor &compressor, bool append, ostream &out) {
 
-    Group cardgroup = file.createGroup("/"+settings.getIndex());
-        
-    DataSpace scalar(0,NULL);
+    //groups and their attributes exist after the first batch of a file
+    const bool fresh = !append || !outputExists(file, "/"+settings.getIndex());
     
-    double dval;
-    uint32_t ival;
-    
-    Attribute bits = cardgroup.createAttribute("bits",PredType::NATIVE_UINT32,scalar);
-    ival = 14;
-    bits.write(PredType::NATIVE_INT32,&ival);
+    if (fresh) {
+        out << "\t/" << settings.getIndex() << endl;
+
+        Group cardgroup = file.createGroup("/"+settings.getIndex());
+            
+        DataSpace scalar(0,NULL);
+        
+        double dval;
+        uint32_t ival;
+        
+        Attribute bits = cardgroup.createAttribute("bits",PredType::NATIVE_UINT32,scalar);
+        ival = 14;
+        bits.write(PredType::NATIVE_INT32,&ival);
+        
+        Attribute ns_sample = cardgroup.createAttribute("ns_sample",PredType::NATIVE_DOUBLE,scalar);
+        dval = 2.0;
+        ns_sample.write(PredType::NATIVE_DOUBLE,&dval);
+    }
     
-    Attribute ns_sample = cardgroup.createAttribute("ns_sample",PredType::NATIVE_DOUBLE,scalar);
-    dval = 2.0;
-    ns_sample.write(PredType::NATIVE_DOUBLE,&dval);
+    Compression &compression = settings.getCompression();
     
     for (size_t i = 0; i < nsamples.size(); i++) {
     
         string chname = "ch" + to_string(idx2chan[i]);
-        Group group = cardgroup.createGroup(chname);
         string groupname = "/"+settings.getIndex()+"/"+chname;
         
-        cout << "\t" << groupname << endl;
-        
-        Attribute offset = group.createAttribute("offset",PredType::NATIVE_UINT32,scalar);
-        ival = settings.getDCOffset(idx2chan[i]);
-        offset.write(PredType::NATIVE_UINT32,&ival);
-        
-        Attribute samples = group.createAttribute("samples",PredType::NATIVE_UINT32,scalar);
-        ival = settings.getRecordLength(idx2chan[i]);
-        samples.write(PredType::NATIVE_UINT32,&ival);
-        
-        Attribute presamples = group.createAttribute("presamples",PredType::NATIVE_UINT32,scalar);
-        ival = settings.getPreSamples(idx2chan[i]);
-        presamples.write(PredType::NATIVE_UINT32,&ival);
-        
-        Attribute threshold = group.createAttribute("threshold",PredType::NATIVE_UINT32,scalar);
-        ival = settings.getThreshold(idx2chan[i]);
-        threshold.write(PredType::NATIVE_UINT32,&ival);
+        if (fresh) {
+            Group group = file.createGroup(groupname);
+            
+            out << "\t" << groupname << endl;
+            
+            DataSpace scalar(0,NULL);
+            uint32_t ival;
+            
+            Attribute offset = group.createAttribute("offset",PredType::NATIVE_UINT32,scalar);
+            ival = settings.getDCOffset(idx2chan[i]);
+            offset.write(PredType::NATIVE_UINT32,&ival);
+            
+            Attribute samples = group.createAttribute("samples",PredType::NATIVE_UINT32,scalar);
+            ival = nsamples[i];
+            samples.write(PredType::NATIVE_UINT32,&ival);
+            
+            Attribute presamples = group.createAttribute("presamples",PredType::NATIVE_UINT32,scalar);
+            ival = settings.getPreSamples(idx2chan[i]);
+            presamples.write(PredType::NATIVE_UINT32,&ival);
+            
+            Attribute threshold = group.createAttribute("threshold",PredType::NATIVE_UINT32,scalar);
+            ival = settings.getThreshold(idx2chan[i]);
+            threshold.write(PredType::NATIVE_UINT32,&ival);
+        }
         
-        hsize_t dimensions[2];
-        dimensions[0] = nEvents;
-        dimensions[1] = nsamples[i];
+        hsize_t row;
         
-        DataSpace samplespace(2, dimensions);
-        DataSpace metaspace(1, dimensions);
+        if (settings.getWaveforms() && (!integrations[i] || integrations[i]->save_samples)) {
+            if (fresh) out << "\t" << groupname << "/samples" << endl;
+            DataSet samples_ds = outputDataSet(file, groupname+"/samples", PredType::NATIVE_UINT16, nEvents, nsamples[i], compression, append, row);
+            compressor.write<uint16_t>(samples_ds, PredType::NATIVE_UINT16, compression, *stores[i], COL_SAMPLES, nEvents, nsamples[i], row);
+        }
         
-        cout << "\t" << groupname << "/samples" << endl;
-        DataSet samples_ds = file.createDataSet(groupname+"/samples", PredType::NATIVE_UINT16, samplespace);
-        samples_ds.write(grabs[i], PredType::NATIVE_UINT16);
-        memmove(grabs[i],grabs[i]+nEvents*nsamples[i],nsamples[i]*sizeof(uint16_t)*(grabbed[i]-nEvents));
+        if (fresh) out << "\t" << groupname << "/patterns" << endl;
+        DataSet patterns_ds = outputDataSet(file, groupname+"/patterns", PredType::NATIVE_UINT16, nEvents, 0, compression, append, row);
+        stores[i]->write<uint16_t>(patterns_ds, PredType::NATIVE_UINT16, COL_PATTERNS, nEvents, 1, row);
         
-        cout << "\t" << groupname << "/patterns" << endl;
-        DataSet patterns_ds = file.createDataSet(groupname+"/patterns", PredType::NATIVE_UINT16, metaspace);
-        patterns_ds.write(patterns[i], PredType::NATIVE_UINT16);
-        memmove(patterns[i],patterns[i]+nEvents,sizeof(uint16_t)*(grabbed[i]-nEvents));
+        if (settings.getExtras()) {
+            if (fresh) out << "\t" << groupname << "/baselines" << endl;
+            DataSet baselines_ds = outputDataSet(file, groupname+"/baselines", PredType::NATIVE_UINT16, nEvents, 0, compression, append, row);
+            stores[i]->write<uint16_t>(baselines_ds, PredType::NATIVE_UINT16, COL_BASELINES, nEvents, 1, row);
+        }
         
-        cout << "\t" << groupname << "/baselines" << endl;
-        DataSet baselines_ds = file.createDataSet(groupname+"/baselines", PredType::NATIVE_UINT16, metaspace);
-        baselines_ds.write(baselines[i], PredType::NATIVE_UINT16);
-        memmove(baselines[i],baselines[i]+nEvents,sizeof(uint16_t)*(grabbed[i]-nEvents));
+        if (fresh) out << "\t" << groupname << "/qshorts" << endl;
+        DataSet qshorts_ds = outputDataSet(file, groupname+"/qshorts", PredType::NATIVE_UINT16, nEvents, 0, compression, append, row);
+        stores[i]->write<uint16_t>(qshorts_ds, PredType::NATIVE_UINT16, COL_QSHORTS, nEvents, 1, row);
         
-        cout << "\t" << groupname << "/qshorts" << endl;
-        DataSet qshorts_ds = file.createDataSet(groupname+"/qshorts", PredType::NATIVE_UINT16, metaspace);
-        qshorts_ds.write(qshorts[i], PredType::NATIVE_UINT16);
-        memmove(qshorts[i],qshorts[i]+nEvents,sizeof(uint16_t)*(grabbed[i]-nEvents));
+        if (fresh) out << "\t" << groupname << "/qlongs" << endl;
+        DataSet qlongs_ds = outputDataSet(file, groupname+"/qlongs", PredType::NATIVE_UINT16, nEvents, 0, compression, append, row);
+        stores[i]->write<uint16_t>(qlongs_ds, PredType::NATIVE_UINT16, COL_QLONGS, nEvents, 1, row);
+
+        if (fresh) out << "\t" << groupname << "/times" << endl;
+        DataSet times_ds = outputDataSet(file, groupname+"/times", PredType::NATIVE_UINT64, nEvents, 0, compression, append, row);
+        stores[i]->write<uint64_t>(times_ds, PredType::NATIVE_UINT64, COL_TIMES, nEvents, 1, row);
         
-        cout << "\t" << groupname << "/qlongs" << endl;
-        DataSet qlongs_ds = file.createDataSet(groupname+"/qlongs", PredType::NATIVE_UINT16, metaspace);
-        qlongs_ds.write(qlongs[i], PredType::NATIVE_UINT16);
-        memmove(qlongs[i],qlongs[i]+nEvents,sizeof(uint16_t)*(grabbed[i]-nEvents));
-
-        cout << "\t" << groupname << "/times" << endl;
-        DataSet times_ds = file.createDataSet(groupname+"/times", PredType::NATIVE_UINT64, metaspace);
-        times_ds.write(times[i], PredType::NATIVE_UINT64);
-        memmove(times[i],times[i]+nEvents,sizeof(uint64_t)*(grabbed[i]-nEvents));
+        if (pool && settings.getSaveProbes()) {
+            if (fresh) out << "\t" << groupname << "/probes" << endl;
+            DataSet probes_ds = outputDataSet(file, groupname+"/probes", PredType::NATIVE_UINT8, nEvents, nsamples[i], compression, append, row);
+            compressor.write<uint8_t>(probes_ds, PredType::NATIVE_UINT8, compression, *stores[i], COL_PROBES, nEvents, nsamples[i], row);
+        }
         
-        grabbed[i] -= nEvents;
+        if (integrations[i]) {
+            integrations[i]->write(file, groupname, *stores[i], COL_PEDMEANS, nEvents, append, out);
+        }
     }
-    
-    dispatch_index -= nEvents;
-    if (dispatch_index < 0) dispatch_index = 0;
 }
 
 uint32_t* V1730Decoder::decode_chan_agg(uint32_t *chanagg, uint32_t group, uint16_t pattern) {
@@ -555,60 +822,146 @@ uint32_t* V1730Decoder::decode_chan_agg(uint32_t *chanagg, uint32_t group, uint1
     
     const uint32_t size = chanagg[0] & 0x7FFF;
     const uint32_t format = chanagg[1];
-    const uint32_t samples = (format & 0xFFF)*8;
     
-    /*
     //Metadata
-    const bool dualtrace_enable = format & (1<<31);
+    //const bool dualtrace_enable = format & (1<<31);
     const bool charge_enable =format & (1<<30);
     const bool time_enable = format & (1<<29);
-    const bool baseline_enable = format & (1<<28);
+    const bool extras_enable = format & (1<<28);
     const bool waveform_enable = format & (1<<27);
-    const uint32_t extras = (format >> 24) & 0x7;
+    /*
+    const uint32_t extras_option = (format >> 24) & 0x7;
     const uint32_t analog_probe = (format >> 22) & 0x3;
     const uint32_t digital_probe_2 = (format >> 19) & 0x7;
     const uint32_t digital_probe_1 = (format >> 16) & 0x7;
     */
+    const uint32_t samples = waveform_enable ? (format & 0xFFF)*8 : 0;
+    
+    //the odd channel flag is in the time tag and the board always records charges
+    if (!time_enable || !charge_enable) throw runtime_error("Channel aggregate without time tags or charges (gr " + to_string(group) + ")");
+    if (extras_enable != settings.getExtras()) throw runtime_error("Channel aggregate extras do not match settings (gr " + to_string(group) + ")");
+    
+    const uint32_t idx[2] = { chan2idx[group*2+0], chan2idx[group*2+1] };
+    
+    //both channels of a group share a record length, so each event need not
+    //be checked against its channel's
+    for (uint32_t odd = 0; odd < 2; odd++) {
+        if (idx[odd] != NO_INDEX && nsamples[idx[odd]] != samples) throw runtime_error("Number of samples received " + to_string(samples) + " does not match expected " + to_string(nsamples[idx[odd]]) + " (" + to_string(group*2+odd) + ")");
+    }
     
-    const uint32_t idx0 = chan2idx.count(group * 2 + 0) ? chan2idx[group * 2 + 0] : 999;
-    const uint32_t idx1 = chan2idx.count(group * 2 + 1) ? chan2idx[group * 2 + 1] : 999;
+    //the last word of an aggregate can be padding rather than an event
+    uint32_t *event = chanagg+2, *end = chanagg+size-1;
+    if (!pool) {
+        for (const uint32_t words = event_words(format); event < end; event += words) {
+            const uint32_t odd = event[0] >> 31;
+            if (idx[odd] == NO_INDEX) disabled_channel(group,odd);
+            grabbed[idx[odd]]->push();
+        }
+    } else if (!waveform_enable) {
+        if (extras_enable) decode_chan_events<false,true,false>(event,end,samples,group,idx,pattern);
+        else decode_chan_events<false,false,false>(event,end,samples,group,idx,pattern);
+    } else if (settings.getSaveProbes()) {
+        if (extras_enable) decode_chan_events<true,true,true>(event,end,samples,group,idx,pattern);
+        else decode_chan_events<true,false,true>(event,end,samples,group,idx,pattern);
+    } else {
+        if (extras_enable) decode_chan_events<true,true,false>(event,end,samples,group,idx,pattern);
+        else decode_chan_events<true,false,false>(event,end,samples,group,idx,pattern);
+    }
     
-    for (uint32_t *event = chanagg+2; (size_t)(event-chanagg+1) < size; event += samples/2+3) {
+    return chanagg + size;
+}
+
+template <bool WAVEFORMS, bool EXTRAS, bool PROBES>
+void V1730Decoder::decode_chan_events(uint32_t *event, uint32_t *end, uint32_t samples, uint32_t group, const uint32_t idx[2], uint16_t pattern) {
+    
+    //time tag, samples, extras, charge
+    const uint32_t words = 1 + (WAVEFORMS ? samples/2 : 0) + (EXTRAS ? 1 : 0) + 1;
+    
+    for ( ; event < end; event += words) {
         
-        const bool oddch = event[0] & 0x80000000;
-        const uint32_t idx = oddch ? idx1 : idx0;
-        const uint32_t len = nsamples[idx];
+        const uint32_t odd = event[0] >> 31;
+        if (idx[odd] == NO_INDEX) disabled_channel(group,odd);
         
-        if (idx == 999) throw runtime_error("Received data for disabled channel (" + to_string(group*2+oddch?1:0) + ")");
+        //the extras and charge words follow the samples
+        const uint32_t *tail = event + 1 + (WAVEFORMS ? samples/2 : 0);
+        const uint32_t extras = EXTRAS ? tail[0] : 0;
+        const uint32_t charge = tail[EXTRAS ? 1 : 0];
         
-        if (len != samples) throw runtime_error("Number of samples received " + to_string(samples) + " does not match expected " + to_string(len) + " (" + to_string(idx2chan[idx]) + ")");
+        EventStore &store = *grabbed[idx[odd]];
+        store.push();
+        size_t row;
+        char *chunk = store.chunk(store.size()-1,row);
         
-        if (eventBuffer) {
-            const size_t ev = grabbed[idx]++;
-            if (ev == eventBuffer) throw runtime_error("Decoder buffer for " + settings.getIndex() + " overflowed!");
-            uint16_t *data = grabs[idx] + ev*len;
-            
-            for (uint32_t *word = event+1, sample = 0; sample < len; word++, sample+=2) {
-                data[sample+0] = *word & 0x3FFF;
-                //uint8_t dp10 = (*word >> 14) & 0x1;
-                //uint8_t dp20 = (*word >> 15) & 0x1;
-                data[sample+1] = (*word >> 16) & 0x3FFF;
-                //uint8_t dp11 = (*word >> 30) & 0x1;
-                //uint8_t dp21 = (*word >> 31) & 0x1;
+        if (WAVEFORMS) {
+            IntegrateSpec *spec = integrations[idx[odd]];
+            uint16_t *samps = spec && !spec->save_samples ? scratch.data() : store.in<uint16_t>(chunk,COL_SAMPLES,row);
+            unpack14_pairs(event+1, samps, PROBES ? store.in<uint8_t>(chunk,COL_PROBES,row) : NULL, samples);
+            if (spec) {
+                integral result;
+                spec->integrate(samps,result);
+                *store.in<double>(chunk,COL_PEDMEANS,row) = result.pedmean;
+                *store.in<uint8_t>(chunk,COL_PEDVALID,row) = result.pedvalid;
+                *store.in<double>(chunk,COL_SIGCHARGES,row) = result.sigcharge;
+                *store.in<double>(chunk,COL_CROSSTIMES,row) = result.time;
             }
-            
-            patterns[idx][ev] = pattern;
-            baselines[idx][ev] = event[1+samples/2+0] & 0xFFFF;
-            qshorts[idx][ev] = event[1+samples/2+1] & 0x7FFF;
-            qlongs[idx][ev] = (event[1+samples/2+1] >> 16) & 0xFFFF;
-            times[idx][ev] = ((uint64_t)(event[0] & 0x7FFFFFFF)) | (((uint64_t)(event[1+samples/2+0]&0xFFFF0000))<<15);
-        } else {
-            grabbed[idx]++;
         }
+        
+        *store.in<uint16_t>(chunk,COL_PATTERNS,row) = pattern;
+        *store.in<uint16_t>(chunk,COL_QSHORTS,row) = charge & 0x7FFF;
+        *store.in<uint16_t>(chunk,COL_QLONGS,row) = (charge >> 16) & 0xFFFF;
+        *store.in<uint64_t>(chunk,COL_TIMES,row) = ((uint64_t)(event[0] & 0x7FFFFFFF)) | (((uint64_t)(extras&0xFFFF0000))<<15);
+        if (EXTRAS) *store.in<uint16_t>(chunk,COL_BASELINES,row) = extras & 0xFFFF;
     
     }
     
-    return chanagg + size;
+}
+
+void V1730Decoder::disabled_channel(uint32_t group, uint32_t odd) {
+    throw runtime_error("Received data for disabled channel (" + to_string(group*2+odd) + ")");
+}
+
+uint32_t V1730Decoder::event_words(uint32_t format) {
+    const uint32_t samples = format & (1<<27) ? (format & 0xFFF)*8 : 0;
+    return samples/2 + (format & (1<<29) ? 1 : 0) + (format & (1<<28) ? 1 : 0) + (format & (1<<30) ? 1 : 0);
+}
+
+bool V1730Decoder::whole_board_agg(uint32_t *boardagg, size_t bytes) {
+    size_t words = bytes/4;
+    if (words && boardagg[0] == 0xFFFFFFFF) {
+        boardagg++; //sometimes padded
+        words--;
+    }
+    if (!words) return false;
+    if ((boardagg[0] & 0xF0000000) != 0xA0000000) return true; //decoding will complain
+    return (boardagg[0] & 0x0FFFFFFF) <= words;
+}
+
+bool V1730Decoder::reserve_board_agg(uint32_t *boardagg) {
+    if (boardagg[0] == 0xFFFFFFFF) {
+        boardagg++; //sometimes padded
+    }
+    if ((boardagg[0] & 0xF0000000) != 0xA0000000) return true; //decoding will complain
+    
+    const uint32_t mask = boardagg[1] & 0xFF;
+    uint32_t *chanagg = boardagg+4, *end = boardagg + (boardagg[0] & 0x0FFFFFFF);
+    
+    //a channel aggregate's events may all belong to either channel of the pair
+    for (uint32_t gr = 0; gr < 8; gr++) {
+        if (!(mask & (1 << gr))) continue;
+        //sizes and formats are only checked by decoding, which complains
+        if (chanagg + 2 > end) return true;
+        const uint32_t size = chanagg[0] & 0x7FFF;
+        if (size < 2 || chanagg + size > end) return true;
+        const uint32_t words = event_words(chanagg[1]);
+        if (!words) return true;
+        const size_t events = (size-2)/words;
+        for (uint32_t ch = gr*2; ch < gr*2+2; ch++) {
+            if (chan2idx[ch] != NO_INDEX && !grabbed[chan2idx[ch]]->reserve(events)) return false;
+        }
+        chanagg += size;
+    }
+    
+    return true;
 }
 
 uint32_t* V1730Decoder::decode_board_agg(uint32_t *boardagg) {
@@ -621,21 +974,23 @@ uint32_t* V1730Decoder::decode_board_agg(uint32_t *boardagg) {
     boardagg_counter++;    
     
     uint32_t size = boardagg[0] & 0x0FFFFFFF;
+    if (size < 4) throw runtime_error("Board aggregate shorter than its header");
     
     //const uint32_t board = (boardagg[1] >> 28) & 0xF;
     //const bool fail = boardagg[1] & (1 << 26);
     const uint16_t pattern = (boardagg[1] >> 8) & 0x7FFF;
     const uint32_t mask = boardagg[1] & 0xFF;
     
-    cout << "\t(LVDS & 0xFF): " << (pattern & 0xFF) << endl;
+    log << "\t(LVDS & 0xFF): " << (pattern & 0xFF) << endl;
     
     //const uint32_t count = boardagg[2] & 0x7FFFFF;
     //const uint32_t timetag = boardagg[3];
     
-    uint32_t *chans = boardagg+4;
+    uint32_t *chans = boardagg+4, *end = boardagg+size;
     
     for (uint32_t gr = 0; gr < 8; gr++) {
         if (mask & (1 << gr)) {
+            if (chans + 2 > end || (chans[0] & 0x7FFF) < 2 || chans + (chans[0] & 0x7FFF) > end) throw runtime_error("Channel aggregate does not fit its board aggregate (gr " + to_string(gr) + ")");
             chans = decode_chan_agg(chans,gr,pattern);
         }
     } 
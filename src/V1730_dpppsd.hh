@@ -22,6 +22,7 @@
 
 #include "VMEBridge.hh"
 #include "Digitizer.hh"
+#include "EventStore.hh"
 #include "RunDB.hh"
 #include "json.hh"
 
@@ -102,10 +103,14 @@ typedef struct {
     //REG_CONFIG
     uint32_t dual_trace; // 1 bit
     uint32_t analog_probe; // 2 bit (see docs)
-    uint32_t oscilloscope_mode; // 1 bit
+    uint32_t oscilloscope_mode; // 1 bit (waveforms recorded)
+    uint32_t extras; // 1 bit (baseline and extended time tag recorded)
     uint32_t digital_virt_probe_1; // 3 bit (see docs)
     uint32_t digital_virt_probe_2; // 3 bit (see docs)
     
+    //decoder only, keep the digital probe bits of the waveforms
+    uint32_t save_probes; // 1 bit
+    
     //REG_GLOBAL_TRIGGER_MASK
     uint32_t coincidence_window; // 3 bit
     uint32_t global_majority_level; // 3 bit
@@ -124,6 +129,16 @@ typedef struct {
     //REG_READOUT_BLT_AGGREGATE_NUMBER
     uint16_t max_board_agg_blt;
     
+    //REG_BOARD_ID
+    uint32_t board_id; // 5 bit
+    
+    //REG_MCST_CBLT
+    uint32_t chain_addr; // 8 bit (A31..A24 of the CBLT address)
+    uint32_t chain_pos; // 2 bit (disabled, last, first, intermediate)
+    
+    //REG_READOUT_CONTROL
+    uint32_t chain_align; // 1 bit (pad aggregates to 64 bit for CBLT)
+    
 } V1730_card_config;
 
 class V1730Settings : public DigitizerSettings {
@@ -139,6 +154,10 @@ class V1730Settings : public DigitizerSettings {
         
         void validate();
         
+        //rounds record lengths up to what the board records, a multiple of 8
+        //samples, as programming does
+        void roundRecordLengths();
+        
         inline bool getEnabled(uint32_t ch) {
             return chans[ch].enabled;
         }
@@ -162,6 +181,18 @@ class V1730Settings : public DigitizerSettings {
         inline std::string getIndex() {
             return index;
         }
+        
+        inline bool getSaveProbes() {
+            return card.save_probes;
+        }
+        
+        inline bool getWaveforms() {
+            return card.oscilloscope_mode;
+        }
+        
+        inline bool getExtras() {
+            return card.extras;
+        }
     
     protected:
     
@@ -224,6 +255,10 @@ class V1730 : public Digitizer {
         static constexpr uint32_t REG_EVENT_SIZE = 0x814C;
         static constexpr uint32_t REG_READOUT_CONTROL = 0xEF00;
         static constexpr uint32_t REG_READOUT_STATUS = 0xEF04;
+        static constexpr uint32_t REG_INTERRUPT_STATUS_ID = 0xEF14;
+        static constexpr uint32_t REG_INTERRUPT_EVENT_NUMBER = 0xEF18;
+        static constexpr uint32_t REG_BOARD_ID = 0xEF08;
+        static constexpr uint32_t REG_MCST_CBLT = 0xEF0C;
         static constexpr uint32_t REG_VME_ADDRESS_RELOCATION = 0xEF10;
         static constexpr uint32_t REG_READOUT_BLT_AGGREGATE_NUMBER = 0xEF1C;
         
@@ -245,6 +280,8 @@ class V1730 : public Digitizer {
         
         virtual bool readoutReady();
         
+        virtual void setInterrupt(uint32_t level, uint32_t events);
+        
         virtual bool checkTemps(std::vector<uint32_t> &temps, uint32_t danger);
         
     protected:
@@ -253,11 +290,64 @@ class V1730 : public Digitizer {
 
 };
 
+// A CBLT daisy chain of V1730s (see the CHAIN table), read out with chained
+// block transfers at the chain address. Each board tags its aggregates with
+// its position in the chain as board id, which splits the chained stream
+// back into the per board Buffers used by the decoders.
+class V1730Chain : public VMECard {
+
+    public:
+    
+        V1730Chain(VMEBridge &bridge, RunTable &chain, std::vector<V1730*> &boards, std::vector<Buffer*> &buffers);
+        
+        virtual ~V1730Chain();
+        
+        //programs every board, writing registers the boards share once by
+        //multicast (MCST) and the rest to each board individually
+        bool program(std::vector<V1730Settings*> &settings);
+        
+        //one MCST cycle starts (stops) every board in the group together
+        void startAcquisition();
+        
+        void stopAcquisition();
+        
+        //chained transfers until the chain has no more data or a board's
+        //Buffer is full, returns bytes added to the board Buffers
+        size_t readout();
+        
+        bool acquisitionRunning();
+        
+        inline std::string getIndex() { return index; }
+        
+        inline bool mcstProgram() { return mcst_program; }
+        
+        inline bool mcstStart() { return mcst_start; }
+        
+        inline bool cbltReadout() { return cblt_readout; }
+        
+    protected:
+    
+        std::string index;
+        bool mcst_program, mcst_start, cblt_readout;
+        std::vector<V1730*> boards;
+        std::vector<Buffer*> buffers;
+        size_t transfer_size;
+        
+        //data from the last transfer that does not yet form a whole aggregate
+        std::vector<char> scratch;
+        size_t tail;
+        
+        //moves whole aggregates out of scratch, returns bytes moved
+        size_t split();
+
+};
+
 class V1730Decoder : public Decoder {
 
     public: 
     
-        V1730Decoder(size_t eventBuffer, V1730Settings &settings);
+        //without a pool events are only counted
+        V1730Decoder(EventPool *pool, V1730Settings &settings);
         
         virtual ~V1730Decoder();
         
@@ -265,13 +355,19 @@ class V1730Decoder : public Decoder {
         
         virtual size_t eventsReady();
         
-        virtual void writeOut(H5::H5File &file, size_t nEvents);
+        virtual DecodedBatch* detach(size_t nEvents);
+        
+        virtual void writeOut(H5::H5File &file, std::vector<EventStore*> &stores, size_t nEvents, ChunkCompressor &compressor, bool append, std::ostream &out);
+        
+        virtual size_t leftover();
+        
+        virtual bool heldBack();
         
         virtual void dispatch(int nfd, int *fds);
 
     protected:
         
-        size_t eventBuffer;
+        EventPool *pool;
         V1730Settings &settings;
         
         size_t dispatch_index;
@@ -280,16 +376,47 @@ class V1730Decoder : public Decoder {
         size_t chanagg_counter;
         size_t boardagg_counter;
         
-        size_t decode_size;
+        size_t decode_size, decode_held;
+        bool decode_full;
         struct timespec last_decode_time;
         
-        std::map<uint32_t,uint32_t> chan2idx,idx2chan;
+        //index into the per channel vectors by channel (NO_INDEX if disabled)
+        //and back
+        static const uint32_t NO_INDEX = 0xFFFFFFFF;
+        uint32_t chan2idx[16];
+        std::vector<uint32_t> idx2chan;
         std::vector<size_t> nsamples;
-        std::vector<size_t> grabbed;
-        std::vector<uint16_t*> grabs, baselines, qshorts, qlongs, patterns;
-        std::vector<uint64_t*> times;
+        std::vector<EventStore*> grabbed; //per channel
+        
+        //online integration per channel (NULL if none) and where traces that
+        //are integrated but not saved are unpacked
+        std::vector<IntegrateSpec*> integrations;
+        std::vector<uint16_t> scratch;
+        
+        //columns of the stores, samples only if settings.getWaveforms() (and
+        //not dropped after integration), baselines only if settings.getExtras(),
+        //probes only if settings.getSaveProbes(), integration results last
+        enum { COL_SAMPLES, COL_PATTERNS, COL_BASELINES, COL_QSHORTS, COL_QLONGS, COL_TIMES, COL_PROBES, COL_PEDMEANS, COL_PEDVALID, COL_CROSSTIMES, COL_SIGCHARGES };
+        
+        //words per event in a channel aggregate with the given format word
+        static uint32_t event_words(uint32_t format);
+        
+        //true if bytes hold all of the board aggregate
+        bool whole_board_agg(uint32_t *boardagg, size_t bytes);
+        
+        //reserves room for every event in a board aggregate
+        bool reserve_board_agg(uint32_t *boardagg);
 
         uint32_t* decode_chan_agg(uint32_t *chanagg, uint32_t group, uint16_t pattern);
+        
+        //stores the events of a channel aggregate already checked against
+        //the settings, with the stride and words present known at compile time
+        //for each format; idx holds the even and odd channel's indexes
+        template <bool WAVEFORMS, bool EXTRAS, bool PROBES> 
+        void decode_chan_events(uint32_t *event, uint32_t *end, uint32_t samples, uint32_t group, const uint32_t idx[2], uint16_t pattern);
+        
+        //errors found while decoding, kept out of line
+        [[noreturn]] void disabled_channel(uint32_t group, uint32_t odd) __attribute__((noinline,cold));
 
         uint32_t* decode_board_agg(uint32_t *boardagg);
 
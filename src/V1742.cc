@@ -20,6 +20,7 @@
 #include <stdexcept>
  
 #include "V1742.hh"
+#include "Unpack.hh"
 
 using namespace std;
 
@@ -80,6 +81,9 @@ V1742Settings::V1742Settings(RunTable &dgtz, RunDB &db) : DigitizerSettings(dgtz
     }
     card.max_event_blt = 10; //8 bit events per transfer
     
+    readIntegrations(db);
+    readCompression(dgtz);
+    
 }
 
 V1742Settings::~V1742Settings() {
@@ -119,59 +123,33 @@ V1742calib::V1742calib(CAEN_DGTZ_DRS4Correction_t *dat) {
         for (size_t ch = 0; ch < 9; ch++) {
             for (size_t i = 0; i < 1024; i++) {
                 groups[gr].chans[ch].cell_offset[i] = cal.cell[ch][i];
+                groups[gr].chans[ch].cell_offset[i+1024] = cal.cell[ch][i];
                 groups[gr].chans[ch].seq_offset[i] = cal.nsample[ch][i];
             }
         }
     }
 }
 
+V1742calib::V1742calib(istream &in) {
+    in.read((char*)groups, sizeof(groups));
+    if (!in) throw runtime_error("V1742 calibration is truncated");
+}
+
+void V1742calib::save(ostream &out) {
+    out.write((const char*)groups, sizeof(groups));
+}
+
 V1742calib::~V1742calib() {
 
 }
 
-void V1742calib::calibrate(uint16_t *samples[4][8], uint16_t *trn_samples[4], size_t sampPerEv, uint16_t *start_index[4], bool grActive[4], bool trActive[4], size_t numEv) {
-    
-    cout << "\tCalibrating V1742 data..." << endl;
-    
-    for (size_t gr = 0; gr < 4; gr++) {
-        if (!grActive[gr]) continue;
-        for (size_t ev = 0; ev < numEv; ev++) {
-            uint16_t *samps[9];
-            uint16_t cellidx = start_index[gr][ev];
-            for (size_t ch = 0; ch < (trActive[gr] ? 9 : 8); ch++) {
-                if (ch < 8) {
-                    samps[ch] = samples[gr][ch]+ev*sampPerEv;
-                } else {
-                    samps[ch] = trn_samples[gr]+ev*sampPerEv;
-                }
-                //Apply CAEN offsets 
-                for (size_t i = 0; i < sampPerEv; i++) {
-                    if (samps[ch][i] == 0 || samps[ch][i] == 4095) continue; //don't correct rails
-                    samps[ch][i] = samps[ch][i] - groups[gr].chans[ch].seq_offset[i] - groups[gr].chans[ch].cell_offset[(cellidx+i)%1024];
-                    if (samps[ch][i] >= 0xF000) {
-                        samps[ch][i] = 0; //fix correction below lower rail
-                    } else if (samps[ch][i] >= 0x0FFF) {
-                        samps[ch][i] = 0x0FFF; //fix correction above upper rail 
-                    }
-                }
-            }
-            for (size_t i = 0; i < sampPerEv; i++) {
-                int identified = 0;
-                for (size_t ch = 0; ch < (trActive[gr] ? 9 : 8); ch++) {
-                    if (samps[ch][i]-samps[ch][(i+1)%sampPerEv] > 30 && samps[ch][(i+3)%sampPerEv]-samps[ch][(i+2)%sampPerEv] > 30) {
-                        identified++;
-                    }
-                }
-                if (identified > 4) {
-                    for (size_t ch = 0; ch < 8; ch++) {
-                        samps[ch][(i+1)%sampPerEv] += 53;
-                        samps[ch][(i+2)%sampPerEv] += 53;
-                    }
-                }
-            }
-        }
+void V1742calib::calibrate(size_t gr, uint16_t start_index, uint16_t *samples[9], size_t nch, size_t nsamples) {
+    //Apply CAEN offsets
+    for (size_t ch = 0; ch < nch; ch++) {
+        drs4_offsets(samples[ch], groups[gr].chans[ch].seq_offset, groups[gr].chans[ch].cell_offset + start_index, nsamples);
     }
-
+    //Remove spikes seen by most channels at once
+    drs4_spikes(samples, nch, nsamples);
 }
 
 V1742::V1742(VMEBridge &_bridge, uint32_t _baseaddr) : Digitizer(_bridge,_baseaddr) {
@@ -202,6 +180,9 @@ bool V1742::program(DigitizerSettings &_settings) {
     //Print firmware version
     cout << "Current firmware version: " << read32(0x8124) << "\n\n";
     
+    //Everything else goes out in as few transactions as possible
+    beginBatch();
+    
     //Set TTL logic levels, ignore LVDS and debug settings
     data = (1<<0) // ttl levels
          | (0<<2) | (0<<3) | (0<<4) | (0<<5) // lvds all input
@@ -251,6 +232,8 @@ bool V1742::program(DigitizerSettings &_settings) {
     //Enable VME BLT readout
     write32(REG_READOUT_CONTROL,1<<4);
     
+    endBatch();
+    
     return true;
 }
 
@@ -274,11 +257,19 @@ bool V1742::readoutReady() {
     return read32(REG_ACQUISITION_STATUS) & (1 << 3);
 }
 
+void V1742::setInterrupt(uint32_t level, uint32_t events) {
+    write32(REG_INTERRUPT_EVENT_NUMBER,events);
+    write32(REG_READOUT_CONTROL,(read32(REG_READOUT_CONTROL)&~0x7)|(level&0x7));
+}
+
 bool V1742::checkTemps(vector<uint32_t> &temps, uint32_t danger) {
     temps.resize(4);
+    uint32_t regs[4];
+    for (int gr = 0; gr < 4; gr++) regs[gr] = REG_DRS4_TEMP|(gr<<8);
+    readBatch(regs,temps.data(),4);
     bool over = false;
     for (int gr = 0; gr < 4; gr++) {
-        temps[gr] = read32(REG_DRS4_TEMP|(gr<<8))&0xFF;
+        temps[gr] &= 0xFF;
         if (temps[gr] >= danger) over = true;
     }
     return over;
@@ -317,41 +308,54 @@ V1742calib* V1742::getCalib(V1742SampleFreq freq) {
     return staticGetCalib(freq,bridge.getLinkNum(),baseaddr);
 }
 
-V1742Decoder::V1742Decoder(size_t _eventBuffer, V1742calib *_calib, V1742Settings &_settings) : eventBuffer(_eventBuffer), calib(_calib), settings(_settings) {
+V1742Decoder::V1742Decoder(EventPool *_pool, V1742calib *_calib, V1742Settings &_settings) : pool(_pool), calib(_calib), settings(_settings) {
 
     dispatch_index = group_counter = event_counter = decode_counter = 0;
+    decode_size = decode_held = 0;
+    decode_full = false;
     
     nSamples = settings.getNumSamples();
     for (size_t gr = 0; gr < 4; gr++) {
-        if (settings.getGroupEnabled(gr)) {
-            grActive[gr] = true;
-            grGrabbed[gr] = 0;
-            if (eventBuffer) {
+        grActive[gr] = settings.getGroupEnabled(gr);
+        trnActive[gr] = grActive[gr] && settings.getTrReadout() && pool;
+        grGrabbed[gr] = NULL;
+        for (size_t ch = 0; ch < 8; ch++) {
+            chActive[gr][ch] = settings.getChannelMask(gr,ch);
+            IntegrateSpec *spec = grActive[gr] && chActive[gr][ch] ? settings.getIntegration("/"+settings.getIndex()+"/gr"+to_string(gr)+"/ch"+to_string(ch)) : NULL;
+            if (spec) {
+                spec->validate(nSamples);
+                spec = new IntegrateSpec(*spec);
+                spec->setADC(12,1.0,settings.nsPerSample());
+                if (!spec->save_samples) scratch.resize(8*nSamples);
+            }
+            integrations[gr][ch] = spec;
+        }
+        if (grActive[gr]) {
+            if (pool) {
+                vector<size_t> columns(COL_INTEGRALS+4*8);
                 for (size_t ch = 0; ch < 8; ch++) {
-                    samples[gr][ch] = new uint16_t[eventBuffer*nSamples];
+                    IntegrateSpec *spec = integrations[gr][ch];
+                    columns[ch] = !spec || spec->save_samples ? nSamples*sizeof(uint16_t) : 0;
+                    columns[COL_INTEGRALS+ch*4+0] = columns[COL_INTEGRALS+ch*4+2] = columns[COL_INTEGRALS+ch*4+3] = spec ? sizeof(double) : 0;
+                    columns[COL_INTEGRALS+ch*4+1] = spec ? sizeof(uint8_t) : 0;
                 }
-                start_index[gr] = new uint16_t[eventBuffer];
-                patterns[gr] = new uint16_t[eventBuffer];
-                trigger_count[gr] = new uint32_t[eventBuffer];
-                trigger_time[gr] = new uint32_t[eventBuffer];
+                columns[COL_TRN_SAMPLES] = trnActive[gr] ? nSamples*sizeof(uint16_t) : 0;
+                columns[COL_START_INDEX] = columns[COL_PATTERNS] = sizeof(uint16_t);
+                columns[COL_TRIGGER_COUNT] = columns[COL_TRIGGER_TIME] = sizeof(uint32_t);
+                grGrabbed[gr] = new EventStore(pool,columns);
+            } else {
+                grGrabbed[gr] = new EventStore();
             }
-        } else {
-            grActive[gr] = false;
-        }
-        for (size_t ch = 0; ch < 8; ch++) {
-            chActive[gr][ch] = settings.getChannelMask(gr,ch);
         }
     }
     
-    if (settings.getTrReadout() && eventBuffer) {
+    map<string,IntegrateSpec> &specs = settings.getIntegrations();
+    for (map<string,IntegrateSpec>::iterator it = specs.begin(); it != specs.end(); it++) {
+        bool found = false;
         for (size_t gr = 0; gr < 4; gr++) {
-            if (settings.getGroupEnabled(gr)) {
-                trn_samples[gr] = new uint16_t[eventBuffer*nSamples];
-                trnActive[gr] = true;
-            }
+            for (size_t ch = 0; ch < 8; ch++) found |= integrations[gr][ch] && integrations[gr][ch]->channel == it->first;
         }
-    } else {
-        trnActive[0] = trnActive[1] = trnActive[2] = trnActive[3] = false;
+        if (!found) throw runtime_error("INTEGRATE " + it->second.name + " names " + it->first + " which is not an enabled channel");
     }
     
     clock_gettime(CLOCK_MONOTONIC,&last_decode_time);
@@ -360,31 +364,39 @@ V1742Decoder::V1742Decoder(size_t _eventBuffer, V1742calib *_calib, V1742Setting
 
 V1742Decoder::~V1742Decoder() {
     if (calib) delete calib;
-    if (eventBuffer) {
-        for (size_t gr = 0; gr < 4; gr++) {
-            if (grActive[gr]) {
-                for (size_t ch = 0; ch < 8; ch++) {
-                    delete [] samples[gr][ch];
-                }
-                delete [] patterns[gr];
-                delete [] start_index[gr];
-                delete [] trigger_count[gr];
-                delete [] trigger_time[gr];
-            }
-            if (trnActive[gr]) delete [] trn_samples[gr];
+    for (size_t gr = 0; gr < 4; gr++) {
+        if (grGrabbed[gr]) delete grGrabbed[gr];
+        for (size_t ch = 0; ch < 8; ch++) {
+            if (integrations[gr][ch]) delete integrations[gr][ch];
         }
     }
 }
 
 void V1742Decoder::decode(Buffer &buffer) {
     size_t lastgrabbed[4]; 
-    for (size_t gr = 0; gr < 4; gr++) lastgrabbed[gr] = grGrabbed[gr];
+    for (size_t gr = 0; gr < 4; gr++) lastgrabbed[gr] = grActive[gr] ? grGrabbed[gr]->size() : 0;
     
     decode_size = buffer.fill();
-    cout << settings.getIndex() << " decoding " << decode_size << " bytes." << endl;
+    log << settings.getIndex() << " decoding " << decode_size << " bytes." << endl;
     uint32_t *next = (uint32_t*)buffer.rptr(), *start = (uint32_t*)buffer.rptr();
-    while ((size_t)((next = decode_event_structure(next)) - start + 1)*4 < decode_size);
-    buffer.dec(decode_size);
+    //a trailing partial event stays in buffer to be finished by later
+    //readouts, as do events without room in the event pool until a writeout
+    //frees some (holding back readout meanwhile)
+    size_t consumed = 0;
+    decode_full = false;
+    while (consumed < decode_size) {
+        const bool whole = whole_event_structure(next, decode_size - consumed);
+        if (!whole && !consumed && decode_size + 8 > buffer.capacity()) throw runtime_error("Readout buffer for " + settings.getIndex() + " is too small for one event");
+        if (!whole || !reserve_event_structure(next)) {
+            if (whole) log << "\tevent memory full, holding " << decode_size - consumed << " bytes" << endl;
+            decode_full = whole;
+            break;
+        }
+        next = decode_event_structure(next);
+        consumed = (next - start)*4;
+    }
+    buffer.dec(consumed);
+    decode_held = decode_size - consumed;
     decode_counter++;
     
     struct timespec cur_time;
@@ -393,8 +405,34 @@ void V1742Decoder::decode(Buffer &buffer) {
     last_decode_time = cur_time;
     
     for (size_t gr = 0; gr < 4; gr++) {
-        if (grActive[gr]) cout << "\tgr" << gr << "\tev: " << grGrabbed[gr]-lastgrabbed[gr] << " / " << (grGrabbed[gr]-lastgrabbed[gr])/time_int << " Hz / " << grGrabbed[gr] << " total " << endl;
+        if (grActive[gr]) log << "\tgr" << gr << "\tev: " << grGrabbed[gr]->size()-lastgrabbed[gr] << " / " << (grGrabbed[gr]->size()-lastgrabbed[gr])/time_int << " Hz / " << grGrabbed[gr]->size() << " total " << endl;
+    }
+}
+    
+bool V1742Decoder::whole_event_structure(uint32_t *event, size_t bytes) {
+    size_t words = bytes/4;
+    if (words && event[0] == 0xFFFFFFFF) {
+        event++; //sometimes padded
+        words--;
+    }
+    if (!words) return false;
+    if ((event[0] & 0xF0000000) != 0xA0000000) return true; //decoding will complain
+    return (event[0] & 0xFFFFFFF) <= words;
+}
+
+bool V1742Decoder::reserve_event_structure(uint32_t *event) {
+    if (event[0] == 0xFFFFFFFF) {
+        event++; //sometimes padded
+    }
+    if ((event[0] & 0xF0000000) != 0xA0000000) return true; //decoding will complain
+    
+    uint32_t mask = event[1] & 0xF;
+    
+    for (uint32_t gr = 0; gr < 4; gr++) {
+        if ((mask & (1 << gr)) && grActive[gr] && !grGrabbed[gr]->reserve(1)) return false;
     }
+    
+    return true;
 }
     
 uint32_t* V1742Decoder::decode_event_structure(uint32_t *event) {
@@ -412,15 +450,15 @@ uint32_t* V1742Decoder::decode_event_structure(uint32_t *event) {
     uint32_t count = event[2] & 0x3FFFFF;
     uint32_t timetag = event[3];
     
-    cout << "\t(LVDS & 0xFF): " << (pattern&0xFF) << endl; 
+    log << "\t(LVDS & 0xFF): " << (pattern&0xFF) << endl; 
     
     if (event_counter++) {
         if (count == trigger_last) {
-            cout << "****" << settings.getIndex() << " duplicate trigger " << count << endl;
+            log << "****" << settings.getIndex() << " duplicate trigger " << count << endl;
         } else if (count < trigger_last) {
-            cout << "****" << settings.getIndex() << " orphaned trigger " << count << endl;
+            log << "****" << settings.getIndex() << " orphaned trigger " << count << endl;
         } else if (count != trigger_last + 1) { 
-            cout << "****" << settings.getIndex() << " missed " << count-trigger_last-1 << " triggers" << endl;
+            log << "****" << settings.getIndex() << " missed " << count-trigger_last-1 << " triggers" << endl;
             trigger_last = count;
         } else {
             trigger_last = count;
@@ -433,12 +471,13 @@ uint32_t* V1742Decoder::decode_event_structure(uint32_t *event) {
     
     for (uint32_t gr = 0; gr < 4; gr++) {
         if (mask & (1 << gr)) {
-            size_t ev = grGrabbed[gr]++;
-            if (eventBuffer) {
-                if (ev == eventBuffer) throw runtime_error("Decoder buffer for " + settings.getIndex() + " overflowed!");
-                patterns[gr][ev] = pattern;
-                trigger_time[gr][ev] = timetag;
-                trigger_count[gr][ev] = count;
+            if (!grActive[gr]) throw runtime_error("Recieved group data for inactive group (" + to_string(gr) + ")");
+            EventStore &store = *grGrabbed[gr];
+            store.push();
+            if (pool) {
+                *store.back<uint16_t>(COL_PATTERNS) = pattern;
+                *store.back<uint32_t>(COL_TRIGGER_TIME) = timetag;
+                *store.back<uint32_t>(COL_TRIGGER_COUNT) = count;
             }
             groups = decode_group_structure(groups,gr);
         }
@@ -450,8 +489,6 @@ uint32_t* V1742Decoder::decode_event_structure(uint32_t *event) {
 
 uint32_t* V1742Decoder::decode_group_structure(uint32_t *group, uint32_t gr) {
 
-    if (!grActive[gr]) throw runtime_error("Recieved group data for inactive group (" + to_string(gr) + ")");
-    
     uint32_t cell_index = (group[0] & 0x3FF00000) >> 20;
     //uint32_t freq = (group[0] >> 16) & 0x3;
     
@@ -463,37 +500,40 @@ uint32_t* V1742Decoder::decode_group_structure(uint32_t *group, uint32_t gr) {
     
     group_counter++;
     
-    if (eventBuffer) {
-        size_t ev = grGrabbed[gr]-1;
+    if (pool) {
+        EventStore &store = *grGrabbed[gr];
         
-        start_index[gr][ev] = cell_index;
+        *store.back<uint16_t>(COL_START_INDEX) = cell_index;
         
         uint32_t *word = group+1;
         uint16_t *data[8];
-        for (size_t ch = 0; ch < 8; ch++) data[ch] = samples[gr][ch] + ev*nSamples;
-        for (size_t s = 0; s < nSamples; s++, word += 3) {
-            data[0][s] = word[0]&0xFFF;
-            data[1][s] = (word[0]>>12)&0xFFF;
-            data[2][s] = ((word[1]&0xF)<<8)|((word[0]>>24)&0xFF);
-            data[3][s] = (word[1]>>4)&0xFFF;
-            data[4][s] = (word[1]>>16)&0xFFF;
-            data[5][s] = ((word[2]&0xFF)<<4)|((word[1]>>28)&0xF);
-            data[6][s] = (word[2]>>8)&0xFFF;
-            data[7][s] = (word[2]>>20)&0xFFF;
+        for (size_t ch = 0; ch < 8; ch++) {
+            const bool saved = !integrations[gr][ch] || integrations[gr][ch]->save_samples;
+            data[ch] = saved ? store.back<uint16_t>(ch) : scratch.data() + ch*nSamples;
         }
+        unpack12_channels(word,data,nSamples);
+        word += 3*nSamples;
         
-        if (tr && trnActive[gr]) {
-            uint16_t *data = trn_samples[gr] + ev*nSamples;
-            for (size_t s = 0; s < nSamples; word += 3) {
-                data[s++] = word[0]&0xFFF;
-                data[s++] = (word[0]>>12)&0xFFF;
-                data[s++] = ((word[1]&0xF)<<8)|((word[0]>>24)&0xFF);
-                data[s++] = (word[1]>>4)&0xFFF;
-                data[s++] = (word[1]>>16)&0xFFF;
-                data[s++] = ((word[2]&0xFF)<<4)|((word[1]>>28)&0xF);
-                data[s++] = (word[2]>>8)&0xFFF;
-                data[s++] = (word[2]>>20)&0xFFF;
-            }
+        const bool trn = tr && trnActive[gr];
+        if (trn) {
+            unpack12_stream(word,store.back<uint16_t>(COL_TRN_SAMPLES),nSamples);
+        }
+        
+        if (calib) {
+            uint16_t *chans[9];
+            for (size_t ch = 0; ch < 8; ch++) chans[ch] = data[ch];
+            chans[8] = store.back<uint16_t>(COL_TRN_SAMPLES);
+            calib->calibrate(gr,cell_index,chans,trn ? 9 : 8,nSamples);
+        }
+        
+        for (size_t ch = 0; ch < 8; ch++) {
+            if (!integrations[gr][ch]) continue;
+            integral result;
+            integrations[gr][ch]->integrate(data[ch],result);
+            *store.back<double>(COL_INTEGRALS+ch*4+0) = result.pedmean;
+            *store.back<uint8_t>(COL_INTEGRALS+ch*4+1) = result.pedvalid;
+            *store.back<double>(COL_INTEGRALS+ch*4+2) = result.time;
+            *store.back<double>(COL_INTEGRALS+ch*4+3) = result.sigcharge;
         }
         
     }
@@ -502,10 +542,18 @@ uint32_t* V1742Decoder::decode_group_structure(uint32_t *group, uint32_t gr) {
     
 }
 
+size_t V1742Decoder::leftover() {
+    return decode_held;
+}
+
+bool V1742Decoder::heldBack() {
+    return decode_full;
+}
+
 size_t V1742Decoder::eventsReady() {
     size_t grabs = INT64_MAX;//eventBuffer;
     for (size_t gr = 0; gr < 4; gr++) {
-        if (grActive[gr] && grGrabbed[gr] < grabs) grabs = grGrabbed[gr];
+        if (grActive[gr] && grGrabbed[gr]->size() < grabs) grabs = grGrabbed[gr]->size();
     }
     return grabs;
 }
@@ -520,11 +568,11 @@ void V1742Decoder::dispatch(int nfd, int *fds) {
         for (size_t gr = 0; gr < 4; gr++) {
             if (!grActive[gr]) continue;
             for (size_t ch = 0; ch < 8; ch++) {
-                if (!chActive[gr][ch]) continue;
-                uint8_t lvdsidx = patterns[gr][dispatch_index] & 0xFF; 
+                if (!chActive[gr][ch] || (integrations[gr][ch] && !integrations[gr][ch]->save_samples)) continue;
+                uint8_t lvdsidx = *grGrabbed[gr]->at<uint16_t>(COL_PATTERNS,dispatch_index) & 0xFF; 
                 uint8_t dsize = 2;
                 uint16_t nsamps = nSamples;
-                uint16_t *samps = &samples[gr][ch][nsamps*dispatch_index];
+                uint16_t *samps = grGrabbed[gr]->at<uint16_t>(ch,dispatch_index);
                 string strname = "/"+settings.getIndex()+"/gr" + to_string(gr) + "/ch" + to_string(ch);
                 uint16_t strlen = strname.length();
                 uint16_t length = 2+strlen+2+nsamps*2+1+1;
@@ -544,104 +592,117 @@ void V1742Decoder::dispatch(int nfd, int *fds) {
 
 using namespace H5;
 
-void V1742Decoder::writeOut(H5File &file, size_t nEvents) {
-
-    if (calib) calib->calibrate(samples, trn_samples, nSamples, start_index, grActive, trnActive, nEvents);
+DecodedBatch* V1742Decoder::detach(size_t nEvents) {
+    vector<EventStore*> stores(4,NULL);
+    for (size_t gr = 0; gr < 4; gr++) {
+        if (grGrabbed[gr]) stores[gr] = grGrabbed[gr]->detach(nEvents);
+    }
+    dispatch_index = dispatch_index > nEvents ? dispatch_index - nEvents : 0;
+    return new DecodedBatch(this,stores,nEvents);
+}
 
-    cout << "\t/" << settings.getIndex() << endl;
+void V1742Decoder::writeOut(H5File &file, vector<EventStore*> &stores, size_t nEvents, ChunkCompressor &compressor, bool append, ostream &out) {
 
-    Group cardgroup = file.createGroup("/"+settings.getIndex());
-        
+    //groups and their attributes exist after the first batch of a file
+    const bool fresh = !append || !outputExists(file, "/"+settings.getIndex());
+    
     DataSpace scalar(0,NULL);
     
     double dval;
     uint32_t ival;
     
-    Attribute bits = cardgroup.createAttribute("bits",PredType::NATIVE_UINT32,scalar);
-    ival = 12;
-    bits.write(PredType::NATIVE_INT32,&ival);
+    if (fresh) {
+        out << "\t/" << settings.getIndex() << endl;
+
+        Group cardgroup = file.createGroup("/"+settings.getIndex());
+        
+        Attribute bits = cardgroup.createAttribute("bits",PredType::NATIVE_UINT32,scalar);
+        ival = 12;
+        bits.write(PredType::NATIVE_INT32,&ival);
+        
+        Attribute ns_sample = cardgroup.createAttribute("ns_sample",PredType::NATIVE_DOUBLE,scalar);
+        dval = settings.nsPerSample();
+        ns_sample.write(PredType::NATIVE_DOUBLE,&dval);
+                
+        Attribute _samples = cardgroup.createAttribute("samples",PredType::NATIVE_UINT32,scalar);
+        ival = nSamples;
+        _samples.write(PredType::NATIVE_UINT32,&ival);
+    }
     
-    Attribute ns_sample = cardgroup.createAttribute("ns_sample",PredType::NATIVE_DOUBLE,scalar);
-    dval = settings.nsPerSample();
-    ns_sample.write(PredType::NATIVE_DOUBLE,&dval);
-            
-    Attribute _samples = cardgroup.createAttribute("samples",PredType::NATIVE_UINT32,scalar);
-    ival = nSamples;
-    _samples.write(PredType::NATIVE_UINT32,&ival);
+    Compression &compression = settings.getCompression();
     
     for (size_t gr = 0; gr < 4; gr++) {
         if (!grActive[gr]) continue;
         string grname = "gr" + to_string(gr);
-        Group grgroup = cardgroup.createGroup(grname);
         string grgroupname = "/"+settings.getIndex()+"/"+grname;
         
-        cout << "\t" << grgroupname << endl;
-
-        hsize_t dimensions[2];
-        dimensions[0] = nEvents;
-        dimensions[1] = nSamples;
+        if (fresh) {
+            file.createGroup(grgroupname);
+            out << "\t" << grgroupname << endl;
+        }
         
-        DataSpace samplespace(2, dimensions);
-        DataSpace metaspace(1, dimensions);
+        hsize_t row;
         
         for (size_t ch = 0; ch < 8; ch++) {
             if (!chActive[gr][ch]) continue;
             string chname = "ch" + to_string(ch);
-            Group chgroup = grgroup.createGroup(chname);
             string chgroupname = "/"+settings.getIndex()+"/"+grname+"/"+chname;
             
-            cout << "\t" << chgroupname << endl;
-        
-            Attribute offset = chgroup.createAttribute("offset",PredType::NATIVE_UINT32,scalar);
-            ival = settings.getDCOffset(gr*8+ch);
-            offset.write(PredType::NATIVE_UINT32,&ival);
+            if (fresh) {
+                Group chgroup = file.createGroup(chgroupname);
+                
+                out << "\t" << chgroupname << endl;
+            
+                Attribute offset = chgroup.createAttribute("offset",PredType::NATIVE_UINT32,scalar);
+                ival = settings.getDCOffset(gr*8+ch);
+                offset.write(PredType::NATIVE_UINT32,&ival);
+            }
             
-            cout << "\t" << chgroupname << "/samples" << endl;
-            DataSet samples_ds = file.createDataSet(chgroupname+"/samples", PredType::NATIVE_UINT16, samplespace);
-            samples_ds.write(samples[gr][ch], PredType::NATIVE_UINT16);
-            memmove(samples[gr][ch],samples[gr][ch]+nEvents*nSamples,sizeof(uint16_t)*nSamples*(grGrabbed[gr]-nEvents));
+            if (!integrations[gr][ch] || integrations[gr][ch]->save_samples) {
+                if (fresh) out << "\t" << chgroupname << "/samples" << endl;
+                DataSet samples_ds = outputDataSet(file, chgroupname+"/samples", PredType::NATIVE_UINT16, nEvents, nSamples, compression, append, row);
+                compressor.write<uint16_t>(samples_ds, PredType::NATIVE_UINT16, compression, *stores[gr], ch, nEvents, nSamples, row);
+            }
+            
+            if (integrations[gr][ch]) {
+                integrations[gr][ch]->write(file, chgroupname, *stores[gr], COL_INTEGRALS+ch*4, nEvents, append, out);
+            }
         }
         
         if (trnActive[gr]) {
             string chname = "tr";
-            Group chgroup = grgroup.createGroup(chname);
             string chgroupname = "/"+settings.getIndex()+"/"+grname+"/"+chname;
             
-            cout << "\t" << chgroupname << endl;
-        
-            Attribute offset = chgroup.createAttribute("offset",PredType::NATIVE_UINT32,scalar);
-            ival = settings.getTrDCOffset(gr/2);
-            offset.write(PredType::NATIVE_UINT32,&ival);
+            if (fresh) {
+                Group chgroup = file.createGroup(chgroupname);
+                
+                out << "\t" << chgroupname << endl;
+            
+                Attribute offset = chgroup.createAttribute("offset",PredType::NATIVE_UINT32,scalar);
+                ival = settings.getTrDCOffset(gr/2);
+                offset.write(PredType::NATIVE_UINT32,&ival);
+                
+                out << "\t" << chgroupname << "/samples" << endl;
+            }
             
-            cout << "\t" << chgroupname << "/samples" << endl;
-            DataSet samples_ds = file.createDataSet(chgroupname+"/samples", PredType::NATIVE_UINT16, samplespace);
-            samples_ds.write(trn_samples[gr], PredType::NATIVE_UINT16);
-            memmove(trn_samples[gr],trn_samples[gr]+nEvents*nSamples,sizeof(uint16_t)*nSamples*(grGrabbed[gr]-nEvents));
+            DataSet samples_ds = outputDataSet(file, chgroupname+"/samples", PredType::NATIVE_UINT16, nEvents, nSamples, compression, append, row);
+            compressor.write<uint16_t>(samples_ds, PredType::NATIVE_UINT16, compression, *stores[gr], COL_TRN_SAMPLES, nEvents, nSamples, row);
         }
             
-        cout << "\t" << grgroupname << "/start_index" << endl;
-        DataSet start_index_ds = file.createDataSet(grgroupname+"/start_index", PredType::NATIVE_UINT16, metaspace);
-        start_index_ds.write(start_index[gr], PredType::NATIVE_UINT16);
-        memmove(start_index[gr],start_index[gr]+nEvents,sizeof(uint16_t)*(grGrabbed[gr]-nEvents));
+        if (fresh) out << "\t" << grgroupname << "/start_index" << endl;
+        DataSet start_index_ds = outputDataSet(file, grgroupname+"/start_index", PredType::NATIVE_UINT16, nEvents, 0, compression, append, row);
+        stores[gr]->write<uint16_t>(start_index_ds, PredType::NATIVE_UINT16, COL_START_INDEX, nEvents, 1, row);
         
-        cout << "\t" << grgroupname << "/patterns" << endl;
-        DataSet patterns_ds = file.createDataSet(grgroupname+"/patterns", PredType::NATIVE_UINT16, metaspace);
-        patterns_ds.write(patterns[gr], PredType::NATIVE_UINT16);
-        memmove(patterns[gr],patterns[gr]+nEvents,sizeof(uint16_t)*(grGrabbed[gr]-nEvents));
+        if (fresh) out << "\t" << grgroupname << "/patterns" << endl;
+        DataSet patterns_ds = outputDataSet(file, grgroupname+"/patterns", PredType::NATIVE_UINT16, nEvents, 0, compression, append, row);
+        stores[gr]->write<uint16_t>(patterns_ds, PredType::NATIVE_UINT16, COL_PATTERNS, nEvents, 1, row);
             
-        cout << "\t" << grgroupname << "/trigger_time" << endl;
-        DataSet trigger_time_ds = file.createDataSet(grgroupname+"/trigger_time", PredType::NATIVE_UINT32, metaspace);
-        trigger_time_ds.write(trigger_time[gr], PredType::NATIVE_UINT32);
-        memmove(trigger_time[gr],trigger_time[gr]+nEvents,sizeof(uint32_t)*(grGrabbed[gr]-nEvents));
+        if (fresh) out << "\t" << grgroupname << "/trigger_time" << endl;
+        DataSet trigger_time_ds = outputDataSet(file, grgroupname+"/trigger_time", PredType::NATIVE_UINT32, nEvents, 0, compression, append, row);
+        stores[gr]->write<uint32_t>(trigger_time_ds, PredType::NATIVE_UINT32, COL_TRIGGER_TIME, nEvents, 1, row);
         
-        cout << "\t" << grgroupname << "/trigger_count" << endl;
-        DataSet trigger_count_ds = file.createDataSet(grgroupname+"/trigger_count", PredType::NATIVE_UINT32, metaspace);
-        trigger_count_ds.write(trigger_count[gr], PredType::NATIVE_UINT32);
-        memmove(trigger_count[gr],trigger_count[gr]+nEvents,sizeof(uint32_t)*(grGrabbed[gr]-nEvents));
-        
-        grGrabbed[gr] -= nEvents;
+        if (fresh) out << "\t" << grgroupname << "/trigger_count" << endl;
+        DataSet trigger_count_ds = outputDataSet(file, grgroupname+"/trigger_count", PredType::NATIVE_UINT32, nEvents, 0, compression, append, row);
+        stores[gr]->write<uint32_t>(trigger_count_ds, PredType::NATIVE_UINT32, COL_TRIGGER_COUNT, nEvents, 1, row);
     }
-    
-    dispatch_index -= nEvents;
-    if (dispatch_index < 0) dispatch_index = 0;
 }
@@ -19,12 +19,15 @@
 #include <vector>
 #include <string>
 #include <ctime>
+#include <istream>
+#include <ostream>
 
 #include <CAENDigitizer.h>
 #include "VMEBridge.hh"
 #include "Digitizer.hh"
 #include "RunDB.hh"
 #include "json.hh"
+#include "EventStore.hh"
 
 #ifndef V1742__hh
 #define V1742__hh
@@ -135,14 +138,22 @@ class V1742calib {
     public:
         V1742calib(CAEN_DGTZ_DRS4Correction_t *dat);
         
+        //tables saved by save(), to decode a raw capture without the card
+        V1742calib(std::istream &in);
+        
+        void save(std::ostream &out);
+        
         virtual ~V1742calib();
         
-        virtual void calibrate(uint16_t *samples[4][8], uint16_t *trn_samples[4], size_t sampPerEv, uint16_t *start_index[4], bool grActive[4], bool trActive[4], size_t num);
+        //corrects one event of group gr in place, samples holds the 8 channels
+        //and, if nch is 9, the trigger channel
+        virtual void calibrate(size_t gr, uint16_t start_index, uint16_t *samples[9], size_t nch, size_t nsamples);
         
     protected:
         struct {
             struct {
-                int cell_offset[1024], seq_offset[1024];
+                //cell offsets are repeated so that those from any start index on are contiguous
+                int16_t cell_offset[2048], seq_offset[1024];
             } chans[9]; 
             int cell_delay[1024];   
         } groups[4];
@@ -151,6 +162,8 @@ class V1742calib {
 
 class V1742 : public Digitizer {
 
+    public:
+    
     //system wide
     static constexpr uint32_t REG_GROUP_CONFIG = 0x8000;
     static constexpr uint32_t REG_CUSTOM_SIZE = 0x8020;
@@ -184,9 +197,10 @@ class V1742 : public Digitizer {
     static constexpr uint32_t REG_EVENT_SIZE = 0x814C;
     static constexpr uint32_t REG_READOUT_CONTROL = 0xEF00;
     static constexpr uint32_t REG_READOUT_STATUS = 0xEF04;
+    static constexpr uint32_t REG_INTERRUPT_STATUS_ID = 0xEF14;
+    static constexpr uint32_t REG_INTERRUPT_EVENT_NUMBER = 0xEF18;
     static constexpr uint32_t REG_MAX_EVENT_BLT = 0xEF1C;
     
-    public:
         V1742(VMEBridge &bridge, uint32_t baseaddr);
         
         virtual ~V1742();
@@ -203,6 +217,8 @@ class V1742 : public Digitizer {
         
         virtual bool readoutReady();
         
+        virtual void setInterrupt(uint32_t level, uint32_t events);
+        
         virtual bool checkTemps(std::vector<uint32_t> &temps, uint32_t danger);
         
         virtual V1742calib* getCalib(V1742SampleFreq freq);
@@ -215,7 +231,8 @@ class V1742Decoder : public Decoder {
 
     public: 
     
-        V1742Decoder(size_t eventBuffer, V1742calib *calib, V1742Settings &settings);
+        //without a pool events are only counted
+        V1742Decoder(EventPool *pool, V1742calib *calib, V1742Settings &settings);
         
         virtual ~V1742Decoder();
         
@@ -223,18 +240,25 @@ class V1742Decoder : public Decoder {
         
         virtual size_t eventsReady();
         
-        virtual void writeOut(H5::H5File &file, size_t nEvents);
+        virtual DecodedBatch* detach(size_t nEvents);
+        
+        virtual void writeOut(H5::H5File &file, std::vector<EventStore*> &stores, size_t nEvents, ChunkCompressor &compressor, bool append, std::ostream &out);
+        
+        virtual size_t leftover();
+        
+        virtual bool heldBack();
         
         virtual void dispatch(int nfd, int *fds);
 
     protected:
         
-        size_t eventBuffer;
+        EventPool *pool;
         V1742calib *calib;
         V1742Settings &settings;
         
         size_t dispatch_index;
-        size_t decode_size;
+        size_t decode_size, decode_held;
+        bool decode_full;
         size_t group_counter,event_counter,decode_counter;
         struct timespec last_decode_time;
         
@@ -243,14 +267,24 @@ class V1742Decoder : public Decoder {
         uint32_t nSamples;
         bool grActive[4];
         bool chActive[4][8];
-        size_t grGrabbed[4];
-        uint16_t *samples[4][8];
-        uint16_t *start_index[4];
-        uint16_t *patterns[4];
-        uint32_t *trigger_count[4];
-        uint32_t *trigger_time[4];
+        EventStore *grGrabbed[4]; //per group
         bool trnActive[4];
-        uint16_t *trn_samples[4];
+        
+        //online integration per channel (NULL if none) and where traces that
+        //are integrated but not saved are unpacked
+        IntegrateSpec *integrations[4][8];
+        std::vector<uint16_t> scratch;
+        
+        //columns of the stores, samples of channel ch are column ch (empty if
+        //dropped after integration), and its integration results are the four
+        //columns from COL_INTEGRALS+4*ch on
+        enum { COL_TRN_SAMPLES = 8, COL_START_INDEX, COL_PATTERNS, COL_TRIGGER_COUNT, COL_TRIGGER_TIME, COL_INTEGRALS };
+        
+        //true if bytes hold all of the event
+        bool whole_event_structure(uint32_t *event, size_t bytes);
+        
+        //reserves room for an event in each of its groups
+        bool reserve_event_structure(uint32_t *event);
         
         uint32_t* decode_event_structure(uint32_t *event);
         
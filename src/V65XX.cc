@@ -30,8 +30,11 @@ V65XX::V65XX(VMEBridge &bridge, uint32_t baseaddr) : VMECard(bridge,baseaddr) {
     vmax = read16(REG_BOARD_VMAX);
     imax = read16(REG_BOARD_IMAX);
     positive.resize(nChans);
+    vector<uint32_t> regs(nChans), polarity(nChans);
+    for (uint32_t ch = 0; ch < nChans; ch++) regs[ch] = (0x80*(ch+1))|REG_POLARITY;
+    readBatch(regs.data(),polarity.data(),nChans,cvD16);
     for (uint32_t ch = 0; ch < nChans; ch++) {
-        positive[ch] = read16((0x80*(ch+1))|REG_POLARITY);
+        positive[ch] = polarity[ch];
     }
 }
         
@@ -81,22 +84,31 @@ void V65XX::set(RunTable &config) {
        
     }
 
-    for (uint32_t ch = 0; ch < nChans; ch++) {
-        string field = "ch"+to_string(ch);
-        if (config.isMember(field)) {
-            json::Value &chan = config[field];
-            if (chan.isMember("enabled") && !chan["enabled"].cast<bool>()) setEnabled(ch,false);
-            if (chan.isMember("v_set")) setVSet(ch,chan["v_set"].cast<double>());
-            if (chan.isMember("v_max")) setVMax(ch,chan["v_max"].cast<double>());
-            if (chan.isMember("i_max")) setIMax(ch,chan["i_max"].cast<double>());
-            if (chan.isMember("r_up")) setUpRate(ch,chan["r_up"].cast<int>());
-            if (chan.isMember("r_down")) setDownRate(ch,chan["r_down"].cast<int>());
-            if (chan.isMember("trip")) setTripTime(ch,chan["trip"].cast<double>());
-            if (chan.isMember("ramp_off")) setDownMode(ch,chan["ramp_off"].cast<bool>());
-            if (chan.isMember("enabled") && chan["enabled"].cast<bool>()) setEnabled(ch,true);
-        }
+    //channel settings are independent writes, so issue them together
+    beginBatch();
+    try {
+        for (uint32_t ch = 0; ch < nChans; ch++) {
+            string field = "ch"+to_string(ch);
+            if (config.isMember(field)) {
+                json::Value &chan = config[field];
+                if (chan.isMember("enabled") && !chan["enabled"].cast<bool>()) setEnabled(ch,false);
+                if (chan.isMember("v_set")) setVSet(ch,chan["v_set"].cast<double>());
+                if (chan.isMember("v_max")) setVMax(ch,chan["v_max"].cast<double>());
+                if (chan.isMember("i_max")) setIMax(ch,chan["i_max"].cast<double>());
+                if (chan.isMember("r_up")) setUpRate(ch,chan["r_up"].cast<int>());
+                if (chan.isMember("r_down")) setDownRate(ch,chan["r_down"].cast<int>());
+                if (chan.isMember("trip")) setTripTime(ch,chan["trip"].cast<double>());
+                if (chan.isMember("ramp_off")) setDownMode(ch,chan["ramp_off"].cast<bool>());
+                if (chan.isMember("enabled") && chan["enabled"].cast<bool>()) setEnabled(ch,true);
+            }
     
+        }
+    } catch (runtime_error &e) {
+        //settings accepted before the bad one still go out, as they did unbatched
+        endBatch();
+        throw;
     }
+    endBatch();
 
 }
 
@@ -124,6 +136,26 @@ bool V65XX::isWarning() {
     return warning;
 }
 
+void V65XX::monitor(vector<float> &V, vector<float> &I, vector<uint32_t> &status) {
+    vector<uint32_t> regs(5*nChans), data(5*nChans);
+    for (uint32_t ch = 0; ch < nChans; ch++) {
+        regs[5*ch+0] = (0x80*(ch+1))|REG_VMON;
+        regs[5*ch+1] = (0x80*(ch+1))|REG_IMONH;
+        regs[5*ch+2] = (0x80*(ch+1))|REG_IMONL;
+        regs[5*ch+3] = (0x80*(ch+1))|REG_IMON_RANGE;
+        regs[5*ch+4] = (0x80*(ch+1))|REG_STATUS;
+    }
+    readBatch(regs.data(),data.data(),regs.size(),cvD16);
+    V.resize(nChans);
+    I.resize(nChans);
+    status.resize(nChans);
+    for (uint32_t ch = 0; ch < nChans; ch++) {
+        V[ch] = (positive[ch] ? 1.0 : -1.0)*data[5*ch+0]*VRES;
+        I[ch] = data[5*ch+3] ? data[5*ch+2]*IRESL : data[5*ch+1]*IRESH;
+        status[ch] = data[5*ch+4];
+    }
+}
+
 void V65XX::powerDown() {
     for (uint32_t ch = 0; ch < nChans; ch++) {
         setEnabled(ch,false);
@@ -91,6 +91,11 @@ class V65XX : public VMECard, virtual public HVInterface {
         
         bool isWarning();
         
+        inline uint32_t getNumChans() { return nChans; }
+        
+        //voltage, current, and status of every channel in one batch of reads
+        void monitor(std::vector<float> &V, std::vector<float> &I, std::vector<uint32_t> &status);
+        
         void powerDown();
         
         void kill();
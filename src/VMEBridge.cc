@@ -21,9 +21,10 @@ using namespace std;
 
 const std::string VMEBridge::error_codes[6] = {"Success","Bus Error","Comm Error","Generic Error","Invalid Param","Timeout Error"};
 
+const std::string VMEBridge::op_names[VME_NUM_OPS] = {"read","write","blt"};
+
 VMEBridge::VMEBridge(int link, int board) {
-    this->link = link;
-    this->board = board;
+    init(link,board);
     int res = CAENVME_Init(cvV1718,link,board,&handle);
     if (res) {
         stringstream err;
@@ -32,7 +33,13 @@ VMEBridge::VMEBridge(int link, int board) {
     }
 }
 
+VMEBridge::VMEBridge() : handle(-1) {
+
+}
+
 VMEBridge::~VMEBridge() noexcept(false) {
+    pthread_mutex_destroy(&mutex);
+    if (handle < 0) return;
     int res = CAENVME_End(handle);
     if (res) {
         stringstream err;
@@ -40,3 +47,118 @@ VMEBridge::~VMEBridge() noexcept(false) {
         throw runtime_error(err.str());
     }
 }
+
+void VMEBridge::init(int link, int board) {
+    this->link = link;
+    this->board = board;
+    pthread_mutex_init(&mutex,NULL);
+    //reads and BLTs go out immediately, writes keep the historical 10ms settle time
+    for (int op = 0; op < VME_NUM_OPS; op++) {
+        timing[op].mode = TIMING_NONE;
+        timing[op].delay_us = 0;
+        timing[op].timeout_us = 0;
+        stats[op].cycles = stats[op].retries = stats[op].errors = 0;
+        stats[op].busy_s = stats[op].sleep_s = 0.0;
+    }
+    timing[VME_WRITE].mode = TIMING_FIXED;
+    timing[VME_WRITE].delay_us = 10000;
+}
+
+bool VMEBridge::waitIRQ(uint32_t mask, uint32_t timeout_ms) {
+    pthread_mutex_lock(&mutex);
+    int res = rawIRQEnable(mask);
+    if (!res) res = rawIRQWait(mask, timeout_ms);
+    pthread_mutex_unlock(&mutex);
+    if (res == cvTimeoutError) return false;
+    if (res) {
+        stringstream err;
+        err << error_codes[-res] << " :: waitIRQ " << std::hex << mask;
+        throw runtime_error(err.str());
+    }
+    return true;
+}
+
+void VMEBridge::multiWrite(uint32_t *addrs, uint32_t *data, CVDataWidth *widths, size_t n) {
+    vector<CVErrorCodes> errs(n,cvSuccess);
+    for (size_t i = 0; i < n; i += MULTI_CYCLES) {
+        const size_t count = n-i < MULTI_CYCLES ? n-i : MULTI_CYCLES;
+        size_t failed = count;
+        int res = cycle(VME_WRITE, [&]() {
+            int res = rawMultiWrite(addrs+i, data+i, widths+i, &errs[i], count);
+            for (failed = 0; failed < count && errs[i+failed] == cvSuccess; failed++);
+            return failed < count ? errs[i+failed] : res;
+        }, count);
+        if (res) {
+            stringstream err;
+            err << error_codes[-res] << " :: multiWrite";
+            if (failed < count) err << " @ " << std::hex << addrs[i+failed] << " : " << data[i+failed];
+            throw runtime_error(err.str());
+        }
+    }
+}
+
+void VMEBridge::multiRead(uint32_t *addrs, uint32_t *data, CVDataWidth *widths, size_t n) {
+    vector<CVErrorCodes> errs(n,cvSuccess);
+    for (size_t i = 0; i < n; i += MULTI_CYCLES) {
+        const size_t count = n-i < MULTI_CYCLES ? n-i : MULTI_CYCLES;
+        size_t failed = count;
+        int res = cycle(VME_READ, [&]() {
+            int res = rawMultiRead(addrs+i, data+i, widths+i, &errs[i], count);
+            for (failed = 0; failed < count && errs[i+failed] == cvSuccess; failed++);
+            return failed < count ? errs[i+failed] : res;
+        }, count);
+        if (res) {
+            stringstream err;
+            err << error_codes[-res] << " :: multiRead";
+            if (failed < count) err << " @ " << std::hex << addrs[i+failed];
+            throw runtime_error(err.str());
+        }
+    }
+}
+
+void VMEBridge::setTiming(RunTable &run) {
+    if (!run.isMember("bridge_timing")) return;
+    json::Value &conf = run["bridge_timing"];
+    for (int op = 0; op < VME_NUM_OPS; op++) {
+        if (!conf.isMember(op_names[op])) continue;
+        json::Value &tbl = conf[op_names[op]];
+        VMETiming policy;
+        const string mode = tbl["mode"].cast<string>();
+        if (mode == "none") {
+            policy.mode = TIMING_NONE;
+        } else if (mode == "fixed") {
+            policy.mode = TIMING_FIXED;
+        } else if (mode == "poll") {
+            if (op == VME_BLT) throw runtime_error("BLTs cannot be retried, so blt bridge timing cannot poll");
+            policy.mode = TIMING_POLL;
+        } else {
+            throw runtime_error("Unknown bridge timing mode for " + op_names[op] + ": " + mode);
+        }
+        policy.delay_us = tbl.isMember("delay_us") ? tbl["delay_us"].cast<int>() : 0;
+        policy.timeout_us = tbl.isMember("timeout_us") ? tbl["timeout_us"].cast<int>() : 0;
+        if (policy.mode != TIMING_NONE && !policy.delay_us) policy.delay_us = 1;
+        setTiming((VMEOp)op,policy);
+    }
+}
+
+void VMEBridge::setTiming(VMEOp op, VMETiming policy) {
+    pthread_mutex_lock(&mutex);
+    timing[op] = policy;
+    pthread_mutex_unlock(&mutex);
+}
+
+void VMEBridge::timingReport(ostream &out) {
+    static const string mode_names[3] = {"none","fixed","poll"};
+    pthread_mutex_lock(&mutex);
+    out << "VME bridge timing:" << endl;
+    for (int op = 0; op < VME_NUM_OPS; op++) {
+        const VMETimingStats &st = stats[op];
+        out << "\t" << op_names[op] << " [" << mode_names[timing[op].mode] << " " << timing[op].delay_us << " us]"
+            << "\tcycles: " << st.cycles 
+            << "\tbus: " << st.busy_s << " s (" << (st.cycles ? 1e6*st.busy_s/st.cycles : 0.0) << " us/cycle)"
+            << "\tslept: " << st.sleep_s << " s"
+            << "\tretries: " << st.retries 
+            << "\terrors: " << st.errors << endl;
+    }
+    pthread_mutex_unlock(&mutex);
+}
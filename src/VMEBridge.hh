@@ -16,18 +16,46 @@
  */
  
 #include <unistd.h>
+#include <pthread.h>
+#include <ctime>
 #include <string>
+#include <vector>
 #include <sstream>
+#include <ostream>
 #include <stdexcept>
 #include <CAENVMElib.h>
 
+#include "RunDB.hh"
+
 #ifndef VMEBridge__hh
 #define VMEBridge__hh
 
+//classes of bus operation that have their own timing policy
+enum VMEOp { VME_READ, VME_WRITE, VME_BLT, VME_NUM_OPS };
+
+//none  -> issue the cycle immediately
+//fixed -> sleep delay_us before reads and BLTs, after writes
+//poll  -> issue immediately, retry every delay_us while the bridge reports it
+//         is not ready (bus, comm, timeout errors) for up to timeout_us, for
+//         reads and writes only
+enum VMETimingMode { TIMING_NONE, TIMING_FIXED, TIMING_POLL };
+
+typedef struct {
+    VMETimingMode mode;
+    uint32_t delay_us;
+    uint32_t timeout_us;
+} VMETiming;
+
+typedef struct {
+    size_t cycles, retries, errors;
+    double busy_s, sleep_s;
+} VMETimingStats;
+
 class VMEBridge {
 
     protected: 
         static const std::string error_codes[6];
+        static const std::string op_names[VME_NUM_OPS];
         int link;
         int board;
     
@@ -38,23 +66,30 @@ class VMEBridge {
         
         inline int getLinkNum() { return link; }
         inline int getBoardNum() { return board; }
+        
+        //reads RUN[bridge_timing] if present, e.g.
+        //bridge_timing: { write: { mode: "poll", delay_us: 10, timeout_us: 10000 }, read: { mode: "none" } }
+        void setTiming(RunTable &run);
+        
+        void setTiming(VMEOp op, VMETiming policy);
+        
+        //per operation class cycle counts, retries, and time on the bus / asleep
+        void timingReport(std::ostream &out);
 
         inline void write32(uint32_t addr, uint32_t data) {
             //std::cout << "\twrite32@" << std::hex << addr << ':' << data << dec << endl;
-            int res = CAENVME_WriteCycle(handle, addr, &data, cvA32_U_DATA, cvD32);
+            int res = cycle(VME_WRITE, [&]() { return rawWrite(addr, &data, cvD32); });
             if (res) {
                 std::stringstream err;
                 err << error_codes[-res] << " :: write32 @ " << std::hex << addr << " : " << data;
                 throw std::runtime_error(err.str());
             }
-            usleep(10000);
         }        
         
         inline uint32_t read32(uint32_t addr) {
             uint32_t read = 0;
             //std::cout << "\tread32@" << std::hex << addr << ':';
-            usleep(1);
-            int res = CAENVME_ReadCycle(handle, addr, &read, cvA32_U_DATA, cvD32);
+            int res = cycle(VME_READ, [&]() { return rawRead(addr, &read, cvD32); });
             if (res) {
                 std::stringstream err;
                 err << error_codes[-res] << " :: read32 @ " << std::hex << addr;
@@ -66,20 +101,18 @@ class VMEBridge {
         
         inline void write16(uint32_t addr, uint32_t data) {
             //std::cout << "\twrite16@" << std::hex << addr << ':' << data << dec << endl;
-            int res = CAENVME_WriteCycle(handle, addr, &data, cvA32_U_DATA, cvD16);
+            int res = cycle(VME_WRITE, [&]() { return rawWrite(addr, &data, cvD16); });
             if (res) {
                 std::stringstream err;
                 err << error_codes[-res] << " :: write16 @ " << std::hex << addr << " : " << data;
                 throw std::runtime_error(err.str());
             }
-            usleep(10000);
         }        
         
         inline uint32_t read16(uint32_t addr) {
             uint32_t read = 0;
             //std::cout << "\tread16@" << std::hex << addr << ':';
-            usleep(1);
-            int res = CAENVME_ReadCycle(handle, addr, &read, cvA32_U_DATA, cvD16);
+            int res = cycle(VME_READ, [&]() { return rawRead(addr, &read, cvD16); });
             if (res) {
                 std::stringstream err;
                 err << error_codes[-res] << " :: read16 @ " << std::hex << addr;
@@ -92,8 +125,7 @@ class VMEBridge {
         inline uint32_t readBLT(uint32_t addr, void *buffer, uint32_t size) {
             uint32_t bytes;
             //std::cout << "\tBLT@" << std::hex << addr << " for " << dec << size << endl;
-            usleep(1);
-            int res = CAENVME_MBLTReadCycle(handle, addr, buffer, size, cvA32_U_MBLT, (int*)&bytes);
+            int res = cycle(VME_BLT, [&]() { return rawBLT(addr, buffer, size, (int*)&bytes); });
             if (res && (res != -1)) { //we ignore bus errors for BLT
                 std::stringstream err;
                 err << error_codes[-res] << " :: readBLT @ " << std::hex << addr;
@@ -102,9 +134,131 @@ class VMEBridge {
             return bytes;
         }
         
+        //FIFO MBLT: the address does not increment, so one call can drain far
+        //more than the 4kB address window of the board's output buffer
+        inline uint32_t readFIFOBLT(uint32_t addr, void *buffer, uint32_t size) {
+            uint32_t bytes;
+            int res = cycle(VME_BLT, [&]() { return rawFIFOBLT(addr, buffer, size, (int*)&bytes); });
+            if (res && (res != -1)) { //we ignore bus errors for BLT
+                std::stringstream err;
+                err << error_codes[-res] << " :: readFIFOBLT @ " << std::hex << addr;
+                throw std::runtime_error(err.str());
+            }
+            return bytes;
+        }
+        
+        //enables the IRQ lines in mask and blocks up to timeout_ms for one of
+        //them, returning false on timeout; the bridge lock is held throughout
+        bool waitIRQ(uint32_t mask, uint32_t timeout_ms);
+        
+        //cycles the bridge accepts in one CAENVME_MultiRead/MultiWrite
+        static constexpr size_t MULTI_CYCLES = 256;
+        
+        //issues n single cycles as a few multi-cycle transactions, with the
+        //timing policy for writes or reads applied once per transaction
+        void multiWrite(uint32_t *addrs, uint32_t *data, CVDataWidth *widths, size_t n);
+        
+        void multiRead(uint32_t *addrs, uint32_t *data, CVDataWidth *widths, size_t n);
+        
     protected:
         int handle;
+        
+        //for backends that do not open a CAENVME handle
+        VMEBridge();
+        
+        void init(int link, int board);
+        
+        //the CAENVME calls behind each operation, overridden by other backends
+        virtual int rawRead(uint32_t addr, uint32_t *data, CVDataWidth width) {
+            return CAENVME_ReadCycle(handle, addr, data, cvA32_U_DATA, width);
+        }
+        
+        virtual int rawWrite(uint32_t addr, uint32_t *data, CVDataWidth width) {
+            return CAENVME_WriteCycle(handle, addr, data, cvA32_U_DATA, width);
+        }
+        
+        virtual int rawBLT(uint32_t addr, void *buffer, uint32_t size, int *bytes) {
+            return CAENVME_MBLTReadCycle(handle, addr, buffer, size, cvA32_U_MBLT, bytes);
+        }
+        
+        virtual int rawFIFOBLT(uint32_t addr, void *buffer, uint32_t size, int *bytes) {
+            return CAENVME_FIFOMBLTReadCycle(handle, addr, buffer, size, cvA32_U_MBLT, bytes);
+        }
+        
+        virtual int rawIRQEnable(uint32_t mask) {
+            return CAENVME_IRQEnable(handle, mask);
+        }
+        
+        virtual int rawIRQWait(uint32_t mask, uint32_t timeout_ms) {
+            return CAENVME_IRQWait(handle, mask, timeout_ms);
+        }
+        
+        virtual int rawMultiRead(uint32_t *addrs, uint32_t *data, CVDataWidth *widths, CVErrorCodes *errs, int n) {
+            std::vector<CVAddressModifier> ams(n,cvA32_U_DATA);
+            return CAENVME_MultiRead(handle, addrs, data, n, ams.data(), widths, errs);
+        }
+        
+        virtual int rawMultiWrite(uint32_t *addrs, uint32_t *data, CVDataWidth *widths, CVErrorCodes *errs, int n) {
+            std::vector<CVAddressModifier> ams(n,cvA32_U_DATA);
+            return CAENVME_MultiWrite(handle, addrs, data, n, ams.data(), widths, errs);
+        }
+        
+        //serializes cycles when several readout threads share this bridge
+        pthread_mutex_t mutex;
+        
+        VMETiming timing[VME_NUM_OPS];
+        VMETimingStats stats[VME_NUM_OPS];
+        
+        static inline double elapsed(struct timespec &start, struct timespec &end) {
+            return (end.tv_sec - start.tv_sec)+1e-9*(end.tv_nsec - start.tv_nsec);
+        }
+        
+        //a failed BLT may already have drained board memory, so repeating it
+        //would lose or duplicate data, and bus errors terminate every BLT
+        static inline bool retryable(VMEOp op, int res) {
+            return op != VME_BLT && (res == cvCommError || res == cvTimeoutError || res == cvBusError);
+        }
+        
+        //issues a raw CAENVME call (of ncycles bus cycles) under the bridge lock applying the timing policy for op
+        template <typename F> inline int cycle(VMEOp op, F raw, size_t ncycles = 1) {
+            const VMETiming &policy = timing[op];
+            struct timespec start, end;
+            double slept = 0.0;
+            size_t retries = 0;
+            
+            if (policy.mode == TIMING_FIXED && op != VME_WRITE) {
+                usleep(policy.delay_us);
+                slept += 1e-6*policy.delay_us;
+            }
+            
+            int res;
+            for (uint32_t waited = 0; ; waited += policy.delay_us, retries++) {
+                pthread_mutex_lock(&mutex);
+                clock_gettime(CLOCK_MONOTONIC,&start);
+                res = raw();
+                clock_gettime(CLOCK_MONOTONIC,&end);
+                stats[op].cycles += ncycles;
+                stats[op].busy_s += elapsed(start,end);
+                pthread_mutex_unlock(&mutex);
+                if (policy.mode != TIMING_POLL || !retryable(op,res) || waited >= policy.timeout_us) break;
+                usleep(policy.delay_us);
+                slept += 1e-6*policy.delay_us;
+            }
+            
+            if (policy.mode == TIMING_FIXED && op == VME_WRITE) {
+                usleep(policy.delay_us);
+                slept += 1e-6*policy.delay_us;
+            }
+            
+            if (slept > 0.0 || retries || (res && !(op == VME_BLT && res == cvBusError))) {
+                pthread_mutex_lock(&mutex);
+                stats[op].sleep_s += slept;
+                stats[op].retries += retries;
+                if (res && !(op == VME_BLT && res == cvBusError)) stats[op].errors++;
+                pthread_mutex_unlock(&mutex);
+            }
+            return res;
+        }
 };
 
 #endif
-
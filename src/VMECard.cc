@@ -17,10 +17,38 @@
  
 #include "VMECard.hh"
 
-VMECard::VMECard(VMEBridge &_bridge, uint32_t _baseaddr) : bridge(_bridge), baseaddr(_baseaddr) {
+VMECard::VMECard(VMEBridge &_bridge, uint32_t _baseaddr) : bridge(_bridge), baseaddr(_baseaddr), batching(false), hold(false) {
 
 }
 
 VMECard::~VMECard() {
 
 }
+
+void VMECard::flush() {
+    if (!batch_addrs.size()) return;
+    //clear first so a failed transaction is not replayed by the next flush
+    std::vector<uint32_t> addrs, data;
+    std::vector<CVDataWidth> widths;
+    addrs.swap(batch_addrs);
+    data.swap(batch_data);
+    widths.swap(batch_widths);
+    bridge.multiWrite(addrs.data(),data.data(),widths.data(),addrs.size());
+}
+
+void VMECard::takeBatch(std::vector<uint32_t> &addrs, std::vector<uint32_t> &data, std::vector<CVDataWidth> &widths) {
+    addrs.swap(batch_addrs);
+    data.swap(batch_data);
+    widths.swap(batch_widths);
+    batch_addrs.clear();
+    batch_data.clear();
+    batch_widths.clear();
+}
+
+void VMECard::readBatch(const uint32_t *regs, uint32_t *data, size_t n, CVDataWidth width) {
+    if (batch_addrs.size()) flush();
+    std::vector<uint32_t> addrs(n);
+    std::vector<CVDataWidth> widths(n,width);
+    for (size_t i = 0; i < n; i++) addrs[i] = baseaddr|regs[i];
+    bridge.multiRead(addrs.data(),data,widths.data(),n);
+}
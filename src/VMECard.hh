@@ -29,25 +29,63 @@ class VMECard {
         VMECard(VMEBridge &bridge, uint32_t baseaddr);
         
         virtual ~VMECard();
+        
+        //while held, endBatch leaves the queued writes to be taken by the
+        //caller, which can merge several cards' writes into multicast cycles
+        inline void holdBatch(bool held) {
+            hold = held;
+        }
+        
+        void takeBatch(std::vector<uint32_t> &addrs, std::vector<uint32_t> &data, std::vector<CVDataWidth> &widths);
     
     protected:
         
         VMEBridge &bridge;
         uint32_t baseaddr;
         
+        //between beginBatch and endBatch writes are queued and go out together
+        //as multi-cycle transactions; reads flush the queue first to keep order
+        bool batching, hold;
+        std::vector<uint32_t> batch_addrs, batch_data;
+        std::vector<CVDataWidth> batch_widths;
+        
+        inline void beginBatch() {
+            batching = true;
+        }
+        
+        inline void endBatch() {
+            if (!hold) flush();
+            batching = false;
+        }
+        
+        void flush();
+        
+        //reads n registers of the given width in as few transactions as possible
+        void readBatch(const uint32_t *regs, uint32_t *data, size_t n, CVDataWidth width = cvD32);
+        
         inline void write16(uint32_t reg, uint32_t data) {
-            bridge.write16(baseaddr|reg,data);
+            if (batching) {
+                queue(reg,data,cvD16);
+            } else {
+                bridge.write16(baseaddr|reg,data);
+            }
         }
         
         inline uint32_t read16(uint32_t reg) {
+            if (batch_addrs.size()) flush();
             return bridge.read16(baseaddr|reg);
         }
         
         inline void write32(uint32_t reg, uint32_t data) {
-            bridge.write32(baseaddr|reg,data);
+            if (batching) {
+                queue(reg,data,cvD32);
+            } else {
+                bridge.write32(baseaddr|reg,data);
+            }
         }
         
         inline uint32_t read32(uint32_t reg) {
+            if (batch_addrs.size()) flush();
             return bridge.read32(baseaddr|reg);
         }
         
@@ -55,6 +93,18 @@ class VMECard {
             return bridge.readBLT(baseaddr|addr,buffer,size);
         }
         
+        inline uint32_t readFIFOBLT(uint32_t addr, void *buffer, uint32_t size) {
+            return bridge.readFIFOBLT(baseaddr|addr,buffer,size);
+        }
+        
+    private:
+    
+        inline void queue(uint32_t reg, uint32_t data, CVDataWidth width) {
+            batch_addrs.push_back(baseaddr|reg);
+            batch_data.push_back(data);
+            batch_widths.push_back(width);
+        }
+        
 };
 
 #endif
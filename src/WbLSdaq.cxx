@@ -29,9 +29,16 @@
 
 #include "RunDB.hh"
 #include "VMEBridge.hh"
+#include "SimVMEBridge.hh"
 #include "V1730_dpppsd.hh"
 #include "V1742.hh"
 #include "V65XX.hh"
+#include "SlowControl.hh"
+#include "DecodePool.hh"
+#include "FileWriter.hh"
+#include "RawCapture.hh"
+#include "ReplayDigitizer.hh"
+#include "EventStore.hh"
 #include "LeCroy6Zi.hh"
 #include "EthernetCommunication.hh"
 #include "FileCommunication.hh"
@@ -46,6 +53,8 @@ bool decode_running;
 
 class RunType {
     public:
+        virtual ~RunType() { }
+        
         //called just before readout begins
         virtual void begin() = 0;
         
@@ -58,12 +67,16 @@ class RunType {
         //called before writing to modify the output filename
         virtual string fname() = 0;
         
-        //add any runtype metadata to output file
+        //add any runtype metadata to output file, called on a clone
         virtual void write(H5File &file) = 0;
         
-        //called after data is written to add more data or prepare for next file
+        //called after data is handed to the writer to prepare for next file
         virtual bool keepgoing() = 0;
         
+        //copy holding the metadata of the file about to be written, which
+        //the writer saves with write() while this goes on to the next file
+        virtual RunType* clone() = 0;
+        
 };
 
 // Gets fixed numbers of events, optionally splitting into multiple files (repeating)
@@ -128,8 +141,10 @@ class NEventsRun : public RunType {
             uint32_t timestamp = time(NULL);
             Attribute tstampattr = root.createAttribute("creation_time",PredType::NATIVE_UINT32,scalar);
             tstampattr.write(PredType::NATIVE_UINT32,&timestamp);
-
-			last_time = cur_time;
+        }
+        
+        virtual RunType* clone() {
+            return new NEventsRun(*this);
         }
         
         virtual bool keepgoing() {
@@ -211,12 +226,14 @@ class TimedRun : public RunType {
             uint32_t timestamp = time(NULL);
             Attribute tstampattr = root.createAttribute("creation_time",PredType::NATIVE_UINT32,scalar);
             tstampattr.write(PredType::NATIVE_UINT32,&timestamp);
-
-
-			last_time = cur_time;
+        }
+        
+        virtual RunType* clone() {
+            return new TimedRun(*this);
         }
         
         virtual bool keepgoing() {
+            last_time = cur_time;
             if (evtsPerFile > 0) curCycle++;
             double time_int = (cur_time.tv_sec - begin_time.tv_sec)+1e-9*(cur_time.tv_nsec - begin_time.tv_nsec);
             return time_int < runtime;
@@ -228,6 +245,80 @@ void int_handler(int x) {
     stop = true;
 }
 
+// One output file: metadata from a clone of the run type, the events each
+// decoder detached for it, and the monitor samples and run config. Only the
+// writer thread touches HDF5.
+//
+// When streaming, a file is written by several jobs sharing the open file in
+// stream: the first creates it, each appends its batches to extendible
+// datasets and flushes, and the last (with the run type) finishes and closes
+// it, so only the latest batch is lost if the DAQ dies.
+class RunFile : public WriteJob {
+    public:
+        RunFile(RunType *_runtype, SlowControl *_monitor, const string &_config, H5File **_stream = NULL) :
+            runtype(_runtype),
+            monitor(_monitor),
+            config(_config),
+            single(NULL),
+            file(_stream ? _stream : &single),
+            append(_stream != NULL) { }
+        
+        virtual ~RunFile() {
+            //closes a file whose writing failed or was skipped
+            if (closes && *file) {
+                delete *file;
+                *file = NULL;
+            }
+            delete runtype;
+            for (size_t i = 0; i < batches.size(); i++) delete batches[i];
+        }
+        
+        virtual size_t write(ChunkCompressor &compressor, ostream &out) {
+            Exception::dontPrint();
+            
+            if (opens) {
+                *file = new H5File(fname, H5F_ACC_TRUNC);
+                
+                DataSpace scalar(0,NULL);
+                Group root = (*file)->openGroup("/");
+               
+                StrType configdtype(PredType::C_S1, config.size());
+                Attribute attr = root.createAttribute("run_config",configdtype,scalar);
+                attr.write(configdtype,config.c_str());
+                
+                int epochtime = time(NULL);
+                Attribute timestamp = root.createAttribute("created_unix_timestamp",PredType::NATIVE_INT,scalar);
+                timestamp.write(PredType::NATIVE_INT,&epochtime);
+            }
+            
+            for (size_t i = 0; i < batches.size(); i++) {
+                batches[i]->writeOut(**file,compressor,append,out);
+            }
+            
+            if (closes) {
+                runtype->write(**file);
+                monitor->writeOut(**file,out);
+            }
+            
+            (*file)->flush(H5F_SCOPE_LOCAL);
+            if (!closes) return 0;
+            const size_t size = (*file)->getFileSize();
+            delete *file;
+            *file = NULL;
+            return size;
+        }
+        
+        RunType *runtype;
+        SlowControl *monitor;
+        const string &config;
+        vector<DecodedBatch*> batches;
+        
+    protected:
+        H5File *single;
+        H5File **file;
+        bool append;
+};
+
 typedef struct {
     vector<Buffer*> *buffers;
     vector<Decoder*> *decoders;
@@ -235,6 +326,12 @@ typedef struct {
     pthread_cond_t *newdata;
     string config;
     RunType *runtype;
+    SlowControl *monitor;
+    DecodePool *pool;
+    EventPool *events;
+    FileWriter *writer;
+    size_t stream_events; //0 unless files are streamed
+    size_t file_events; //events per file, or per batch when streaming
 } decode_thread_data;
 
 void *decode_thread(void *_data) {
@@ -242,70 +339,330 @@ void *decode_thread(void *_data) {
     decode_thread_data* data = (decode_thread_data*)_data;
     
     vector<size_t> evtsReady(data->buffers->size());
+    //bytes decoders left in their buffers, only new data is worth decoding
+    vector<size_t> held(data->buffers->size(),0);
+    bool warned = false;
+    size_t written = 0;
+    //when streaming, events already appended to the open file
+    H5File *stream = NULL;
+    vector<size_t> appended(data->buffers->size(),0);
+    bool opened = false;
     data->runtype->begin();
     try {
         decode_running = true;
         while (decode_running) {
+            RunFile *job = NULL;
             pthread_mutex_lock(data->iomutex);
             for (;;) {
                 bool found = stop;
                 for (size_t i = 0; i < data->buffers->size(); i++) {
-                    found |= (*data->buffers)[i]->fill() > 0;
+                    found |= (*data->buffers)[i]->fill() > held[i];
+                }
+                //a written job frees event memory, so anything held back
+                //may now fit
+                if (data->writer->written() != written) {
+                    written = data->writer->written();
+                    for (size_t i = 0; i < held.size(); i++) held[i] = 0;
+                    warned = false;
+                    found = true;
                 }
                 if (found) break;
                 pthread_cond_wait(data->newdata,data->iomutex);
             }
             
+            //decoders only touch their own Buffer, so readout can carry on
+            pthread_mutex_unlock(data->iomutex);
+            const size_t misses = data->events ? data->events->misses() : 0;
+            string failed;
+            try {
+                data->pool->decode(*data->decoders,*data->buffers);
+            } catch (runtime_error &e) {
+                failed = e.what();
+            }
+            pthread_mutex_lock(data->iomutex);
+            
+            //decoders may run on pool threads, so what they report is only
+            //printed here, whole and in card order
+            for (size_t i = 0; i < data->decoders->size(); i++) {
+                cout << (*data->decoders)[i]->report();
+            }
+            if (failed.size()) throw runtime_error(failed);
+            
+            const bool full = data->events && data->events->misses() != misses;
+            for (size_t i = 0; i < data->buffers->size(); i++) {
+                held[i] = (*data->decoders)[i]->leftover();
+            }
+            
+            //writeout is decided only once every decoder is caught up, on
+            //the events of the file including those already streamed out
             size_t total = 0;
+            bool batch = false;
             for (size_t i = 0; i < data->decoders->size(); i++) {
-                size_t sz = (*data->buffers)[i]->fill();
-                if (sz > 0) (*data->decoders)[i]->decode(*(*data->buffers)[i]);
                 size_t ev = (*data->decoders)[i]->eventsReady();
-                evtsReady[i] = ev;
+                evtsReady[i] = appended[i] + ev;
                 total += ev;
+                if (data->stream_events && ev >= data->stream_events) batch = true;
+            }
+            
+            //a decoder held back short of a file can only be freed by the
+            //writeout it is keeping from happening, e.g. when one busy V1730
+            //channel has used up the memory its board aggregates need, so
+            //unless a queued write will free some the file is cut short
+            bool stuck = false;
+            if (full && !data->writer->pending()) {
+                for (size_t i = 0; i < data->decoders->size(); i++) {
+                    if (!(*data->decoders)[i]->heldBack()) continue;
+                    //without a file size (events: 0) no file will ever free it
+                    if (data->stream_events ? !total : !data->file_events || evtsReady[i] < data->file_events) stuck = true;
+                }
+            }
+            if (stuck && !total) {
+                throw runtime_error("Decoder buffer overflowed! Event memory is full with no events to write out");
+            } else if (stuck) {
+                cout << "Event memory (" << data->events->budget()/1024/1024 << " MiB) is full with a channel short of a file, writing a short file" << endl;
             }
             
-            if (stop && total == 0) {
+            if (stop && total == 0 && !opened) {
                 decode_running = false;
-            } else if (stop || data->runtype->writeout(evtsReady)) {
-                Exception::dontPrint();
-                
-                string fname = data->runtype->fname() + ".h5"; 
-                cout << "Saving data to " << fname << endl;
-                
-                H5File file(fname, H5F_ACC_TRUNC);
-                data->runtype->write(file);
-                  
-                DataSpace scalar(0,NULL);
-                Group root = file.openGroup("/");
-               
-                StrType configdtype(PredType::C_S1, data->config.size());
-                Attribute config = root.createAttribute("run_config",configdtype,scalar);
-                config.write(configdtype,data->config.c_str());
-                
-                int epochtime = time(NULL);
-                Attribute timestamp = root.createAttribute("created_unix_timestamp",PredType::NATIVE_INT,scalar);
-                timestamp.write(PredType::NATIVE_INT,&epochtime);
-                
+            } else if (stop || data->runtype->writeout(evtsReady) || stuck) {
+                //the file is written on the writer thread from events moved
+                //out of the decoders, which carry on decoding into the next
+                job = new RunFile(data->runtype->clone(),data->monitor,data->config,data->stream_events ? &stream : NULL);
+                job->fname = data->runtype->fname() + ".h5"; 
+                job->opens = !opened;
                 for (size_t i = 0; i < data->decoders->size(); i++) {
-                    (*data->decoders)[i]->writeOut(file,evtsReady[i]);
+                    job->batches.push_back((*data->decoders)[i]->detach(evtsReady[i]-appended[i]));
+                    appended[i] = 0;
                 }
-                
+                opened = false;
                 decode_running = data->runtype->keepgoing();
+            } else if (data->stream_events && total && (batch || full)) {
+                //appending frees the memory, so a full pool never waits for
+                //the file to be complete
+                job = new RunFile(NULL,data->monitor,data->config,&stream);
+                job->fname = data->runtype->fname() + ".h5"; 
+                job->opens = !opened;
+                job->closes = false;
+                for (size_t i = 0; i < data->decoders->size(); i++) {
+                    job->batches.push_back((*data->decoders)[i]->detach(evtsReady[i]-appended[i]));
+                    appended[i] = evtsReady[i];
+                }
+                opened = true;
+            } else if (full && !warned) {
+                cout << "Event memory (" << data->events->budget()/1024/1024 << " MiB) is full before a file is ready, holding back readout" << endl;
+                warned = true;
             }
             pthread_mutex_unlock(data->iomutex);
+            
+            //waits while the writer's queue is full
+            if (job) {
+                try {
+                    data->writer->push(job);
+                } catch (runtime_error &e) {
+                    pthread_mutex_lock(data->iomutex);
+                    throw;
+                }
+            }
+        }
+        data->writer->finish();
+        if (data->writer->error().size()) {
+            pthread_mutex_lock(data->iomutex);
+            throw runtime_error("Writing files failed: " + data->writer->error());
         }
         stop = true;
     } catch (runtime_error &e) {
         pthread_mutex_unlock(data->iomutex);
         stop = true;
+        data->writer->finish();
+        //a file left open by a run that failed part way
+        delete stream;
         pthread_mutex_lock(data->iomutex);
         cout << "Decode thread aborted: " << e.what() << endl;
         pthread_mutex_unlock(data->iomutex);
     }
+    decode_running = false;
+    pthread_exit(NULL);
+}
+
+//how readout waits for data between passes over its cards
+//  spin    -> poll every card continuously
+//  backoff -> sleep after an empty pass, doubling from min_us up to max_us
+//  irq     -> block on the cards' VME interrupt for up to timeout_ms
+enum ReadoutWaitMode { WAIT_SPIN, WAIT_BACKOFF, WAIT_IRQ };
+
+typedef struct {
+    ReadoutWaitMode mode;
+    uint32_t min_us, max_us;
+    uint32_t level, timeout_ms;
+} readout_wait;
+
+typedef struct {
+    vector<size_t> cards; //indexes of the digitizers this thread reads out
+    vector<Digitizer*> *digitizers;
+    vector<Buffer*> *buffers;
+    vector<DigitizerSettings*> *settings;
+    vector<V1730Chain*> chains; //CBLT chains this thread reads out
+    vector<bool> *chained; //digitizers read out through a chain instead
+    pthread_mutex_t *iomutex;
+    pthread_cond_t *newdata;
+    VMEBridge *bridge;
+    readout_wait wait;
+    uint32_t delay_us; //current backoff
+    size_t polls, irqs, timeouts, bytes;
+    vector<bool> replayed; //replay cards of this thread that have finished
+    size_t *replays; //replay cards of all threads still running
+} readout_thread_data;
+
+//reads RUN[readout_wait], e.g. { mode: "irq", level: 1, timeout_ms: 100 }
+readout_wait readout_wait_config(RunTable &run) {
+    readout_wait wait;
+    wait.mode = WAIT_SPIN;
+    wait.min_us = 10;
+    wait.max_us = 10000;
+    wait.level = 1;
+    wait.timeout_ms = 100;
+    if (!run.isMember("readout_wait")) return wait;
+    json::Value &conf = run["readout_wait"];
+    const string mode = conf["mode"].cast<string>();
+    if (mode == "spin") {
+        wait.mode = WAIT_SPIN;
+    } else if (mode == "backoff") {
+        wait.mode = WAIT_BACKOFF;
+    } else if (mode == "irq") {
+        wait.mode = WAIT_IRQ;
+    } else {
+        throw runtime_error("Unknown readout_wait mode: " + mode);
+    }
+    if (conf.isMember("min_us")) wait.min_us = conf["min_us"].cast<int>();
+    if (conf.isMember("max_us")) wait.max_us = conf["max_us"].cast<int>();
+    if (conf.isMember("level")) wait.level = conf["level"].cast<int>();
+    if (conf.isMember("timeout_ms")) wait.timeout_ms = conf["timeout_ms"].cast<int>();
+    if (wait.level < 1 || wait.level > 7) throw runtime_error("readout_wait level must be 1-7");
+    if (!wait.min_us) wait.min_us = 1;
+    if (wait.max_us < wait.min_us) wait.max_us = wait.min_us;
+    return wait;
+}
+
+//one pass over the cards owned by a readout thread
+void readout_cards(readout_thread_data *data) {
+    if (data->wait.mode == WAIT_IRQ) {
+        if (data->bridge->waitIRQ(1 << (data->wait.level-1),data->wait.timeout_ms)) {
+            data->irqs++;
+        } else {
+            data->timeouts++;
+        }
+    }
+    bool found = false;
+    for (size_t c = 0; c < data->chains.size() && !stop; c++) {
+        V1730Chain *chain = data->chains[c];
+        const size_t bytes = chain->readout();
+        if (bytes) {
+            data->bytes += bytes;
+            found = true;
+            pthread_cond_signal(data->newdata);
+        } else if (!chain->acquisitionRunning()) {
+            pthread_mutex_lock(data->iomutex);
+            cout << "Chain " << chain->getIndex() << " aborted acquisition!" << endl;
+            pthread_mutex_unlock(data->iomutex);
+            stop = true;
+        }
+    }
+    for (size_t j = 0; j < data->cards.size() && !stop; j++) {
+        const size_t i = data->cards[j];
+        if ((*data->chained)[i]) continue;
+        Digitizer *dgtz = (*data->digitizers)[i];
+        Buffer *buffer = (*data->buffers)[i];
+        data->polls++;
+        if (dgtz->readoutReady()) {
+            const size_t bytes = dgtz->readoutBLT(buffer->wptr(),buffer->free());
+            buffer->inc(bytes);
+            data->bytes += bytes;
+            found = true;
+            pthread_cond_signal(data->newdata);
+        }
+        if (!dgtz->acquisitionRunning()) {
+            //the run ends with the last replay to finish
+            if (dynamic_cast<ReplayDigitizer*>(dgtz)) {
+                if (data->replayed[i]) continue;
+                data->replayed[i] = true;
+                pthread_mutex_lock(data->iomutex);
+                cout << "Digitizer " << (*data->settings)[i]->getIndex() << " finished its replay" << endl;
+                if (!--*data->replays) stop = true;
+                pthread_mutex_unlock(data->iomutex);
+                continue;
+            }
+            pthread_mutex_lock(data->iomutex);
+            cout << "Digitizer " << (*data->settings)[i]->getIndex() << " aborted acquisition!" << endl;
+            pthread_mutex_unlock(data->iomutex);
+            stop = true;
+        }
+    }
+    if (data->wait.mode == WAIT_BACKOFF) {
+        if (found) {
+            data->delay_us = data->wait.min_us;
+        } else {
+            usleep(data->delay_us);
+            data->delay_us = 2*data->delay_us < data->wait.max_us ? 2*data->delay_us : data->wait.max_us;
+        }
+    }
+}
+
+void *readout_thread(void *_data) {
+    readout_thread_data* data = (readout_thread_data*)_data;
+    try {
+        while (!stop) readout_cards(data);
+    } catch (exception &e) {
+        stop = true;
+        pthread_mutex_lock(data->iomutex);
+        cout << "Readout thread aborted: " << e.what() << endl;
+        pthread_mutex_unlock(data->iomutex);
+    }
     pthread_exit(NULL);
 }
 
+//Builds the readout thread layout from RUN[readout_threads]
+//  absent  -> one thread (the main loop) reads out every card
+//  "card"  -> one thread per digitizer
+//  [[idx,...],...] -> one thread per list of digitizer indexes, unlisted cards get their own
+vector<vector<size_t>> readout_layout(RunTable &run, vector<DigitizerSettings*> &settings) {
+    vector<vector<size_t>> layout;
+    if (!run.isMember("readout_threads")) {
+        layout.resize(1);
+        for (size_t i = 0; i < settings.size(); i++) layout[0].push_back(i);
+        return layout;
+    }
+    json::Value &threads = run["readout_threads"];
+    vector<bool> assigned(settings.size(),false);
+    if (threads.getType() == json::TARRAY) {
+        for (size_t t = 0; t < threads.getArraySize(); t++) {
+            vector<string> indexes = threads[t].toVector<string>();
+            layout.push_back(vector<size_t>());
+            for (size_t j = 0; j < indexes.size(); j++) {
+                size_t i;
+                for (i = 0; i < settings.size() && settings[i]->getIndex() != indexes[j]; i++);
+                if (i == settings.size()) throw runtime_error("Unknown digitizer in readout_threads: " + indexes[j]);
+                if (assigned[i]) throw runtime_error("Digitizer assigned to multiple readout threads: " + indexes[j]);
+                assigned[i] = true;
+                layout.back().push_back(i);
+            }
+        }
+    } else if (threads.cast<string>() != "card") {
+        throw runtime_error("Unknown readout_threads layout: " + threads.cast<string>());
+    }
+    for (size_t i = 0; i < settings.size(); i++) {
+        if (!assigned[i]) layout.push_back(vector<size_t>(1,i));
+    }
+    return layout;
+}
+
+//Software triggers the digitizer if it is the one named by RUN[soft_trig]
+void soft_trigger(RunTable &run, DigitizerSettings *settings, Digitizer *digitizer) {
+    if (run.isMember("soft_trig") && settings->getIndex() == run["soft_trig"].cast<string>()) {
+        cout << "Software triggering " << settings->getIndex() << endl;
+        digitizer->softTrig();
+    }
+}
+
 int main(int argc, char **argv) {
 
     if (argc != 2) {
@@ -325,7 +682,7 @@ int main(int argc, char **argv) {
     
     const string runtypestr = run["runtype"].cast<string>();
     RunType *runtype = NULL;
-    size_t eventBufferSize = 0;
+    size_t eventBufferSize = 0, fileEvents = 0;
     if (run.isMember("event_buffer_size")) {
         eventBufferSize = run["event_buffer_size"].cast<int>();
     } 
@@ -341,6 +698,7 @@ int main(int argc, char **argv) {
         }
         runtype = new NEventsRun(outfile,nEvents,nRepeat);
         if (!eventBufferSize) eventBufferSize = (size_t)(nEvents*1.5);
+        fileEvents = nEvents;
     } else if (runtypestr == "timed") {
         cout << "Setting up a time limited run..." << endl;
         const string outfile = run["outfile"].cast<string>();
@@ -356,15 +714,45 @@ int main(int argc, char **argv) {
         }
         runtype = new TimedRun(outfile,run["runtime"].cast<int>(),evtsPerFile);
         if (!eventBufferSize) eventBufferSize = (size_t)(evtsPerFile*1.5);
+        fileEvents = evtsPerFile;
     } 
     
-    cout << "Using " << eventBufferSize << " event buffers." << endl;
-
     if (!runtype){
         cout << "Unknown runtype: " << runtypestr << endl;
         return -1;
     }
     
+    //streamed files are appended to every stream_events events, so event
+    //memory only has to hold a few batches rather than a whole file
+    size_t streamEvents = 0;
+    if (run.isMember("stream_events")) {
+        streamEvents = run["stream_events"].cast<int>();
+        if (streamEvents) {
+            cout << "Streaming files out in batches of " << streamEvents << " events" << endl;
+            if (!run.isMember("event_buffer_size")) eventBufferSize = streamEvents*3;
+            fileEvents = streamEvents;
+        }
+    }
+    
+    //raw capture writes each card's readout to disk undecoded, and run types
+    //then count aggregates (V1742 events) instead of events
+    const bool capture = run.isMember("raw_capture") && run["raw_capture"].cast<bool>();
+    const size_t capture_block = (run.isMember("raw_block_kb") ? run["raw_block_kb"].cast<int>() : 4096)*1024ul;
+    const string outfile = run["outfile"].cast<string>();
+    if (capture) cout << "Capturing raw readout, files count aggregates rather than events" << endl;
+    
+    //decoded events are kept in chunks drawn from a shared budget, which by
+    //default holds eventBufferSize events for every channel
+    if (!capture && !eventBufferSize && !run.isMember("event_memory_mb")) {
+        cout << "Event memory cannot be sized from a file of 0 events - set event_buffer_size or event_memory_mb" << endl;
+        return -1;
+    }
+    EventPool *events = NULL;
+    if (!capture) {
+        const size_t chunk_kb = run.isMember("event_chunk_kb") ? run["event_chunk_kb"].cast<int>() : 1024;
+        events = new EventPool(chunk_kb*1024,0);
+    }
+    
     //Every run has these options
     const int linknum = run["link_num"].cast<int>();
     const int temptime = run["check_temps_every"].cast<int>();
@@ -373,7 +761,19 @@ int main(int argc, char **argv) {
         config_only = run["config_only"].cast<bool>();
     }
     
-    cout << "Grabbing V1742 calibration..." << endl;
+    //simulated cards stand in for the crate when RUN[vme_bridge] is "simulated"
+    bool simulated = false;
+    if (run.isMember("vme_bridge")) {
+        const string bridgetype = run["vme_bridge"].cast<string>();
+        if (bridgetype == "simulated") {
+            simulated = true;
+        } else if (bridgetype != "v1718") {
+            cout << "Unknown vme_bridge: " << bridgetype << endl;
+            return -1;
+        }
+    }
+    
+    if (!simulated) cout << "Grabbing V1742 calibration..." << endl;
     
     //This has to be done before using the CANEVME library due to bugs in the
     //CAENDigitizer library... so hack it in here.
@@ -385,6 +785,21 @@ int main(int argc, char **argv) {
         cout << "* V1742 - " << tbl.getIndex() << endl;
         V1742Settings *stngs = new V1742Settings(tbl,db);
         v1742settings.push_back(stngs);
+        if (tbl.isMember("replay")) {
+            //the calibration saved with the capture, if there was one
+            ifstream in(tbl["replay"].cast<string>()+".calib",ios::binary);
+            if (in) {
+                v1742calibs.push_back(new V1742calib(in));
+            } else {
+                cout << "No calibration captured for " << tbl.getIndex() << ", decoding without DRS4 corrections" << endl;
+                v1742calibs.push_back(NULL);
+            }
+            continue;
+        }
+        if (simulated) {
+            v1742calibs.push_back(NULL);
+            continue;
+        }
         v1742calibs.push_back(V1742::staticGetCalib(stngs->sampleFreq(),run["link_num"].cast<int>(),tbl["base_address"].cast<int>()));
     }
 
@@ -392,15 +807,25 @@ int main(int argc, char **argv) {
     
     // ejc
     // from the device having swapped to _1, have tracked this down as a bug?
-    VMEBridge bridge(0,linknum);
+    readout_wait wait = readout_wait_config(run);
+    
+    VMEBridge *bridge = simulated ? new SimVMEBridge(db,0,linknum) : new VMEBridge(0,linknum);
+    try {
+        bridge->setTiming(run);
+    } catch (runtime_error &e) {
+        cout << "Could not set bridge timing: " << e.what() << endl;
+        return -1;
+    }
     
     vector<V65XX*> hvs;
+    vector<string> hvnames;
     vector<RunTable> v65XXs = db.getGroup("V65XX");
     if (v65XXs.size() > 0) cout << "Setting up V65XX HV..." << endl;
     for (size_t i = 0; i < v65XXs.size(); i++) {
         RunTable &tbl = v65XXs[i];
         cout << "\t" << tbl["index"].cast<string>() << endl;
-        hvs.push_back(new V65XX(bridge,tbl["base_address"].cast<int>()));
+        hvs.push_back(new V65XX(*bridge,tbl["base_address"].cast<int>()));
+        hvnames.push_back(tbl["index"].cast<string>());
         hvs.back()->set(tbl);
     }
     
@@ -430,6 +855,7 @@ int main(int argc, char **argv) {
     vector<Digitizer*> digitizers;
     vector<Buffer*> buffers;
     vector<Decoder*> decoders;
+    size_t replays = 0;
     
     vector<RunTable> v1730s = db.getGroup("V1730");
     for (size_t i = 0; i < v1730s.size(); i++) {
@@ -437,13 +863,85 @@ int main(int argc, char **argv) {
         cout << "* V1730 - " << tbl.getIndex() << endl;
         V1730Settings *stngs = new V1730Settings(tbl,db);
         settings.push_back(stngs);
-        digitizers.push_back(new V1730(bridge,tbl["base_address"].cast<int>()));
-        ((V1730*)digitizers.back())->stopAcquisition();
-        ((V1730*)digitizers.back())->calib();
+        if (tbl.isMember("replay")) {
+            if (wait.mode == WAIT_IRQ) {
+                cout << "V1730 " << tbl.getIndex() << " is replayed and cannot raise interrupts" << endl;
+                return -1;
+            }
+            digitizers.push_back(new ReplayDigitizer(*bridge,tbl["base_address"].cast<int>(),tbl["replay"].cast<string>(),tbl.isMember("replay_speed") ? tbl["replay_speed"].cast<double>() : 1.0));
+            replays++;
+        } else {
+            digitizers.push_back(new V1730(*bridge,tbl["base_address"].cast<int>()));
+            ((V1730*)digitizers.back())->stopAcquisition();
+            ((V1730*)digitizers.back())->calib();
+        }
+        if (tbl.isMember("blt_bytes")) digitizers.back()->setTransferSize(tbl["blt_bytes"].cast<int>());
         buffers.push_back(new Buffer(tbl["buffer_size"].cast<int>()*1024*1024));
-        if (!digitizers.back()->program(*stngs)) return -1;
+    }
+    
+    //CHAIN tables group V1730s for MCST programming and start and for CBLT readout
+    vector<V1730Chain*> chains;
+    vector<vector<size_t>> chain_members;
+    vector<bool> chained(v1730s.size(),false);
+    vector<bool> grouped(v1730s.size(),false);
+    vector<RunTable> chaintbls = db.getGroup("CHAIN");
+    for (size_t c = 0; c < chaintbls.size(); c++) {
+        RunTable &tbl = chaintbls[c];
+        cout << "* CHAIN - " << tbl.getIndex() << endl;
+        vector<string> names = tbl["boards"].toVector<string>();
+        vector<V1730*> boards;
+        vector<Buffer*> bufs;
+        chain_members.push_back(vector<size_t>());
+        for (size_t j = 0; j < names.size(); j++) {
+            size_t i;
+            for (i = 0; i < v1730s.size() && settings[i]->getIndex() != names[j]; i++);
+            if (i == v1730s.size()) {
+                cout << "CHAIN " << tbl.getIndex() << " board " << names[j] << " is not a V1730" << endl;
+                return -1;
+            }
+            if (grouped[i]) {
+                cout << "V1730 " << names[j] << " is in more than one CHAIN" << endl;
+                return -1;
+            }
+            if (dynamic_cast<ReplayDigitizer*>(digitizers[i])) {
+                cout << "V1730 " << names[j] << " is replayed and cannot be in a CHAIN" << endl;
+                return -1;
+            }
+            grouped[i] = true;
+            chain_members.back().push_back(i);
+            boards.push_back((V1730*)digitizers[i]);
+            bufs.push_back(buffers[i]);
+        }
+        chains.push_back(new V1730Chain(*bridge,tbl,boards,bufs));
+        for (size_t j = 0; j < chain_members.back().size(); j++) {
+            chained[chain_members.back()[j]] = chains.back()->cbltReadout();
+        }
+    }
+    
+    for (size_t c = 0; c < chains.size(); c++) {
+        if (!chains[c]->mcstProgram()) continue;
+        vector<V1730Settings*> stngs;
+        for (size_t j = 0; j < chain_members[c].size(); j++) {
+            stngs.push_back((V1730Settings*)settings[chain_members[c][j]]);
+        }
+        if (!chains[c]->program(stngs)) return -1;
+    }
+    
+    for (size_t i = 0; i < v1730s.size(); i++) {
+        RunTable &tbl = v1730s[i];
+        bool programmed = false;
+        for (size_t c = 0; c < chains.size(); c++) {
+            if (!chains[c]->mcstProgram()) continue;
+            for (size_t j = 0; j < chain_members[c].size(); j++) programmed |= chain_members[c][j] == i;
+        }
+        if (!programmed && !digitizers[i]->program(*settings[i])) return -1;
+        if (wait.mode == WAIT_IRQ) digitizers[i]->setInterrupt(wait.level,tbl.isMember("irq_events") ? tbl["irq_events"].cast<int>() : 1);
         // decoders need settings after programming
-        decoders.push_back(new V1730Decoder(eventBufferSize,*stngs));
+        if (capture) {
+            decoders.push_back(new RawCapture(tbl.getIndex(),outfile+"."+tbl.getIndex(),capture_block));
+        } else {
+            decoders.push_back(new V1730Decoder(events,*(V1730Settings*)settings[i]));
+        }
     }
     
     for (size_t i = 0; i < v1742s.size(); i++) {
@@ -451,13 +949,91 @@ int main(int argc, char **argv) {
         cout << "* V1742 - " << tbl.getIndex() << endl;
         V1742Settings *stngs = v1742settings[i];
         settings.push_back(stngs);
-        V1742 *card = new V1742(bridge,tbl["base_address"].cast<int>());
-        card->stopAcquisition();
+        Digitizer *card;
+        if (tbl.isMember("replay")) {
+            if (wait.mode == WAIT_IRQ) {
+                cout << "V1742 " << tbl.getIndex() << " is replayed and cannot raise interrupts" << endl;
+                return -1;
+            }
+            card = new ReplayDigitizer(*bridge,tbl["base_address"].cast<int>(),tbl["replay"].cast<string>(),tbl.isMember("replay_speed") ? tbl["replay_speed"].cast<double>() : 1.0);
+            replays++;
+        } else {
+            card = new V1742(*bridge,tbl["base_address"].cast<int>());
+            card->stopAcquisition();
+        }
+        if (tbl.isMember("blt_bytes")) card->setTransferSize(tbl["blt_bytes"].cast<int>());
         digitizers.push_back(card);
         buffers.push_back(new Buffer(tbl["buffer_size"].cast<int>()*1024*1024));
         if (!digitizers.back()->program(*stngs)) return -1;
+        if (wait.mode == WAIT_IRQ) digitizers.back()->setInterrupt(wait.level,tbl.isMember("irq_events") ? tbl["irq_events"].cast<int>() : 1);
         // decoders need settings after programming
-        decoders.push_back(new V1742Decoder(eventBufferSize,v1742calibs[i],*stngs)); 
+        if (capture) {
+            decoders.push_back(new RawCapture(tbl.getIndex(),outfile+"."+tbl.getIndex(),capture_block));
+            //the DRS4 corrections are applied when the capture is converted
+            if (v1742calibs[i]) {
+                ofstream calib(outfile+"."+tbl.getIndex()+".calib",ios::binary);
+                v1742calibs[i]->save(calib);
+                if (!calib) {
+                    cout << "Could not save V1742 calibration of " << tbl.getIndex() << endl;
+                    return -1;
+                }
+            }
+        } else {
+            decoders.push_back(new V1742Decoder(events,v1742calibs[i],*stngs)); 
+        }
+    }
+    
+    //CBLT chains replace the per board readout of their members
+    chained.resize(digitizers.size(),false);
+    
+    if (events) {
+        if (run.isMember("event_memory_mb")) {
+            events->setBudget(run["event_memory_mb"].cast<int>()*1024ul*1024ul);
+            const size_t needed = events->bytesFor(fileEvents);
+            if (events->budget() < needed) {
+                cout << "event_memory_mb must be at least " << (needed+1024*1024-1)/1024/1024 << " to hold " << fileEvents << " events per " << (streamEvents ? "batch" : "file") << endl;
+                return -1;
+            }
+        } else {
+            events->setBudget(events->bytesFor(eventBufferSize));
+        }
+        events->setQuota(fileEvents);
+        cout << "Using up to " << events->budget()/1024/1024 << " MiB of event memory in " << events->chunkBytes()/1024 << " KiB chunks" << endl;
+    }
+    
+    bridge->timingReport(cout);
+    
+    vector<vector<size_t>> layout = readout_layout(run,settings);
+    if (wait.mode == WAIT_IRQ && layout.size() > 1) {
+        //IRQ waits hold the bridge lock, which would serialize the threads
+        cout << "readout_wait irq requires a single readout thread" << endl;
+        return -1;
+    }
+    //a chain is read out by the thread holding its boards, all members must be there
+    vector<vector<V1730Chain*>> thread_chains(layout.size());
+    for (size_t c = 0; c < chains.size(); c++) {
+        if (!chains[c]->cbltReadout()) continue;
+        for (size_t t = 0; t < layout.size(); t++) {
+            vector<size_t> &cards = layout[t];
+            size_t held = 0;
+            for (size_t j = 0; j < chain_members[c].size(); j++) {
+                for (size_t k = 0; k < cards.size(); k++) if (cards[k] == chain_members[c][j]) held++;
+            }
+            if (!held) continue;
+            if (held != chain_members[c].size()) {
+                cout << "CHAIN " << chains[c]->getIndex() << " is split across readout threads" << endl;
+                return -1;
+            }
+            thread_chains[t].push_back(chains[c]);
+        }
+    }
+    if (layout.size() > 1) {
+        cout << "Using " << layout.size() << " readout threads:" << endl;
+        for (size_t t = 0; t < layout.size(); t++) {
+            cout << "\t" << t << " :";
+            for (size_t j = 0; j < layout[t].size(); j++) cout << " " << settings[layout[t][j]]->getIndex();
+            cout << endl;
+        }
     }
     
     size_t arm_last = 0;
@@ -466,6 +1042,14 @@ int main(int argc, char **argv) {
             arm_last = i;
     }
     
+    //boards in an MCST group start and stop together with one cycle to the group
+    vector<int> mcst_group(digitizers.size(),-1);
+    for (size_t c = 0; c < chains.size(); c++) {
+        if (!chains[c]->mcstStart()) continue;
+        for (size_t j = 0; j < chain_members[c].size(); j++) mcst_group[chain_members[c][j]] = c;
+    }
+    const int arm_last_group = digitizers.size() > 0 ? mcst_group[arm_last] : -1;
+    
     cout << "Waiting for HV to stabilize..." << endl;
     
     while (!stop) {
@@ -490,22 +1074,30 @@ int main(int argc, char **argv) {
     pthread_cond_t newdata;
     pthread_mutex_init(&iomutex,NULL);
     pthread_cond_init(&newdata, NULL);
-    vector<uint32_t> temps;
     
+    //temperatures and HV are polled off the readout path from here on
+    SlowControl monitor(digitizers,settings,hvs,hvnames,&iomutex,temptime,60);
+    
+    for (size_t c = 0; c < chains.size(); c++) {
+        if (!chains[c]->mcstStart() || (int)c == arm_last_group) continue;
+        chains[c]->startAcquisition();
+        for (size_t j = 0; j < chain_members[c].size(); j++) {
+            soft_trigger(run,settings[chain_members[c][j]],digitizers[chain_members[c][j]]);
+        }
+    }
     for (size_t i = 0; i < digitizers.size(); i++) {
-        if (i == arm_last) continue;
+        if (i == arm_last || mcst_group[i] >= 0) continue;
         digitizers[i]->startAcquisition();
-        if (run.isMember("soft_trig") && settings[i]->getIndex() == run["soft_trig"].cast<string>()) {
-            cout << "Software triggering " << settings[i]->getIndex() << endl;
-            digitizers[i]->softTrig();
-        }
+        soft_trigger(run,settings[i],digitizers[i]);
     }
-    if (digitizers.size() > 0) {
-        digitizers[arm_last]->startAcquisition();
-        if (run.isMember("soft_trig") && settings[arm_last]->getIndex() == run["soft_trig"].cast<string>()) {
-            cout << "Software triggering " << settings[arm_last]->getIndex() << endl;
-            digitizers[arm_last]->softTrig();
+    if (arm_last_group >= 0) {
+        chains[arm_last_group]->startAcquisition();
+        for (size_t j = 0; j < chain_members[arm_last_group].size(); j++) {
+            soft_trigger(run,settings[chain_members[arm_last_group][j]],digitizers[chain_members[arm_last_group][j]]);
         }
+    } else if (digitizers.size() > 0) {
+        digitizers[arm_last]->startAcquisition();
+        soft_trigger(run,settings[arm_last],digitizers[arm_last]);
     }
     for (size_t i = 0; i < lescopes.size(); i++) {
         lescopes[i]->normal();
@@ -519,6 +1111,19 @@ int main(int argc, char **argv) {
     data.iomutex = &iomutex;
     data.newdata = &newdata;
     data.runtype = runtype;
+    data.monitor = &monitor;
+    DecodePool *pool = new DecodePool(run.isMember("decode_threads") ? run["decode_threads"].cast<int>() : 1);
+    if (pool->threads() > 1) cout << "Using " << pool->threads() << " decode threads" << endl;
+    data.pool = pool;
+    data.events = events;
+    //files are written on their own thread, with up to write_queue more
+    //waiting behind the one being written, and compressed on compress_threads
+    FileWriter writer(run.isMember("write_queue") ? run["write_queue"].cast<int>() : 1,
+                      run.isMember("compress_threads") ? run["compress_threads"].cast<int>() : 2,
+                      &iomutex,&newdata);
+    data.writer = &writer;
+    data.stream_events = streamEvents;
+    data.file_events = fileEvents;
     { //copy entire config as-is to be saved in each file
         std::ifstream file(argv[1]);
         std::stringstream buf;
@@ -528,48 +1133,44 @@ int main(int argc, char **argv) {
     pthread_t decode;
     pthread_create(&decode,NULL,&decode_thread,&data);
     
-    struct timespec last_temp_time, cur_time;
-    clock_gettime(CLOCK_MONOTONIC,&last_temp_time);
+    monitor.start();
     
     if (config_only) stop = true;
+    
+    //with a single layout entry the main loop does the readout itself
+    vector<readout_thread_data> readout_data(layout.size());
+    for (size_t t = 0; t < layout.size(); t++) {
+        readout_data[t].cards = layout[t];
+        readout_data[t].digitizers = &digitizers;
+        readout_data[t].buffers = &buffers;
+        readout_data[t].settings = &settings;
+        readout_data[t].iomutex = &iomutex;
+        readout_data[t].newdata = &newdata;
+        readout_data[t].chained = &chained;
+        readout_data[t].chains = thread_chains[t];
+        readout_data[t].bridge = bridge;
+        readout_data[t].wait = wait;
+        readout_data[t].delay_us = wait.min_us;
+        readout_data[t].polls = readout_data[t].irqs = readout_data[t].timeouts = readout_data[t].bytes = 0;
+        readout_data[t].replayed.assign(digitizers.size(),false);
+        readout_data[t].replays = &replays;
+    }
+    vector<pthread_t> readout(layout.size() > 1 ? layout.size() : 0);
+    for (size_t t = 0; t < readout.size(); t++) {
+        pthread_create(&readout[t],NULL,&readout_thread,&readout_data[t]);
+    }
 
     try { 
         readout_running = true;
         while (readout_running && !stop) {
             //Digitizer loop
-            for (size_t i = 0; i < digitizers.size() && !stop; i++) {
-                Digitizer *dgtz = digitizers[i];
-                if (dgtz->readoutReady()) {
-                    buffers[i]->inc(dgtz->readoutBLT(buffers[i]->wptr(),buffers[i]->free()));
-                    pthread_cond_signal(&newdata);
-                }
-                if (!dgtz->acquisitionRunning()) {
-                    pthread_mutex_lock(&iomutex);
-                    cout << "Digitizer " << settings[i]->getIndex() << " aborted acquisition!" << endl;
-                    pthread_mutex_unlock(&iomutex);
-                    stop = true;
-                }
+            if (readout.size()) {
+                usleep(100000);
+            } else {
+                readout_cards(&readout_data[0]);
             }
             
-            //Temperature check
-            clock_gettime(CLOCK_MONOTONIC,&cur_time);
-            if (cur_time.tv_sec-last_temp_time.tv_sec > temptime) {
-                pthread_mutex_lock(&iomutex);
-                last_temp_time = cur_time;
-                cout << "Temperature check..." << endl;
-                bool overtemp = false;
-                for (size_t i = 0; i < digitizers.size() && !stop; i++) {
-                    overtemp |= digitizers[i]->checkTemps(temps,60);
-                    cout << settings[i]->getIndex() << " : [ " << temps[0];
-                    for (size_t t = 1; t < temps.size(); t++) cout << ", " << temps[t];
-                    cout << " ]" << endl;
-                }
-                if (overtemp) {
-                    cout << "Overtemp! Aborting readout." << endl;
-                    stop = true;
-                }
-                pthread_mutex_unlock(&iomutex);
-            }
+            if (monitor.alarm()) stop = true;
         } 
         readout_running = false;
     } catch (exception &e) {
@@ -581,10 +1182,23 @@ int main(int argc, char **argv) {
     }
     
     stop = true;
+    for (size_t t = 0; t < readout.size(); t++) {
+        pthread_join(readout[t],NULL);
+    }
+    monitor.stop();
     pthread_mutex_lock(&iomutex);
     cout << "Stopping acquisition..." << endl;
     pthread_mutex_unlock(&iomutex);
     
+    for (size_t t = 0; t < readout_data.size(); t++) {
+        const readout_thread_data &rd = readout_data[t];
+        const double mib = rd.bytes/1024.0/1024.0;
+        cout << "Readout " << t << ": " << mib << " MiB"
+             << "\tpolls: " << rd.polls << " (" << (mib > 0 ? rd.polls/mib : 0.0) << " /MiB)"
+             << "\tIRQs: " << rd.irqs << " (" << (mib > 0 ? rd.irqs/mib : 0.0) << " /MiB)"
+             << "\ttimeouts: " << rd.timeouts << endl;
+    }
+    
     for (size_t i = 0; i < lecroy6zis.size(); i++) {
         RunTable &tbl = lecroy6zis[i];
         try { //want to make sure this doesn't ever cause a crash
@@ -602,15 +1216,40 @@ int main(int argc, char **argv) {
             cout << "Could not stop scope! : " << e.what() << endl;
         }
     }
-    if (digitizers.size() > 0) digitizers[arm_last]->stopAcquisition();
+    if (arm_last_group >= 0) {
+        chains[arm_last_group]->stopAcquisition();
+    } else if (digitizers.size() > 0) {
+        digitizers[arm_last]->stopAcquisition();
+    }
+    for (size_t c = 0; c < chains.size(); c++) {
+        if (!chains[c]->mcstStart() || (int)c == arm_last_group) continue;
+        chains[c]->stopAcquisition();
+    }
     for (size_t i = 0; i < digitizers.size(); i++) {
-        if (i == arm_last) continue;
+        if (i == arm_last || mcst_group[i] >= 0) continue;
         digitizers[i]->stopAcquisition();
     }
     pthread_cond_signal(&newdata);
     
-    //busy wait for all data to be written out
-    while (decode_running) { sleep(1); }
+    //wait for all data to be written out
+    pthread_join(decode,NULL);
+    delete pool;
+    writer.report(cout);
+    for (size_t i = 0; i < decoders.size(); i++) {
+        RawCapture *raw = dynamic_cast<RawCapture*>(decoders[i]);
+        if (!raw) continue;
+        try {
+            raw->finish();
+        } catch (runtime_error &e) {
+            cout << "Raw capture failed: " << e.what() << endl;
+        }
+    }
+    
+    bridge->timingReport(cout);
+    for (size_t i = 0; i < digitizers.size(); i++) {
+        cout << settings[i]->getIndex() << " block transfers:" << endl;
+        digitizers[i]->transferReport(cout);
+    }
     
     // Should add some logic to cleanup memory, but we're done anyway
     
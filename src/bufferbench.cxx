@@ -0,0 +1,170 @@
+/**
+ *  Copyright 2014 by Benjamin Land (a.k.a. BenLand100)
+ *
+ *  WbLSdaq is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  WbLSdaq is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include "Buffer.hh"
+
+using namespace std;
+
+// The previous mutex and memmove Buffer, kept here as the reference to beat
+class MutexBuffer {
+    public:
+        MutexBuffer(size_t _size) : size(_size) {
+            buffer = new char[size*2];
+            r_ptr = w_ptr = buffer;
+            pthread_mutex_init(&mutex,NULL);
+        }
+
+        ~MutexBuffer() {
+            delete [] buffer;
+            pthread_mutex_destroy(&mutex);
+        }
+
+        inline size_t free() {
+            pthread_mutex_lock(&mutex);
+            const size_t amt = size - (w_ptr - r_ptr);
+            pthread_mutex_unlock(&mutex);
+            return amt;
+        }
+
+        inline size_t fill() {
+            pthread_mutex_lock(&mutex);
+            const size_t amt = w_ptr - r_ptr;
+            pthread_mutex_unlock(&mutex);
+            return amt;
+        }
+
+        inline void inc(size_t amt) {
+            pthread_mutex_lock(&mutex);
+            w_ptr += amt;
+            if ((size_t)(r_ptr - buffer) >= size) {
+                const size_t total = w_ptr - r_ptr;
+                memmove(buffer,r_ptr,total);
+                r_ptr = buffer;
+                w_ptr = buffer + total;
+            }
+            pthread_mutex_unlock(&mutex);
+        }
+
+        inline void dec(size_t amt) {
+            pthread_mutex_lock(&mutex);
+            r_ptr += amt;
+            pthread_mutex_unlock(&mutex);
+        }
+
+        inline char* wptr() {
+            pthread_mutex_lock(&mutex);
+            char *ptr = w_ptr;
+            pthread_mutex_unlock(&mutex);
+            return ptr;
+        }
+
+        inline char* rptr() {
+            pthread_mutex_lock(&mutex);
+            char *ptr = r_ptr;
+            pthread_mutex_unlock(&mutex);
+            return ptr;
+        }
+
+    protected:
+        pthread_mutex_t mutex;
+        char *buffer, *r_ptr, *w_ptr;
+        size_t size;
+};
+
+template <class B> struct bench_data {
+    B *buffer;
+    size_t total, chunk;
+    const char *payload;
+    uint64_t checksum;
+};
+
+// Mimics the readout loop: copy a BLT worth of data in whenever it fits
+template <class B> void *producer(void *_data) {
+    bench_data<B> *data = (bench_data<B>*)_data;
+    for (size_t written = 0; written < data->total; ) {
+        const size_t amt = data->chunk < data->total-written ? data->chunk : data->total-written;
+        if (data->buffer->free() < amt) continue;
+        memcpy(data->buffer->wptr(),data->payload,amt);
+        data->buffer->inc(amt);
+        written += amt;
+    }
+    pthread_exit(NULL);
+}
+
+// Mimics the decode thread: touch everything available, then release it
+template <class B> void *consumer(void *_data) {
+    bench_data<B> *data = (bench_data<B>*)_data;
+    data->checksum = 0;
+    for (size_t read = 0; read < data->total; ) {
+        const size_t amt = data->buffer->fill();
+        if (!amt) continue;
+        const char *ptr = data->buffer->rptr();
+        for (size_t i = 0; i < amt; i += 64) data->checksum += ptr[i];
+        data->buffer->dec(amt);
+        read += amt;
+    }
+    pthread_exit(NULL);
+}
+
+template <class B> double run(size_t size, size_t total, size_t chunk, const char *payload) {
+    B buffer(size);
+    bench_data<B> data;
+    data.buffer = &buffer;
+    data.total = total;
+    data.chunk = chunk;
+    data.payload = payload;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC,&start);
+    pthread_t prod, cons;
+    pthread_create(&prod,NULL,&producer<B>,&data);
+    pthread_create(&cons,NULL,&consumer<B>,&data);
+    pthread_join(prod,NULL);
+    pthread_join(cons,NULL);
+    clock_gettime(CLOCK_MONOTONIC,&end);
+
+    double time_int = (end.tv_sec - start.tv_sec)+1e-9*(end.tv_nsec - start.tv_nsec);
+    return total/time_int/1024.0/1024.0;
+}
+
+int main(int argc, char **argv) {
+
+    if (argc > 4) {
+        cout << "./bufferbench [buffer MiB = 5] [transfer bytes = 4093] [total MiB = 4096]" << endl;
+        return -1;
+    }
+
+    const size_t size = (argc > 1 ? atoi(argv[1]) : 5)*1024*1024;
+    const size_t chunk = argc > 2 ? atoi(argv[2]) : 4093;
+    const size_t total = (argc > 3 ? atoi(argv[3]) : 4096)*1024ul*1024ul;
+
+    char *payload = new char[chunk];
+    for (size_t i = 0; i < chunk; i++) payload[i] = (char)i;
+
+    cout << "Moving " << total/1024/1024 << " MiB through a " << size/1024/1024 << " MiB buffer in " << chunk << " byte transfers" << endl;
+    cout << "MutexBuffer: " << run<MutexBuffer>(size,total,chunk,payload) << " MiB/s" << endl;
+    cout << "Buffer:      " << run<Buffer>(size,total,chunk,payload) << " MiB/s" << endl;
+
+    delete [] payload;
+    return 0;
+}
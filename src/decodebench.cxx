@@ -0,0 +1,151 @@
+/**
+ *  Copyright 2014 by Benjamin Land (a.k.a. BenLand100)
+ *
+ *  WbLSdaq is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  WbLSdaq is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#include "V1730_dpppsd.hh"
+#include "EventStore.hh"
+#include "Buffer.hh"
+
+using namespace std;
+
+// All 16 channels enabled with the same record length and event format
+class BenchSettings : public V1730Settings {
+    public:
+        BenchSettings(uint32_t samples, bool waveforms, bool extras) : V1730Settings() {
+            index = "bench";
+            card.oscilloscope_mode = waveforms ? 1 : 0;
+            card.extras = extras ? 1 : 0;
+            for (uint32_t ch = 0; ch < 16; ch++) {
+                chans[ch].enabled = 1;
+                groups[ch/2].record_length = samples;
+            }
+        }
+};
+
+// Board aggregates as a V1730 would send them, each with nev events on every
+// channel, like SimV1730::buildAggregate
+void build_aggregates(vector<uint32_t> &words, size_t total_bytes, uint32_t samples, bool waveforms, bool extras, size_t nev) {
+    const uint32_t evwords = (waveforms ? samples/2 : 0) + (extras ? 1 : 0) + 2;
+    const size_t aggwords = 4 + 8*(2 + nev*2*evwords);
+    words.clear();
+    for (uint32_t agg = 0; (words.size()+aggwords)*4 <= total_bytes; agg++) {
+        const size_t offset = words.size();
+        words.resize(offset+aggwords);
+        uint32_t *board = &words[offset];
+        board[0] = 0xA0000000 | aggwords;
+        board[1] = 0xFF;
+        board[2] = agg;
+        board[3] = agg;
+        uint32_t *chan = board+4;
+        for (uint32_t gr = 0; gr < 8; gr++) {
+            chan[0] = 0x80000000 | (2 + nev*2*evwords);
+            chan[1] = (samples/8) | (waveforms << 27) | (extras << 28) | (1 << 29) | (1 << 30);
+            uint32_t *event = chan+2;
+            for (size_t ev = 0; ev < nev; ev++) {
+                const uint64_t timetag = (agg*nev+ev)*1000;
+                for (uint32_t odd = 0; odd < 2; odd++) {
+                    event[0] = (odd << 31) | (timetag & 0x7FFFFFFF);
+                    if (waveforms) {
+                        for (uint32_t i = 0; i < samples/2; i++) event[1+i] = rand() & 0x3FFF3FFF;
+                    }
+                    if (extras) event[evwords-2] = 8000 | (((timetag >> 31) & 0xFFFF) << 16);
+                    event[evwords-1] = 500 | (1000 << 16);
+                    event += evwords;
+                }
+            }
+            chan = event;
+        }
+    }
+}
+
+//returns events/s decoding the aggregates in words repeatedly until total bytes
+//are done, and how many events and bytes that was
+double run(EventPool &pool, BenchSettings &settings, vector<uint32_t> &words, size_t total, size_t &events, size_t &decoded) {
+    const size_t bytes = words.size()*4;
+    Buffer buffer(bytes + 4096);
+    double elapsed = 0.0;
+    events = decoded = 0;
+    for (size_t done = 0; done < total; done += bytes) {
+        memcpy(buffer.wptr(),words.data(),bytes);
+        buffer.inc(bytes);
+        V1730Decoder decoder(&pool,settings);
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC,&start);
+        decoder.decode(buffer);
+        clock_gettime(CLOCK_MONOTONIC,&end);
+        decoder.report();
+
+        if (buffer.fill()) {
+            cout << "Decoder left " << buffer.fill() << " bytes" << endl;
+            exit(1);
+        }
+        elapsed += (end.tv_sec - start.tv_sec)+1e-9*(end.tv_nsec - start.tv_nsec);
+        events += decoder.eventsReady()*16;
+        decoded += bytes;
+    }
+    return events/elapsed;
+}
+
+int main(int argc, char **argv) {
+
+    if (argc > 3) {
+        cout << "./decodebench [samples per event = 504] [total MiB = 1024]" << endl;
+        return -1;
+    }
+
+    const uint32_t samples = argc > 1 ? atoi(argv[1]) : 504;
+    const size_t total = (argc > 2 ? atoi(argv[2]) : 1024)*1024ul*1024ul;
+    if (samples%8 || !samples) {
+        cout << "samples must be a nonzero multiple of 8" << endl;
+        return -1;
+    }
+
+    //room for every event of a 64 MiB block of aggregates
+    const size_t block = 64*1024*1024;
+    EventPool pool(1024*1024,0);
+
+    struct {
+        const char *name;
+        bool waveforms, extras;
+        size_t nev;
+    } formats[] = {
+        { "waveforms", true, true, 0 },
+        { "list mode", false, true, 512 },
+        { "list mode without extras", false, false, 512 }
+    };
+    //channel aggregates hold at most 0x7FFF words
+    formats[0].nev = 0x7FFF/(2*(samples/2+3)) < 1023 ? 0x7FFF/(2*(samples/2+3)) : 1023;
+
+    cout << "Decoding " << total/1024/1024 << " MiB of V1730 board aggregates with 16 channels" << endl;
+    for (size_t i = 0; i < 3; i++) {
+        BenchSettings settings(samples,formats[i].waveforms,formats[i].extras);
+        vector<uint32_t> words;
+        build_aggregates(words,block,samples,formats[i].waveforms,formats[i].extras,formats[i].nev);
+        pool.setBudget(2*block*(formats[i].waveforms ? 2 : 4));
+        size_t events, decoded;
+        const double rate = run(pool,settings,words,total,events,decoded);
+        cout << formats[i].name << ":\t" << rate/1e6 << " M events/s\t" << rate*decoded/events/1024/1024 << " MiB/s" << endl;
+    }
+
+    return 0;
+}
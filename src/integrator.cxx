@@ -12,6 +12,8 @@
 #include <sstream>
 #include <json.hh>
 
+#include "Integrate.hh"
+
 using namespace std;
 using namespace H5;
 
@@ -23,19 +25,10 @@ using namespace H5;
 
 enum storagetype { FAST, MASTER };
 
-class intspec {
+class intspec : public IntegrateSpec {
     public:
-        uint16_t maxval;
         const string group;
         const storagetype type;
-        double ps_sample;
-        double V_adc;
-        int pedstart, pedend;
-        double pedcut;
-        int sigstart, sigend;
-        double threshold;
-        int cfdwindow;
-        string name;
         bool rawtraces;
         
         //fast only
@@ -45,14 +38,7 @@ class intspec {
         intspec(string _group, storagetype _type) : 
             group(_group), 
             type(_type),
-            pedstart(-1), 
-            pedend(-1), 
-            pedcut(0.0), 
-            sigstart(-1), 
-            sigend(-1),
-            threshold(0.0),
-            cfdwindow(-1),
-            name("") {
+            rawtraces(false) {
             if (type == FAST) {
                 grnum = stoi(group.substr(group.find("gr")+2,1));
             } else {
@@ -60,11 +46,6 @@ class intspec {
             }
         }
         
-        bool check() {
-            return (threshold == 0.0 ? !((pedend != -1) ^ (pedend != -1)) && (cfdwindow == -1) : (pedend != -1) && (pedend != -1))
-                   && (sigstart != -1) && (sigend != -1) && name.length() != 0;
-        }
-        
         virtual void init(H5File &file) {
             string card = group.substr(0,group.find("/",1));
             Group card_group = file.openGroup(card.c_str());
@@ -72,16 +53,12 @@ class intspec {
             uint32_t bits;
             Attribute bits_attrib = card_group.openAttribute("bits");
             bits_attrib.read(PredType::NATIVE_UINT32, &bits);
-            V_adc = (type == MASTER ? 2.0 : 1.0)/pow(2,bits);
-            maxval = 1<<bits;
             
             Attribute ns_sample_attrib = card_group.openAttribute("ns_sample");
             double ns_sample;
             ns_sample_attrib.read(PredType::NATIVE_DOUBLE, &ns_sample);
-            ps_sample = 1000.0 * ns_sample;
             
-            //convert threshold from mV to ADC here
-            threshold /= V_adc*1000.0;
+            setADC(bits, type == MASTER ? 2.0 : 1.0, ns_sample);
         }
         
 };
@@ -476,78 +453,25 @@ int main(int argc, char **argv) {
             if ((specs[i]->type == MASTER ? mi : fi) != -1) {
                 const size_t index = specs[i]->type == MASTER ? mi : fi;
                 const size_t offset = index*data[i].samples;
-                double pedmean = 0;
+                integral result;
+                specs[i]->integrate(data[i].data+offset, result);
                 if (specs[i]->pedstart != -1) {
-                    uint16_t pedmin = 0xFFFF;
-                    uint16_t pedmax = 0;
-                    for (int j = specs[i]->pedstart; j < specs[i]->pedend; j++) {
-                        const uint16_t val = data[i].data[offset+j];
-                        pedmean += val;
-                        if (val > pedmax) pedmax = val;
-                        if (val < pedmin) pedmin = val;
-                    }
-                    pedmean /= (specs[i]->pedend - specs[i]->pedstart);
-                    intevents[i].pedmean.push_back(1000.0*specs[i]->V_adc*pedmean);
+                    intevents[i].pedmean.push_back(result.pedmean);
                     if (specs[i]->pedcut > 0) {
-                        intevents[i].pedvalid.push_back((pedmax-pedmin)*specs[i]->V_adc*1000.0 < specs[i]->pedcut ? 1 : 0);
+                        intevents[i].pedvalid.push_back(result.pedvalid);
                     }
                 }
                 if (specs[i]->rawtraces) {
                     for (size_t j = 0; j < data[i].samples; j++) {
-                        intevents[i].traces.push_back((data[i].data[offset+j]-pedmean)*specs[i]->V_adc*1000.0);
+                        intevents[i].traces.push_back(data[i].data[offset+j]*specs[i]->V_adc*1000.0-result.pedmean);
                     }
                 }
-                double sigcharge = 0;
-                if (specs[i]->threshold == 0.0) {
-                    for (int j = specs[i]->sigstart; j < specs[i]->sigend; j++) {
-                        sigcharge += data[i].data[offset+j];
-                    }
-                } else {
-                    bool crossed = false;
-                    if (specs[i]->threshold > 0.0) { //downward going pulses
-                        for (int j = specs[i]->sigstart; j < specs[i]->sigend; j++) {
-                            sigcharge += data[i].data[offset+j];
-                            if (!crossed && pedmean-data[i].data[offset+j] > specs[i]->threshold) {
-                                if (specs[i]->cfdwindow != -1) {
-                                    const int end = specs[i]->sigend < (j + specs[i]->cfdwindow) ? specs[i]->sigend : (j + specs[i]->cfdwindow);
-                                    const int begin = specs[i]->sigstart > (j - specs[i]->cfdwindow) ? specs[i]->sigstart : (j - specs[i]->cfdwindow);
-                                    uint16_t peak = pedmean;
-                                    for (int k = j; k <= end; k++) if (data[i].data[offset+k] < peak) peak = data[i].data[offset+k];
-                                    double thresh = round((pedmean-peak)*0.5);
-                                    if (thresh < specs[i]->threshold) continue;
-                                    for (int k = begin; k <= end; k++) {
-                                        if (pedmean-data[i].data[offset+k] > thresh) {
-                                            const double prev = pedmean-data[i].data[offset+k-1];
-                                            const double cur = pedmean-data[i].data[offset+k];
-                                            intevents[i].times.push_back(specs[i]->ps_sample*((thresh-prev)/(cur-prev)+k));
-                                            crossed = true;
-                                            break;
-                                        }
-                                    }
-                                } else {
-                                    const double prev = pedmean-data[i].data[offset+j-1];
-                                    const double cur = pedmean-data[i].data[offset+j];
-                                    intevents[i].times.push_back(specs[i]->ps_sample*((specs[i]->threshold-prev)/(cur-prev)+j));
-                                    crossed = true;
-                                }
-                            }
-                        }
-                    } else { //upward going pulses
-                        for (int j = specs[i]->sigstart; j < specs[i]->sigend; j++) {
-                            sigcharge += data[i].data[offset+j];
-                            if (!crossed && pedmean-data[i].data[offset+j] < specs[i]->threshold) {
-                                const double prev = data[i].data[offset+j-1]-pedmean;
-                                const double cur = data[i].data[offset+j]-pedmean;
-                                intevents[i].times.push_back(specs[i]->ps_sample*((-specs[i]->threshold-prev)/(cur-prev)+j));
-                                crossed = true;
-                            }
-                        }
-                    }
-                    if (tcorrfname.length() > 0 && crossed) { 
+                if (specs[i]->threshold != 0.0) {
+                    if (tcorrfname.length() > 0 && result.time != -1.0) { 
                         //TIME CORRECTION CODE
                         if (specs[i]->type == FAST) {
                             const uint16_t start_cell = data[i].start_index[index];
-                            const double crossing = intevents[i].times.back();
+                            const double crossing = result.time;
                             const double residual = crossing-round(crossing);
                             const size_t sample = round(crossing)/specs[i]->ps_sample;
                             const size_t cell = (start_cell+sample)%1024;
@@ -556,14 +480,12 @@ int main(int argc, char **argv) {
                             const double tnext = specs[i]->group_cell_delays[(cell+1)%1024];
                             const double tfine = (tnext-tcross > 0.0 ? tnext-tcross : tnext-tcross+1.024*specs[i]->ps_sample)*residual;
                             
-                            intevents[i].times.back() = 1000.0 * ((tcross - t0 > 0.0 ? tcross - t0 : tcross - t0 + 1.024*specs[i]->ps_sample) + tfine);
+                            result.time = 1000.0 * ((tcross - t0 > 0.0 ? tcross - t0 : tcross - t0 + 1.024*specs[i]->ps_sample) + tfine);
                         }
-                    } else {
-                        intevents[i].times.push_back(-1.0);
                     }
+                    intevents[i].times.push_back(result.time);
                 }
-                sigcharge -= pedmean * (specs[i]->sigend - specs[i]->sigstart);
-                intevents[i].sigcharge.push_back(-specs[i]->ps_sample * specs[i]->V_adc * sigcharge);
+                intevents[i].sigcharge.push_back(result.sigcharge);
             } else {
                 if (specs[i]->pedstart != -1) 
                     intevents[i].pedmean.push_back(0.0);
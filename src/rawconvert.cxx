@@ -0,0 +1,181 @@
+/**
+ *  Copyright 2014 by Benjamin Land (a.k.a. BenLand100)
+ *
+ *  WbLSdaq is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  WbLSdaq is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "RunDB.hh"
+#include "V1730_dpppsd.hh"
+#include "V1742.hh"
+#include "EventStore.hh"
+#include "Compression.hh"
+#include "Buffer.hh"
+
+using namespace std;
+using namespace H5;
+
+// Decodes one card's raw capture into file, batch events at a time so memory
+// does not grow with the capture, returns the number of events written
+size_t convert(const string &rawname, Decoder &decoder, Buffer &buffer, EventPool &pool, size_t batch, H5File &file, ChunkCompressor &compressor) {
+    const int fd = open(rawname.c_str(), O_RDONLY);
+    if (fd < 0) throw runtime_error("Could not open " + rawname + ": " + strerror(errno));
+
+    size_t events = 0;
+    bool eof = false;
+    for (;;) {
+        while (!eof && buffer.free()) {
+            const ssize_t got = read(fd, buffer.wptr(), buffer.free());
+            if (got < 0 && errno == EINTR) continue;
+            if (got < 0) {
+                close(fd);
+                throw runtime_error("Could not read " + rawname + ": " + strerror(errno));
+            }
+            if (got == 0) eof = true;
+            buffer.inc(got);
+        }
+
+        const size_t before = buffer.fill(), misses = pool.misses();
+        try {
+            decoder.decode(buffer);
+        } catch (runtime_error &e) {
+            close(fd);
+            throw;
+        }
+        //the decoders report every pass, which is only noise here
+        decoder.report();
+
+        const size_t ready = decoder.eventsReady();
+        const bool full = pool.misses() != misses;
+        if (ready && (ready >= batch || full || eof)) {
+            DecodedBatch *decoded = decoder.detach(ready);
+            decoded->writeOut(file, compressor, true, cout);
+            delete decoded;
+            events += ready;
+        } else if (full) {
+            close(fd);
+            throw runtime_error("Event memory is full without a whole event on every channel, use a larger batch");
+        } else if (eof && buffer.fill() == before) {
+            if (buffer.fill()) cout << "Ignoring " << buffer.fill() << " bytes of a partial aggregate at the end of " << rawname << endl;
+            break;
+        }
+    }
+    close(fd);
+    buffer.dec(buffer.fill());
+    return events;
+}
+
+int main(int argc, char **argv) {
+
+    if (argc < 3 || argc > 5) {
+        cout << "./rawconvert config.json capture [output.h5] [batch events]" << endl;
+        cout << "\tdecodes capture.<index>.raw of each V1730 and V1742 in config.json, as captured with raw_capture" << endl;
+        return -1;
+    }
+
+    Exception::dontPrint();
+
+    RunDB db;
+    db.addFile(argv[1]);
+    RunTable run = db.getTable("RUN");
+    const string capture = argv[2];
+    const string outname = argc > 3 ? argv[3] : capture + ".h5";
+    size_t batch = argc > 4 ? atoi(argv[4]) : 10000;
+    if (!batch) batch = 10000;
+
+    const size_t chunk_kb = run.isMember("event_chunk_kb") ? run["event_chunk_kb"].cast<int>() : 1024;
+    EventPool pool(chunk_kb*1024,0);
+
+    vector<string> indexes;
+    vector<Decoder*> decoders;
+    vector<Buffer*> buffers;
+
+    vector<RunTable> v1730s = db.getGroup("V1730");
+    for (size_t i = 0; i < v1730s.size(); i++) {
+        RunTable &tbl = v1730s[i];
+        V1730Settings *stngs = new V1730Settings(tbl,db);
+        //as the card was programmed when capturing
+        stngs->roundRecordLengths();
+        indexes.push_back(tbl.getIndex());
+        decoders.push_back(new V1730Decoder(&pool,*stngs));
+        buffers.push_back(new Buffer(tbl["buffer_size"].cast<int>()*1024*1024));
+    }
+
+    vector<RunTable> v1742s = db.getGroup("V1742");
+    for (size_t i = 0; i < v1742s.size(); i++) {
+        RunTable &tbl = v1742s[i];
+        V1742Settings *stngs = new V1742Settings(tbl,db);
+        V1742calib *calib = NULL;
+        ifstream in(capture+"."+tbl.getIndex()+".calib",ios::binary);
+        if (in) {
+            calib = new V1742calib(in);
+        } else {
+            cout << "No calibration captured for " << tbl.getIndex() << ", decoding without DRS4 corrections" << endl;
+        }
+        indexes.push_back(tbl.getIndex());
+        decoders.push_back(new V1742Decoder(&pool,calib,*stngs));
+        buffers.push_back(new Buffer(tbl["buffer_size"].cast<int>()*1024*1024));
+    }
+
+    pool.setBudget(pool.bytesFor(batch*2));
+    pool.setQuota(batch);
+    cout << "Using up to " << pool.budget()/1024/1024 << " MiB of event memory for batches of " << batch << " events" << endl;
+
+    ChunkCompressor compressor(run.isMember("compress_threads") ? run["compress_threads"].cast<int>() : 2);
+
+    try {
+        H5File file(outname, H5F_ACC_TRUNC);
+
+        //the same root attributes as a file written by WbLSdaq
+        stringstream config;
+        config << ifstream(argv[1]).rdbuf();
+        DataSpace scalar(0,NULL);
+        Group root = file.openGroup("/");
+        StrType configdtype(PredType::C_S1, config.str().size());
+        Attribute attr = root.createAttribute("run_config",configdtype,scalar);
+        attr.write(configdtype,config.str().c_str());
+        int epochtime = time(NULL);
+        Attribute timestamp = root.createAttribute("created_unix_timestamp",PredType::NATIVE_INT,scalar);
+        timestamp.write(PredType::NATIVE_INT,&epochtime);
+
+        cout << "Saving data to " << outname << endl;
+        for (size_t i = 0; i < decoders.size(); i++) {
+            const string rawname = capture + "." + indexes[i] + ".raw";
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC,&start);
+            const size_t events = convert(rawname,*decoders[i],*buffers[i],pool,batch,file,compressor);
+            clock_gettime(CLOCK_MONOTONIC,&end);
+            const double took = (end.tv_sec - start.tv_sec)+1e-9*(end.tv_nsec - start.tv_nsec);
+            cout << "Converted " << events << " events per channel from " << rawname << " in " << took << " s" << endl;
+        }
+        file.flush(H5F_SCOPE_LOCAL);
+    } catch (runtime_error &e) {
+        cout << "Conversion failed: " << e.what() << endl;
+        return 1;
+    } catch (H5::Exception &e) {
+        cout << "Conversion failed: " << e.getDetailMsg() << endl;
+        return 1;
+    }
+
+    return 0;
+}
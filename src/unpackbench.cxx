@@ -0,0 +1,247 @@
+/**
+ *  Copyright 2014 by Benjamin Land (a.k.a. BenLand100)
+ *
+ *  WbLSdaq is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  WbLSdaq is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with WbLSdaq. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <algorithm>
+
+#include "Unpack.hh"
+
+using namespace std;
+
+// Packed V1742 group data (8 channels) and TR data for a number of events,
+// unpacked the way V1742Decoder does it, and V1730 channel aggregates walked
+// the way V1730Decoder::decode_chan_agg does it
+struct bench_data {
+    size_t nsamples, nevents;
+    vector<uint32_t> words;
+    vector<uint16_t> out;
+    vector<uint32_t> chanagg;
+    vector<uint8_t> probes;
+    //raw V1742 groups (8 channels and TR) with the start index of each event,
+    //corrected in place after copying to out like V1742calib does
+    vector<uint16_t> raw, start_index;
+    vector<int16_t> seq_offset, cell_offset; //9x1024 and 9x2048 as in V1742calib
+};
+
+double elapsed(struct timespec &start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC,&end);
+    return (end.tv_sec - start.tv_sec)+1e-9*(end.tv_nsec - start.tv_nsec);
+}
+
+//returns MiB/s of packed input for the group (8 channel) kernel
+double run_channels(bench_data &data, size_t total) {
+    const size_t event_bytes = data.nsamples*12;
+    uint16_t *chans[8];
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC,&start);
+    size_t done = 0;
+    for (size_t ev = 0; done < total; ev = (ev+1)%data.nevents, done += event_bytes) {
+        for (size_t ch = 0; ch < 8; ch++) chans[ch] = data.out.data() + (ev*8+ch)*data.nsamples;
+        unpack12_channels(data.words.data() + ev*data.nsamples*3, chans, data.nsamples);
+    }
+    return done/elapsed(start)/1024.0/1024.0;
+}
+
+//returns MiB/s of packed input for the TR (single channel) kernel
+double run_stream(bench_data &data, size_t total) {
+    const size_t event_bytes = data.nsamples*12;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC,&start);
+    size_t done = 0;
+    for (size_t blk = 0; done < total; blk = (blk+1)%(data.nevents*8), done += event_bytes/8) {
+        unpack12_stream(data.words.data() + blk*data.nsamples*3/8, data.out.data() + blk*data.nsamples, data.nsamples);
+    }
+    return done/elapsed(start)/1024.0/1024.0;
+}
+
+//returns MiB/s of channel aggregate for the V1730 kernel
+double run_pairs(bench_data &data, size_t total, bool probes) {
+    const size_t event_words = data.nsamples/2+3;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC,&start);
+    size_t done = 0;
+    while (done < total) {
+        const uint32_t *event = data.chanagg.data();
+        for (size_t ev = 0; ev < data.nevents; ev++, event += event_words) {
+            unpack14_pairs(event+1, data.out.data() + ev*data.nsamples, probes ? data.probes.data() + ev*data.nsamples : NULL, data.nsamples);
+        }
+        done += data.chanagg.size()*4;
+    }
+    return done/elapsed(start)/1024.0/1024.0;
+}
+
+//returns MiB/s of 9 channel groups, including the copy the correction works on
+double run_drs4(bench_data &data, size_t total) {
+    const size_t group = data.nsamples*9;
+    uint16_t *chans[9];
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC,&start);
+    size_t done = 0;
+    for (size_t ev = 0; done < total; ev = (ev+1)%data.nevents, done += group*2) {
+        memcpy(data.out.data() + ev*group, data.raw.data() + ev*group, group*2);
+        for (size_t ch = 0; ch < 9; ch++) {
+            chans[ch] = data.out.data() + ev*group + ch*data.nsamples;
+            drs4_offsets(chans[ch], data.seq_offset.data() + ch*1024, data.cell_offset.data() + ch*2048 + data.start_index[ev], data.nsamples);
+        }
+        drs4_spikes(chans,9,data.nsamples);
+    }
+    return done/elapsed(start)/1024.0/1024.0;
+}
+
+//the correction as V1742calib did it before the kernels, for reference
+void ref_drs4(bench_data &data, vector<uint16_t> &out) {
+    const size_t group = data.nsamples*9, n = data.nsamples;
+    out = data.raw;
+    for (size_t ev = 0; ev < data.nevents; ev++) {
+        uint16_t *samps[9];
+        for (size_t ch = 0; ch < 9; ch++) {
+            samps[ch] = out.data() + ev*group + ch*n;
+            for (size_t i = 0; i < n; i++) {
+                if (samps[ch][i] == 0 || samps[ch][i] == 4095) continue;
+                samps[ch][i] = samps[ch][i] - data.seq_offset[ch*1024+i] - data.cell_offset[ch*2048+(data.start_index[ev]+i)%1024];
+                if (samps[ch][i] >= 0xF000) {
+                    samps[ch][i] = 0;
+                } else if (samps[ch][i] >= 0x0FFF) {
+                    samps[ch][i] = 0x0FFF;
+                }
+            }
+        }
+        for (size_t i = 0; i < n; i++) {
+            int identified = 0;
+            for (size_t ch = 0; ch < 9; ch++) {
+                if (samps[ch][i]-samps[ch][(i+1)%n] > 30 && samps[ch][(i+3)%n]-samps[ch][(i+2)%n] > 30) identified++;
+            }
+            if (identified > 4) {
+                for (size_t ch = 0; ch < 8; ch++) {
+                    samps[ch][(i+1)%n] += 53;
+                    samps[ch][(i+2)%n] += 53;
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+
+    if (argc > 4) {
+        cout << "./unpackbench [samples per channel = 1024] [events = 256] [total MiB = 4096]" << endl;
+        return -1;
+    }
+
+    bench_data data;
+    data.nsamples = argc > 1 ? atoi(argv[1]) : 1024;
+    data.nevents = argc > 2 ? atoi(argv[2]) : 256;
+    const size_t total = (argc > 3 ? atoi(argv[3]) : 4096)*1024ul*1024ul;
+    if (data.nsamples%8 || !data.nsamples || !data.nevents) {
+        cout << "samples must be a nonzero multiple of 8" << endl;
+        return -1;
+    }
+
+    //one extra block so the vector kernels may read past the last event
+    data.words.resize((data.nevents*data.nsamples+8)*3);
+    for (size_t i = 0; i < data.words.size(); i++) data.words[i] = rand();
+    data.out.resize(data.nevents*data.nsamples*8);
+    //time tag, sample pairs, baseline/extras, charge per event
+    data.chanagg.resize(data.nevents*(data.nsamples/2+3));
+    for (size_t i = 0; i < data.chanagg.size(); i++) data.chanagg[i] = rand();
+    data.probes.resize(data.nevents*data.nsamples);
+    //baselines near the rails with noise, some railed samples, and a spike
+    //common to all channels in most events so both correction paths run
+    data.raw.resize(data.nevents*data.nsamples*9);
+    data.start_index.resize(data.nevents);
+    for (size_t ev = 0; ev < data.nevents; ev++) {
+        data.start_index[ev] = rand()%1024;
+        const size_t spike = rand()%data.nsamples;
+        for (size_t ch = 0; ch < 9; ch++) {
+            uint16_t *samps = data.raw.data() + (ev*9+ch)*data.nsamples;
+            const int base = ch%3 == 0 ? 20 : ch%3 == 1 ? 4070 : 2000;
+            for (size_t i = 0; i < data.nsamples; i++) {
+                const int v = base + rand()%21 - 10 - ((i+data.nsamples-spike)%data.nsamples - 1 < 2 ? 60 : 0);
+                samps[i] = rand()%64 == 0 ? 0 : v < 0 ? 0 : v > 4095 ? 4095 : v;
+            }
+        }
+    }
+    data.seq_offset.resize(9*1024);
+    for (size_t i = 0; i < data.seq_offset.size(); i++) data.seq_offset[i] = rand()%41 - 20;
+    data.cell_offset.resize(9*2048);
+    for (size_t ch = 0; ch < 9; ch++) {
+        for (size_t i = 0; i < 1024; i++) data.cell_offset[ch*2048+i] = data.cell_offset[ch*2048+i+1024] = rand()%81 - 40;
+    }
+    data.out.resize(max(data.out.size(),data.raw.size()));
+
+    //the scalar kernel is the reference every other level must reproduce
+    unpack_select(UNPACK_SCALAR);
+    run_channels(data,data.nevents*data.nsamples*12);
+    vector<uint16_t> ref_channels = data.out;
+    run_stream(data,data.nevents*data.nsamples*12);
+    vector<uint16_t> ref_stream = data.out;
+    run_pairs(data,1,true);
+    vector<uint16_t> ref_pairs(data.out.begin(),data.out.begin()+data.nevents*data.nsamples);
+    vector<uint8_t> ref_probes = data.probes;
+
+    cout << "Unpacking " << total/1024/1024 << " MiB of " << data.nsamples << " sample V1742 groups from " << data.nevents << " events" << endl;
+    const UnpackISA levels[] = { UNPACK_SCALAR, UNPACK_SSE41, UNPACK_AVX2 };
+    for (size_t i = 0; i < 3; i++) {
+        if (unpack_select(levels[i]) != levels[i]) {
+            cout << unpack_name(levels[i]) << ": not supported" << endl;
+            continue;
+        }
+        memset(data.out.data(),0,data.out.size()*2);
+        run_channels(data,data.nevents*data.nsamples*12);
+        const bool ok_channels = data.out == ref_channels;
+        memset(data.out.data(),0,data.out.size()*2);
+        run_stream(data,data.nevents*data.nsamples*12);
+        const bool ok_stream = data.out == ref_stream;
+        cout << unpack_name(levels[i]) << ":\tgroup " << run_channels(data,total) << " MiB/s" << (ok_channels ? "" : " (MISMATCH)")
+             << "\tTR " << run_stream(data,total) << " MiB/s" << (ok_stream ? "" : " (MISMATCH)") << endl;
+    }
+
+    cout << "Unpacking " << total/1024/1024 << " MiB of " << data.nsamples << " sample V1730 channel aggregates from " << data.nevents << " events" << endl;
+    for (size_t i = 0; i < 3; i++) {
+        if (unpack_select(levels[i]) != levels[i]) {
+            cout << unpack_name(levels[i]) << ": not supported" << endl;
+            continue;
+        }
+        memset(data.out.data(),0,data.out.size()*2);
+        memset(data.probes.data(),0,data.probes.size());
+        run_pairs(data,1,true);
+        const bool ok = equal(ref_pairs.begin(),ref_pairs.end(),data.out.begin()) && data.probes == ref_probes;
+        cout << unpack_name(levels[i]) << ":\tsamples " << run_pairs(data,total,false) << " MiB/s"
+             << "\t+probes " << run_pairs(data,total,true) << " MiB/s" << (ok ? "" : " (MISMATCH)") << endl;
+    }
+
+    cout << "Correcting " << total/1024/1024 << " MiB of " << data.nsamples << " sample V1742 groups (with TR) from " << data.nevents << " events" << endl;
+    vector<uint16_t> ref_corrected;
+    ref_drs4(data,ref_corrected);
+    for (size_t i = 0; i < 3; i++) {
+        if (unpack_select(levels[i]) != levels[i]) {
+            cout << unpack_name(levels[i]) << ": not supported" << endl;
+            continue;
+        }
+        memset(data.out.data(),0,data.out.size()*2);
+        run_drs4(data,data.nevents*data.nsamples*9*2);
+        const bool ok = equal(ref_corrected.begin(),ref_corrected.end(),data.out.begin());
+        cout << unpack_name(levels[i]) << ":	DRS4 " << run_drs4(data,total) << " MiB/s" << (ok ? "" : " (MISMATCH)") << endl;
+    }
+
+    return 0;
+}